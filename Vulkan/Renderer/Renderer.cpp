@@ -6,7 +6,11 @@
 #include "../Vulkan/VulkanDevice.h"
 #include "../Vulkan/VulkanShader.h"
 #include "../Vulkan/VulkanPipelineCache.h"
+#include "../Vulkan/VulkanPipelineCompiler.h"
+#include "../Vulkan/VulkanLayoutCache.h"
+#include "../Vulkan/VulkanPipelineRegistry.h"
 #include "../Vulkan/VulkanComputePipeline.h"
+#include "../Vulkan/VulkanComputeAutotuner.h"
 #include "../Vulkan/VulkanGraphicsPipeline.h"
 #include "../Vulkan/VulkanSwapchain.h"
 #include "../Vulkan/VulkanFramebuffer.h"
@@ -15,6 +19,9 @@
 #include "../Vulkan/VulkanSemaphore.h"
 #include "../Vulkan/VulkanCommandManager.h"
 #include "../Vulkan/VulkanStagingManager.h"
+#include "../Vulkan/VulkanUploadManager.h"
+#include "../Vulkan/VulkanGeometryArena.h"
+#include "../Vulkan/VulkanBindlessHeap.h"
 
 #include "../Core/Mesh.h"
 
@@ -25,6 +32,8 @@
 #include "glm/gtc/matrix_transform.hpp"
 
 #include <array>
+#include <algorithm>
+#include <iostream>
 
 static constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 3;
 static uint32_t s_CurrentFrame = 0;
@@ -66,9 +75,9 @@ struct Data
 
 	Mesh* Mesh = nullptr;
 	VulkanTexture2D* Texture = nullptr;
-	VulkanBuffer* VertexBuffer = nullptr;
+	VulkanGeometryArena* GeometryArena = nullptr; // Vertices and indices of all meshes
+	GeometryAllocation MeshGeometry;
 	VulkanBuffer* InstanceBuffer = nullptr;
-	VulkanBuffer* IndexBuffer = nullptr;
 	float RotationSpeed = 0.5f;
 
 	static constexpr uint32_t s_InstanceCount = 10;
@@ -151,7 +160,12 @@ static void InitImGui()
 	init_info.ImageCount = MAX_FRAMES_IN_FLIGHT;
 	init_info.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
 
-	ImGui_ImplVulkan_Init(&init_info, (VkRenderPass)s_Data->PresentPipeline->GetRenderPassHandle());
+	// With dynamic rendering ImGui pipeline is created against the format of swapchain images
+	VkRenderPass renderPass = (VkRenderPass)s_Data->PresentPipeline->GetRenderPassHandle();
+	init_info.UseDynamicRendering = (renderPass == VK_NULL_HANDLE);
+	init_info.ColorAttachmentFormat = s_Data->Swapchain->GetImages()[0]->GetVulkanFormat();
+
+	ImGui_ImplVulkan_Init(&init_info, renderPass);
 
 	// execute a gpu command to upload imgui font textures
 	Ref<VulkanFence> fence = MakeRef<VulkanFence>();
@@ -187,7 +201,7 @@ static void SetupRenderingPipeline()
 	depthSpecs.Format = ImageFormat::D32_Float;
 	depthSpecs.Layout = ImageLayoutType::DepthStencilWrite;
 	depthSpecs.Size = { s_Data->Size.x, s_Data->Size.y, 1 };
-	depthSpecs.Usage = ImageUsage::DepthStencilAttachment;
+	depthSpecs.Usage = ImageUsage::DepthStencilAttachment | ImageUsage::TransientAttachment; // Only used within the render pass
 	s_Data->DepthImage = new VulkanImage(depthSpecs, "DepthImage");
 
 	ImageSpecifications colorSpecs;
@@ -247,8 +261,10 @@ static void SetupPresentPipeline()
 
 	s_Data->PresentPipeline = new VulkanGraphicsPipeline(state);
 
-	for (auto& image : swapchainImages)
-		s_Data->PresentFramebuffers.push_back(new VulkanFramebuffer({ image }, s_Data->PresentPipeline->GetRenderPassHandle(), s_Data->Size));
+	// With dynamic rendering swapchain images are passed directly when rendering begins
+	if (const void* renderPassHandle = s_Data->PresentPipeline->GetRenderPassHandle())
+		for (auto& image : swapchainImages)
+			s_Data->PresentFramebuffers.push_back(new VulkanFramebuffer({ image }, renderPassHandle, s_Data->Size));
 }
 
 static void SetupComputePipeline()
@@ -257,6 +273,8 @@ static void SetupComputePipeline()
 
 	ComputePipelineState state;
 	state.ComputeShader = s_Data->ComputeShader;
+	state.PushDescriptorSet = 0; // Input and output change with the image
+	state.TunedWorkgroupDimensions = 2;
 	s_Data->ComputePipeline = new VulkanComputePipeline(state);
 
 	ImageSpecifications imageSpecs;
@@ -271,7 +289,14 @@ void Renderer::Init()
 {
 	VulkanAllocator::Init();
 	VulkanPipelineCache::Init();
-	VulkanDescriptorManager::Init();
+	VulkanPipelineCompiler::Init();
+	VulkanLayoutCache::Init();
+	VulkanPipelineRegistry::Init();
+	VulkanComputeAutotuner::Init();
+	VulkanDescriptorManager::Init(MAX_FRAMES_IN_FLIGHT);
+	VulkanBindlessHeap::Init(MAX_FRAMES_IN_FLIGHT);
+	VulkanUploadManager::Init();
+	VulkanGraphicsPipeline::WarmUp();
 
 	s_Data = new Data;
 	s_Data->Swapchain = Application::GetApp().GetWindow().GetSwapchain();
@@ -295,22 +320,24 @@ void Renderer::Init()
 	auto& vertices = s_Data->Mesh->GetVertices();
 	auto& indices = s_Data->Mesh->GetIndices();
 
-	BufferSpecifications vertexSpecs   { vertices.size() * sizeof(Vertex),  MemoryType::Gpu, BufferUsage::VertexBuffer | BufferUsage::TransferDst};
-	BufferSpecifications instanceSpecs { sizeof(s_Data->InstanceData),      MemoryType::Gpu, BufferUsage::VertexBuffer | BufferUsage::TransferDst};
-	BufferSpecifications indexSpecs    { indices.size() * sizeof(uint32_t), MemoryType::Gpu, BufferUsage::IndexBuffer  | BufferUsage::TransferDst};
-	s_Data->VertexBuffer = new VulkanBuffer(vertexSpecs, "VertexBuffer");
+	// TransferSrc allows the buffer to be moved by defragmentation
+	BufferSpecifications instanceSpecs { sizeof(s_Data->InstanceData), MemoryType::Gpu, BufferUsage::VertexBuffer | BufferUsage::TransferSrc | BufferUsage::TransferDst};
 	s_Data->InstanceBuffer = new VulkanBuffer(instanceSpecs, "InstanceBuffer");
-	s_Data->IndexBuffer  = new VulkanBuffer(indexSpecs, "IndexBuffer");
 
-	Ref<VulkanFence> writeBuffersFence = MakeRef<VulkanFence>();
-	auto cmd = s_Data->GraphicsCommandManager->AllocateCommandBuffer();
-	cmd.Write(s_Data->VertexBuffer, vertices.data(), vertices.size() * sizeof(Vertex), 0, BufferLayoutType::Unknown, BufferReadAccess::Vertex);
-	cmd.Write(s_Data->IndexBuffer, indices.data(), indices.size() * sizeof(uint32_t), 0, BufferLayoutType::Unknown, BufferReadAccess::Index);
-	cmd.End();
-	s_Data->GraphicsCommandManager->Submit(&cmd, 1, writeBuffersFence, nullptr, 0, nullptr, 0);
+	// Uploaded during the first frame. Arena doesn't grow, so it's made big enough for the loaded mesh
+	const uint32_t maxArenaVertices = std::max(1024u * 1024u, (uint32_t)vertices.size());
+	const uint32_t maxArenaIndices = std::max(4u * 1024u * 1024u, (uint32_t)indices.size());
+	s_Data->GeometryArena = new VulkanGeometryArena(sizeof(Vertex), maxArenaVertices, maxArenaIndices, "GeometryArena");
+	s_Data->MeshGeometry = s_Data->GeometryArena->Allocate((uint32_t)vertices.size(), (uint32_t)indices.size());
+	if (s_Data->MeshGeometry.IsValid())
+		s_Data->GeometryArena->Write(s_Data->MeshGeometry, vertices.data(), indices.data());
+	else
+		std::cerr << "[Renderer] Mesh doesn't fit into the geometry arena. It won't be drawn\n";
+
+	// Pipelines were compiling on workers while assets were loading
+	VulkanPipelineCompiler::WaitIdle();
 
 	InitImGui();
-	writeBuffersFence->Wait();
 }
 
 void Renderer::Shutdown()
@@ -318,6 +345,7 @@ void Renderer::Shutdown()
 	VulkanContext::GetDevice()->WaitIdle();
 	
 	ShutdownImGui();
+	VulkanUploadManager::Shutdown();
 	VulkanStagingManager::ReleaseBuffers();
 
 	delete s_Data->ComputePipeline;
@@ -341,16 +369,21 @@ void Renderer::Shutdown()
 		delete fb;
 	s_Data->PresentFramebuffers.clear();
 
-	delete s_Data->VertexBuffer;
+	delete s_Data->GeometryArena;
 	delete s_Data->InstanceBuffer;
-	delete s_Data->IndexBuffer;
 	delete s_Data->Mesh;
 	delete s_Data->Texture;
 
 	delete s_Data;
 	s_Data = nullptr;
 
+	VulkanGraphicsPipeline::ReleaseWarmUpPipelines();
+	VulkanBindlessHeap::Shutdown();
+	VulkanComputeAutotuner::Shutdown();
+	VulkanPipelineRegistry::Shutdown();
+	VulkanLayoutCache::Shutdown();
 	VulkanDescriptorManager::Shutdown();
+	VulkanPipelineCompiler::Shutdown();
 	VulkanPipelineCache::Shutdown();
 	VulkanAllocator::Shutdown();
 }
@@ -363,6 +396,12 @@ void Renderer::DrawFrame(float ts)
 
 	fence->Wait();
 	fence->Reset();
+	VulkanDescriptorManager::BeginFrame(s_CurrentFrame);
+	VulkanBindlessHeap::BeginFrame();
+	VulkanPipelineCompiler::Update();
+	VulkanGraphicsPipeline::UpdateWarmUp();
+	VulkanPipelineCache::Update();
+	VulkanComputeAutotuner::Update();
 
 	uint32_t imageIndex = 0;
 	auto imageAcquireSemaphore = s_Data->Swapchain->AcquireImage(&imageIndex);
@@ -409,30 +448,47 @@ void Renderer::DrawFrame(float ts)
 	s_Data->ComputePipeline->SetImage(s_Data->InvertedColorImage, 0, 1);
 	cmd.Begin();
 
+	// Acquiring resources uploaded on the transfer queue
+	const VulkanSemaphore* uploadSemaphore = VulkanUploadManager::Submit(&cmd, fence);
+
+	s_Data->GeometryArena->Flush(cmd);
+
 	// Update per instance buffer
 	cmd.Write(s_Data->InstanceBuffer, s_Data->InstanceData, sizeof(s_Data->InstanceData), 0, BufferLayoutType::Unknown, BufferReadAccess::Vertex);
 
 	// Rendering
 	cmd.BeginGraphics(s_Data->DrawingPipeline);
 	cmd.SetGraphicsRootConstants(&pushData, nullptr);
-	cmd.DrawIndexedInstanced(s_Data->VertexBuffer, s_Data->IndexBuffer, (uint32_t)s_Data->Mesh->GetIndices().size(), 0, 0, s_Data->s_InstanceCount, 0, s_Data->InstanceBuffer);
+	if (s_Data->MeshGeometry.IsValid())
+		cmd.DrawIndexedInstanced(s_Data->GeometryArena, s_Data->MeshGeometry, s_Data->s_InstanceCount, 0, s_Data->InstanceBuffer);
 	cmd.EndGraphics();
 
 	cmd.TransitionLayout(s_Data->ColorImage, ImageReadAccess::PixelShaderRead, ImageReadAccess::PixelShaderRead);
 	cmd.TransitionLayout(s_Data->InvertedColorImage, ImageLayoutType::Unknown, ImageLayoutType::StorageImage);
-	glm::uvec2 numGroups = CalcNumGroups(s_Data->Size, 16);
-	cmd.Dispatch(s_Data->ComputePipeline, numGroups.x, numGroups.y, 1, &computePushData);
+	cmd.DispatchThreads(s_Data->ComputePipeline, glm::uvec3(s_Data->Size, 1u), &computePushData);
 	cmd.TransitionLayout(s_Data->InvertedColorImage, ImageLayoutType::StorageImage, ImageReadAccess::PixelShaderRead);
 
 	// Copying to present. Drawing UI
-	cmd.BeginGraphics(s_Data->PresentPipeline, *s_Data->PresentFramebuffers[imageIndex]);
+	if (s_Data->PresentFramebuffers.empty())
+		cmd.BeginGraphics(s_Data->PresentPipeline, RenderingAttachments{ { s_Data->Swapchain->GetImages()[imageIndex] } });
+	else
+		cmd.BeginGraphics(s_Data->PresentPipeline, *s_Data->PresentFramebuffers[imageIndex]);
 	cmd.Draw(6, 0);
 	EndImGui(&cmd);
 	cmd.EndGraphics();
 
 	cmd.End();
 
-	s_Data->GraphicsCommandManager->Submit(&cmd, 1, fence, imageAcquireSemaphore, 1, &semaphore, 1);
+	std::vector<const VulkanSemaphore*> waitSemaphores = { imageAcquireSemaphore };
+	if (uploadSemaphore)
+		waitSemaphores.push_back(uploadSemaphore);
+
+	s_Data->GraphicsCommandManager->Submit(&cmd, 1, fence, waitSemaphores, { &semaphore });
+
+	// Moves are submitted after the frame so that they're ordered after the acquisition of uploaded resources
+	if (!VulkanUploadManager::HasPendingUploads())
+		VulkanAllocator::Defragment();
+
 	s_Data->Swapchain->Present(&semaphore);
 
 	s_CurrentFrame = (s_CurrentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
@@ -455,6 +511,22 @@ void Renderer::DrawImGui()
 	const auto textureID = ImGui_ImplVulkan_AddTexture(sampler, imageView, layout);
 
 	ImGui::Image(textureID, { 256.f * aspectRatio, 256.f });
+
+	if (ImGui::CollapsingHeader("GPU memory"))
+	{
+		for (uint32_t i = 0; i < uint32_t(GPUMemoryCategory::Count); ++i)
+		{
+			const GPUMemoryCategory category = GPUMemoryCategory(i);
+			const GPUMemoryCategoryStats stats = VulkanAllocator::GetCategoryStats(category);
+			ImGui::Text("%s: %.2f MB (%llu allocations)", VulkanAllocator::GetCategoryName(category), double(stats.Bytes) / (1024.0 * 1024.0), (unsigned long long)stats.AllocationsCount);
+		}
+		if (ImGui::Button("Dump VMA stats"))
+			VulkanAllocator::DumpStats(Path(GetRendererCachePath()) / "vma_stats.json");
+		if (VulkanAllocator::IsDefragmenting())
+			ImGui::Text("Defragmenting...");
+		else if (ImGui::Button("Defragment"))
+			VulkanAllocator::BeginDefragmentation();
+	}
 	ImGui::End();
 }
 
@@ -473,8 +545,9 @@ void Renderer::OnWindowResized()
 	s_Data->InvertedColorImage->Resize({ size, 1 });
 	s_Data->DepthImage->Resize({ size, 1 });
 	s_Data->DrawingPipeline->Resize(size.x, size.y);
-	for (auto& image : swapchainImages)
-		s_Data->PresentFramebuffers.push_back(new VulkanFramebuffer({ image }, renderPassHandle, size));
+	if (renderPassHandle)
+		for (auto& image : swapchainImages)
+			s_Data->PresentFramebuffers.push_back(new VulkanFramebuffer({ image }, renderPassHandle, size));
 }
 
 void Renderer::BeginImGui()
@@ -375,6 +375,12 @@ enum class CullMode
     FrontAndBack
 };
 
+enum class FrontFace
+{
+    CounterClockwise,
+    Clockwise
+};
+
 struct BufferImageCopy
 {
     // Buffer offset, in bytes.
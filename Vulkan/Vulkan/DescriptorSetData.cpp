@@ -1,27 +1,80 @@
 #include "DescriptorSetData.h"
+#include "VulkanUtils.h"
 
-void DescriptorSetData::SetArg(std::uint32_t idx, const VulkanBuffer* buffer)
+#include <iostream>
+#include <string>
+#include <algorithm>
+
+DescriptorSetData::Binding& DescriptorSetData::GetBinding(uint32_t idx)
 {
-    auto& currentBinding = m_Bindings[idx];
+    if (idx >= m_Bindings.size())
+        m_Bindings.resize(idx + 1);
+    return m_Bindings[idx];
+}
 
-    BufferBinding binding(buffer);
-    if (currentBinding.BufferBindings[0] != binding)
-    {
-        currentBinding.BufferBindings[0] = binding;
-        m_bDirty = true;
-    }
+void DescriptorSetData::SetImage(uint32_t idx, const ImageBinding& image)
+{
+    Binding& binding = GetBinding(idx);
+    if (binding.Count == 1 && !binding.bBuffer && !(binding.Image != image))
+        return;
+
+    binding.Count = 1;
+    binding.bBuffer = false;
+    binding.Image = image;
+    MarkBindingDirty(idx);
 }
 
-void DescriptorSetData::SetArg(std::uint32_t idx, const VulkanBuffer* buffer, std::size_t offset, std::size_t size)
+void DescriptorSetData::SetBuffer(uint32_t idx, const BufferBinding& buffer)
+{
+    Binding& binding = GetBinding(idx);
+    if (binding.Count == 1 && binding.bBuffer && !(binding.Buffer != buffer))
+        return;
+
+    binding.Count = 1;
+    binding.bBuffer = true;
+    binding.Buffer = buffer;
+    MarkBindingDirty(idx);
+}
+
+template<typename MakeBinding>
+void DescriptorSetData::SetImageArray(uint32_t idx, uint32_t count, MakeBinding makeBinding)
 {
-    auto& currentBinding = m_Bindings[idx];
+    assert(count);
+    if (count == 1)
+    {
+        SetImage(idx, makeBinding(0));
+        return;
+    }
 
-    BufferBinding binding(buffer, offset, size);
-    if (currentBinding.BufferBindings[0] != binding)
+    Binding& binding = GetBinding(idx);
+    bool bChanged = binding.Count != count || binding.bBuffer;
+    binding.ImageArray.resize(count);
+    for (uint32_t i = 0; i < count; ++i)
     {
-        currentBinding.BufferBindings[0] = binding;
-        m_bDirty = true;
+        ImageBinding image = makeBinding(i);
+        if (bChanged || binding.ImageArray[i] != image)
+        {
+            binding.ImageArray[i] = image;
+            bChanged = true;
+        }
     }
+
+    if (bChanged)
+    {
+        binding.Count = count;
+        binding.bBuffer = false;
+        MarkBindingDirty(idx);
+    }
+}
+
+void DescriptorSetData::SetArg(std::uint32_t idx, const VulkanBuffer* buffer)
+{
+    SetBuffer(idx, BufferBinding(buffer));
+}
+
+void DescriptorSetData::SetArg(std::uint32_t idx, const VulkanBuffer* buffer, std::size_t offset, std::size_t size)
+{
+    SetBuffer(idx, BufferBinding(buffer, offset, size));
 }
 
 void DescriptorSetData::SetArg(std::uint32_t idx, const VulkanImage* image)
@@ -36,117 +89,244 @@ void DescriptorSetData::SetArg(std::uint32_t idx, const VulkanImage* image, cons
 
 void DescriptorSetData::SetArg(std::uint32_t idx, const VulkanImage* image, const VulkanSampler* sampler)
 {
-    auto& currentBinding = m_Bindings[idx];
-
-    ImageBinding binding(image, sampler);
-    if (currentBinding.ImageBindings[0] != binding)
-    {
-        currentBinding.ImageBindings[0] = binding;
-        m_bDirty = true;
-    }
+    SetImage(idx, ImageBinding(image, sampler));
 }
 
 void DescriptorSetData::SetArg(std::uint32_t idx, const VulkanImage* image, const ImageView& imageView, const VulkanSampler* sampler)
 {
-    auto& currentBinding = m_Bindings[idx];
-
-    ImageBinding binding(image, imageView, sampler);
-    if (currentBinding.ImageBindings[0] != binding)
-    {
-        currentBinding.ImageBindings[0] = binding;
-        m_bDirty = true;
-    }
+    SetImage(idx, ImageBinding(image, imageView, sampler));
 }
 
 void DescriptorSetData::SetArgArray(std::uint32_t idx, const std::vector<const VulkanBuffer*>& buffers)
 {
-    assert(buffers.size());
-    auto& currentBinding = m_Bindings[idx];
-
-    std::vector<BufferBinding> bindings;
-    bindings.reserve(buffers.size());
+    const uint32_t count = (uint32_t)buffers.size();
+    assert(count);
+    if (count == 1)
+    {
+        SetBuffer(idx, BufferBinding(buffers[0]));
+        return;
+    }
 
-    for (auto& buffer : buffers)
-        bindings.emplace_back(buffer);
+    Binding& binding = GetBinding(idx);
+    bool bChanged = binding.Count != count || !binding.bBuffer;
+    binding.BufferArray.resize(count);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        BufferBinding buffer(buffers[i]);
+        if (bChanged || binding.BufferArray[i] != buffer)
+        {
+            binding.BufferArray[i] = buffer;
+            bChanged = true;
+        }
+    }
 
-    if (currentBinding.BufferBindings != bindings)
+    if (bChanged)
     {
-        currentBinding.BufferBindings = bindings;
-        m_bDirty = true;
+        binding.Count = count;
+        binding.bBuffer = true;
+        MarkBindingDirty(idx);
     }
 }
 
 void DescriptorSetData::SetArgArray(std::uint32_t idx, const std::vector<const VulkanImage*>& images)
 {
-    assert(images.size());
-    auto& currentBinding = m_Bindings[idx];
+    SetImageArray(idx, (uint32_t)images.size(), [&images](uint32_t i) { return ImageBinding(images[i]); });
+}
 
-    std::vector<ImageBinding> bindings;
-    bindings.reserve(images.size());
+void DescriptorSetData::SetArgArray(std::uint32_t idx, const std::vector<const VulkanImage*>& images, const std::vector<ImageView>& imageViews)
+{
+    SetImageArray(idx, (uint32_t)images.size(), [&images, &imageViews](uint32_t i) { return ImageBinding(images[i], imageViews[i]); });
+}
 
-    for (auto& image : images)
-        bindings.emplace_back(image);
+void DescriptorSetData::SetArgArray(std::uint32_t idx, const std::vector<const VulkanImage*>& images, const std::vector<const VulkanSampler*>& samplers)
+{
+    SetImageArray(idx, (uint32_t)images.size(), [&images, &samplers](uint32_t i) { return ImageBinding(images[i], samplers[i]); });
+}
+
+void DescriptorSetData::SetArgArray(std::uint32_t idx, const std::vector<const VulkanImage*>& images, const std::vector<ImageView>& imageViews, const std::vector<const VulkanSampler*>& samplers)
+{
+    SetImageArray(idx, (uint32_t)images.size(), [&images, &imageViews, &samplers](uint32_t i) { return ImageBinding(images[i], imageViews[i], samplers[i]); });
+}
 
-    if (currentBinding.ImageBindings != bindings)
+void DescriptorSetData::ReplaceBuffer(VkBuffer oldBuffer, VkBuffer newBuffer)
+{
+    for (uint32_t idx = 0; idx < (uint32_t)m_Bindings.size(); ++idx)
     {
-        currentBinding.ImageBindings = bindings;
-        m_bDirty = true;
+        Binding& binding = m_Bindings[idx];
+        if (!binding.bBuffer)
+            continue;
+
+        BufferBinding* buffers = binding.Count > 1 ? binding.BufferArray.data() : &binding.Buffer;
+        for (uint32_t i = 0; i < binding.Count; ++i)
+        {
+            if (buffers[i].Buffer == oldBuffer)
+            {
+                buffers[i].Buffer = newBuffer;
+                MarkBindingDirty(idx);
+            }
+        }
     }
 }
 
-void DescriptorSetData::SetArgArray(std::uint32_t idx, const std::vector<const VulkanImage*>& images, const std::vector<ImageView>& imageViews)
+void DescriptorSetData::ReplaceImage(VkImage oldImage, VkImage newImage, const std::unordered_map<VkImageView, VkImageView>& views)
 {
-    const size_t imagesCount = images.size();
-    assert(imagesCount);
-    auto& currentBinding = m_Bindings[idx];
-
-    std::vector<ImageBinding> bindings;
-    bindings.reserve(imagesCount);
+    for (uint32_t idx = 0; idx < (uint32_t)m_Bindings.size(); ++idx)
+    {
+        Binding& binding = m_Bindings[idx];
+        if (binding.bBuffer)
+            continue;
 
-    for (size_t i = 0; i < imagesCount; ++i)
-        bindings.emplace_back(images[i], imageViews[i]);
+        ImageBinding* images = binding.Count > 1 ? binding.ImageArray.data() : &binding.Image;
+        for (uint32_t i = 0; i < binding.Count; ++i)
+        {
+            if (images[i].Image != oldImage)
+                continue;
 
-    if (currentBinding.ImageBindings != bindings)
-    {
-        currentBinding.ImageBindings = bindings;
-        m_bDirty = true;
+            images[i].Image = newImage;
+            auto viewIt = views.find(images[i].View);
+            if (viewIt != views.end())
+                images[i].View = viewIt->second;
+            MarkBindingDirty(idx);
+        }
     }
 }
 
-void DescriptorSetData::SetArgArray(std::uint32_t idx, const std::vector<const VulkanImage*>& images, const std::vector<const VulkanSampler*>& samplers)
+size_t DescriptorSetData::GetHash() const
 {
-    const size_t imagesCount = images.size();
-    assert(imagesCount);
-    auto& currentBinding = m_Bindings[idx];
+    size_t result = 0;
+    for (uint32_t idx = 0; idx < (uint32_t)m_Bindings.size(); ++idx)
+    {
+        const Binding& binding = m_Bindings[idx];
+        if (binding.Count == 0)
+            continue;
 
-    std::vector<ImageBinding> bindings;
-    bindings.reserve(imagesCount);
+        HashCombine(result, idx);
+        for (uint32_t i = 0; i < binding.Count; ++i)
+        {
+            if (binding.bBuffer)
+            {
+                const BufferBinding& buffer = binding.GetBuffer(i);
+                HashCombine(result, buffer.Buffer);
+                HashCombine(result, buffer.Offset);
+                HashCombine(result, buffer.Range);
+            }
+            else
+            {
+                const ImageBinding& image = binding.GetImage(i);
+                HashCombine(result, image.View);
+                HashCombine(result, image.Sampler);
+            }
+        }
+    }
+    return result;
+}
 
-    for (size_t i = 0; i < imagesCount; ++i)
-        bindings.emplace_back(images[i], samplers[i]);
+bool DescriptorSetData::HasSameBindings(const DescriptorSetData& other) const
+{
+    static const Binding s_EmptyBinding;
 
-    if (currentBinding.ImageBindings != bindings)
+    const size_t bindingsCount = std::max(m_Bindings.size(), other.m_Bindings.size());
+    for (size_t idx = 0; idx < bindingsCount; ++idx)
     {
-        currentBinding.ImageBindings = bindings;
-        m_bDirty = true;
+        const Binding& binding = idx < m_Bindings.size() ? m_Bindings[idx] : s_EmptyBinding;
+        const Binding& otherBinding = idx < other.m_Bindings.size() ? other.m_Bindings[idx] : s_EmptyBinding;
+        if (binding.Count != otherBinding.Count || binding.bBuffer != otherBinding.bBuffer)
+            return false;
+
+        for (uint32_t i = 0; i < binding.Count; ++i)
+        {
+            if (binding.bBuffer ? (binding.GetBuffer(i) != otherBinding.GetBuffer(i)) : (binding.GetImage(i) != otherBinding.GetImage(i)))
+                return false;
+        }
     }
+    return true;
 }
 
-void DescriptorSetData::SetArgArray(std::uint32_t idx, const std::vector<const VulkanImage*>& images, const std::vector<ImageView>& imageViews, const std::vector<const VulkanSampler*>& samplers)
+void DescriptorSetData::WriteTemplatePayload(const std::vector<DescriptorTemplateEntry>& entries, uint8_t* payload, bool bOnlyDirty) const
 {
-    const size_t imagesCount = images.size();
-    assert(imagesCount);
-    auto& currentBinding = m_Bindings[idx];
+    for (auto& entry : entries)
+    {
+        if (bOnlyDirty && !IsBindingDirty(entry.Binding))
+            continue;
 
-    std::vector<ImageBinding> bindings;
-    bindings.reserve(imagesCount);
+        if (entry.Binding >= m_Bindings.size() || m_Bindings[entry.Binding].Count == 0)
+        {
+            std::cerr << "Error! Binding " << std::to_string(entry.Binding) << " is not set\n";
+            assert(false);
+            continue;
+        }
+        const Binding& bindingData = m_Bindings[entry.Binding];
+        if (bindingData.bBuffer != IsBufferType(entry.DescriptorType))
+        {
+            std::cerr << "Error! Binding " << std::to_string(entry.Binding) << " is set with a resource of a wrong type\n";
+            assert(false);
+            continue;
+        }
 
-    for (size_t i = 0; i < imagesCount; ++i)
-        bindings.emplace_back(images[i], imageViews[i], samplers[i]);
+        if (IsBufferType(entry.DescriptorType))
+        {
+            VkDescriptorBufferInfo* infos = reinterpret_cast<VkDescriptorBufferInfo*>(payload + entry.Offset);
+            for (uint32_t i = 0; i < entry.DescriptorCount; ++i)
+            {
+                const BufferBinding& buffer = bindingData.GetBuffer(i < bindingData.Count ? i : 0);
+                if (buffer.Buffer == VK_NULL_HANDLE)
+                    std::cerr << "Error! Invalid buffer binding for binding " << std::to_string(entry.Binding) << '\n';
 
-    if (currentBinding.ImageBindings != bindings)
-    {
-        currentBinding.ImageBindings = bindings;
-        m_bDirty = true;
+                infos[i] = { buffer.Buffer, buffer.Offset, buffer.Range };
+            }
+        }
+        else if (IsSamplerType(entry.DescriptorType))
+        {
+            VkDescriptorImageInfo* infos = reinterpret_cast<VkDescriptorImageInfo*>(payload + entry.Offset);
+            for (uint32_t i = 0; i < entry.DescriptorCount; ++i)
+                infos[i] = { bindingData.GetImage(0).Sampler, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_UNDEFINED };
+        }
+        else if (IsImageType(entry.DescriptorType))
+        {
+            const bool bReadOnly = (entry.DescriptorType == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE) || (entry.DescriptorType == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+            const VkImageLayout imageLayout = bReadOnly ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+            VkDescriptorImageInfo* infos = reinterpret_cast<VkDescriptorImageInfo*>(payload + entry.Offset);
+            for (uint32_t i = 0; i < entry.DescriptorCount; ++i)
+            {
+                const ImageBinding& image = bindingData.GetImage(i < bindingData.Count ? i : 0);
+                infos[i] = { image.Sampler, image.View, imageLayout };
+            }
+        }
+        else
+        {
+            std::cerr << "Unknown binding\n";
+            assert(false);
+        }
     }
 }
+
+bool DescriptorSetData::References(VkBuffer buffer) const
+{
+    for (auto& binding : m_Bindings)
+        if (binding.bBuffer)
+            for (uint32_t i = 0; i < binding.Count; ++i)
+                if (binding.GetBuffer(i).Buffer == buffer)
+                    return true;
+    return false;
+}
+
+bool DescriptorSetData::References(VkImageView imageView) const
+{
+    for (auto& binding : m_Bindings)
+        if (!binding.bBuffer)
+            for (uint32_t i = 0; i < binding.Count; ++i)
+                if (binding.GetImage(i).View == imageView)
+                    return true;
+    return false;
+}
+
+bool DescriptorSetData::References(VkSampler sampler) const
+{
+    for (auto& binding : m_Bindings)
+        if (!binding.bBuffer)
+            for (uint32_t i = 0; i < binding.Count; ++i)
+                if (binding.GetImage(i).Sampler == sampler)
+                    return true;
+    return false;
+}
@@ -5,6 +5,17 @@
 #include "VulkanBuffer.h"
 
 #include <vector>
+#include <unordered_map>
+
+// Location of a binding in the payload of a descriptor update template.
+// Payload elements are `VkDescriptorBufferInfo` for buffer types and `VkDescriptorImageInfo` for image and sampler types
+struct DescriptorTemplateEntry
+{
+	uint32_t Binding = 0;
+	uint32_t DescriptorCount = 0;
+	VkDescriptorType DescriptorType = VK_DESCRIPTOR_TYPE_MAX_ENUM;
+	size_t Offset = 0;
+};
 
 class DescriptorSetData
 {
@@ -32,19 +43,6 @@ public:
 		{
 			return Image != other.Image || View != other.View || Sampler != other.Sampler;
 		}
-
-		friend bool operator!=(const std::vector<ImageBinding>& left, const std::vector<ImageBinding>& right)
-		{
-			if (left.size() != right.size())
-				return true;
-
-			for (std::uint32_t i = 0; i < left.size(); i++)
-			{
-				if (left[i] != right[i])
-					return true;
-			}
-			return false;
-		}
 	};
 
 	struct BufferBinding
@@ -61,31 +59,38 @@ public:
 		{
 			return Buffer != other.Buffer || Offset != other.Offset || Range != other.Range;
 		}
-
-		friend bool operator!=(const std::vector<BufferBinding>& left, const std::vector<BufferBinding>& right)
-		{
-			if (left.size() != right.size())
-				return true;
-
-			for (std::uint32_t i = 0; i < left.size(); i++)
-			{
-				if (left[i] != right[i])
-					return true;
-			}
-			return false;
-		}
 	};
 
+	// Single descriptors are stored inline. Arrays are stored in `ImageArray` or `BufferArray`, which keep their capacity when reassigned
 	struct Binding
 	{
-		std::vector<ImageBinding> ImageBindings = { {} };
-		std::vector<BufferBinding> BufferBindings = { {} };
+		uint32_t Count = 0; // 0 if the binding was never set
+		bool bBuffer = false; // Buffer or image/sampler binding
+		ImageBinding Image;
+		BufferBinding Buffer;
+		std::vector<ImageBinding> ImageArray;
+		std::vector<BufferBinding> BufferArray;
+
+		const ImageBinding& GetImage(uint32_t idx) const { assert(!bBuffer && idx < Count); return Count > 1 ? ImageArray[idx] : Image; }
+		const BufferBinding& GetBuffer(uint32_t idx) const { assert(bBuffer && idx < Count); return Count > 1 ? BufferArray[idx] : Buffer; }
 	};
 
 public:
-	const std::unordered_map<uint32_t, Binding>& GetBindings() const { return m_Bindings; }
-	bool IsDirty() const { return m_bDirty; }
-	void OnFlushed() { m_bDirty = false; }
+	bool IsDirty() const { return m_DirtyBindings != 0; }
+	void OnFlushed() { m_DirtyBindings = 0; }
+	void MarkDirty() { m_DirtyBindings = ~0ull; }
+
+	// Hash of the bound resources (views, samplers, buffers, offsets and ranges). Used to find already written descriptor sets
+	size_t GetHash() const;
+	bool HasSameBindings(const DescriptorSetData& other) const;
+
+	bool References(VkBuffer buffer) const;
+	bool References(VkImageView imageView) const;
+	bool References(VkSampler sampler) const;
+
+	// Fills the packed payload of an update template in place. Array elements that are not set repeat the first element.
+	// @bOnlyDirty. If set, only bindings that changed since the last flush are written. Should be used only if the payload is not shared with other data
+	void WriteTemplatePayload(const std::vector<DescriptorTemplateEntry>& entries, uint8_t* payload, bool bOnlyDirty = false) const;
 
 	void SetArg(std::uint32_t idx, const VulkanBuffer* buffer);
 	void SetArg(std::uint32_t idx, const VulkanBuffer* buffer, std::size_t offset, std::size_t size);
@@ -101,7 +106,23 @@ public:
 	void SetArgArray(std::uint32_t idx, const std::vector<const VulkanImage*>& images, const std::vector<const VulkanSampler*>& samplers);
 	void SetArgArray(std::uint32_t idx, const std::vector<const VulkanImage*>& images, const std::vector<ImageView>& imageViews, const std::vector<const VulkanSampler*>& samplers);
 
+	// Used when a resource is moved to a new memory location (defragmentation). Marks the data dirty if any binding was replaced
+	void ReplaceBuffer(VkBuffer oldBuffer, VkBuffer newBuffer);
+	void ReplaceImage(VkImage oldImage, VkImage newImage, const std::unordered_map<VkImageView, VkImageView>& views);
+
+private:
+	Binding& GetBinding(uint32_t idx);
+	void SetImage(uint32_t idx, const ImageBinding& image);
+	void SetBuffer(uint32_t idx, const BufferBinding& buffer);
+	// @makeBinding. Called with an element index, returns the binding of that element
+	template<typename MakeBinding>
+	void SetImageArray(uint32_t idx, uint32_t count, MakeBinding makeBinding);
+
+	void MarkBindingDirty(uint32_t idx) { m_DirtyBindings |= GetDirtyBit(idx); }
+	bool IsBindingDirty(uint32_t idx) const { return (m_DirtyBindings & GetDirtyBit(idx)) != 0; }
+	static uint64_t GetDirtyBit(uint32_t idx) { return 1ull << (idx < 63u ? idx : 63u); } // Bindings above 63 share the last bit
+
 private:
-	std::unordered_map<uint32_t, Binding> m_Bindings; // Binding -> Data
-	bool m_bDirty = true;
-};
\ No newline at end of file
+	std::vector<Binding> m_Bindings; // Binding -> Data. Grows to the highest set binding and is never shrunk
+	uint64_t m_DirtyBindings = ~0ull;
+};
@@ -1,6 +1,32 @@
 #include "VulkanAllocator.h"
 #include "VulkanContext.h"
 #include "VulkanImage.h"
+#include "VulkanCommandManager.h"
+
+#include <unordered_map>
+#include <unordered_set>
+#include <array>
+#include <fstream>
+
+struct DefragmentationData
+{
+	VulkanCommandManager* CommandManager = nullptr;
+	VulkanCommandBuffer Cmd;
+	Ref<VulkanFence> Fence;
+
+	std::vector<VmaPool> Pools; // Pools to defragment one after another. VK_NULL_HANDLE stands for default pools
+	size_t PoolIndex = 0;
+	VmaDefragmentationContext Context = VK_NULL_HANDLE;
+	VmaDefragmentationPassMoveInfo PassInfo{};
+	bool bPassInProgress = false;
+
+	std::unordered_set<VmaAllocation> PassAllocations; // Source allocations of the pass in progress
+	std::vector<VulkanDefragmentable*> MovedResources;
+
+	uint64_t MaxBytesPerPass = 0;
+	uint32_t MaxAllocationsPerPass = 0;
+	VmaDefragmentationStats TotalStats{};
+};
 
 struct VulkanAllocatorData
 {
@@ -8,6 +34,18 @@ struct VulkanAllocatorData
     VmaAllocator Allocator;
     uint64_t TotalAllocatedBytes = 0;
     uint64_t TotalFreedBytes = 0;
+
+	// Memory type index -> Pool.
+	// Optimal-tiling images and mappable buffers never share VkDeviceMemory,
+	// so mapping a buffer can't map memory bound to an image that is not in VK_IMAGE_LAYOUT_GENERAL.
+	std::unordered_map<uint32_t, VmaPool> ImagePools;
+	std::unordered_map<uint32_t, VmaPool> MappableBufferPools;
+
+	std::array<GPUMemoryCategoryStats, size_t(GPUMemoryCategory::Count)> CategoryStats;
+	std::unordered_set<VmaAllocation> LiveAllocations;
+
+	std::unordered_map<VmaAllocation, VulkanDefragmentable*> Defragmentables;
+	DefragmentationData Defragmentation;
 };
 
 static VmaMemoryUsage MemoryTypeToVmaUsage(MemoryType memory_type)
@@ -26,6 +64,171 @@ static VmaMemoryUsage MemoryTypeToVmaUsage(MemoryType memory_type)
 
 static VulkanAllocatorData* s_AllocatorData = nullptr;
 
+// Category is stored in the allocation's user data
+static void OnAllocated(VmaAllocation allocation, GPUMemoryCategory category, const std::string& debugName)
+{
+	VmaAllocator allocator = s_AllocatorData->Allocator;
+	vmaSetAllocationUserData(allocator, allocation, (void*)uintptr_t(category));
+	if (!debugName.empty())
+		vmaSetAllocationName(allocator, allocation, debugName.c_str());
+
+	VmaAllocationInfo allocationInfo{};
+	vmaGetAllocationInfo(allocator, allocation, &allocationInfo);
+	s_AllocatorData->TotalAllocatedBytes += allocationInfo.size;
+
+	auto& categoryStats = s_AllocatorData->CategoryStats[size_t(category)];
+	categoryStats.Bytes += allocationInfo.size;
+	++categoryStats.AllocationsCount;
+
+	s_AllocatorData->LiveAllocations.insert(allocation);
+}
+
+static void OnFreed(VmaAllocation allocation)
+{
+	VmaAllocationInfo allocationInfo{};
+	vmaGetAllocationInfo(s_AllocatorData->Allocator, allocation, &allocationInfo);
+	s_AllocatorData->TotalFreedBytes += allocationInfo.size;
+
+	auto& categoryStats = s_AllocatorData->CategoryStats[size_t(uintptr_t(allocationInfo.pUserData))];
+	categoryStats.Bytes -= allocationInfo.size;
+	--categoryStats.AllocationsCount;
+
+	s_AllocatorData->LiveAllocations.erase(allocation);
+	s_AllocatorData->Defragmentables.erase(allocation);
+}
+
+static void ReportLeaks()
+{
+	if (s_AllocatorData->LiveAllocations.empty())
+		return;
+
+	std::cerr << "[Vulkan allocator] Memory leak detected! Leaked allocations: " << s_AllocatorData->LiveAllocations.size() << '\n';
+	for (uint32_t i = 0; i < uint32_t(GPUMemoryCategory::Count); ++i)
+	{
+		const auto& categoryStats = s_AllocatorData->CategoryStats[i];
+		if (categoryStats.AllocationsCount)
+			std::cerr << "\t" << VulkanAllocator::GetCategoryName(GPUMemoryCategory(i)) << ": " << categoryStats.AllocationsCount << " allocations, " << categoryStats.Bytes << " bytes\n";
+	}
+
+	for (VmaAllocation allocation : s_AllocatorData->LiveAllocations)
+	{
+		VmaAllocationInfo allocationInfo{};
+		vmaGetAllocationInfo(s_AllocatorData->Allocator, allocation, &allocationInfo);
+
+		const GPUMemoryCategory category = GPUMemoryCategory(uintptr_t(allocationInfo.pUserData));
+		std::cerr << "\t\t" << (allocationInfo.pName ? allocationInfo.pName : "<unnamed>")
+			<< " (" << VulkanAllocator::GetCategoryName(category) << "): " << allocationInfo.size << " bytes\n";
+	}
+}
+
+// Starts defragmentation of the next pool that has something to move. Returns false if there's nothing left
+static bool BeginNextDefragmentation()
+{
+	auto& defrag = s_AllocatorData->Defragmentation;
+	while (defrag.PoolIndex < defrag.Pools.size())
+	{
+		VmaDefragmentationInfo info{};
+		info.flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_FAST_BIT;
+		info.pool = defrag.Pools[defrag.PoolIndex];
+		info.maxBytesPerPass = defrag.MaxBytesPerPass;
+		info.maxAllocationsPerPass = defrag.MaxAllocationsPerPass;
+
+		if (vmaBeginDefragmentation(s_AllocatorData->Allocator, &info, &defrag.Context) == VK_SUCCESS)
+			return true;
+
+		defrag.Context = VK_NULL_HANDLE;
+		++defrag.PoolIndex;
+	}
+
+	std::cout << "[Vulkan allocator] Defragmentation finished. Moved " << defrag.TotalStats.allocationsMoved << " allocations ("
+		<< defrag.TotalStats.bytesMoved << " bytes). Released " << defrag.TotalStats.deviceMemoryBlocksFreed << " blocks ("
+		<< defrag.TotalStats.bytesFreed << " bytes)\n";
+	return false;
+}
+
+static void EndDefragmentation()
+{
+	auto& defrag = s_AllocatorData->Defragmentation;
+
+	VmaDefragmentationStats stats{};
+	vmaEndDefragmentation(s_AllocatorData->Allocator, defrag.Context, &stats);
+	defrag.Context = VK_NULL_HANDLE;
+
+	defrag.TotalStats.bytesMoved += stats.bytesMoved;
+	defrag.TotalStats.bytesFreed += stats.bytesFreed;
+	defrag.TotalStats.allocationsMoved += stats.allocationsMoved;
+	defrag.TotalStats.deviceMemoryBlocksFreed += stats.deviceMemoryBlocksFreed;
+
+	++defrag.PoolIndex;
+	BeginNextDefragmentation();
+}
+
+static void FinishDefragmentationPass()
+{
+	auto& defrag = s_AllocatorData->Defragmentation;
+	assert(defrag.bPassInProgress);
+
+	defrag.Fence->Wait();
+	for (auto& resource : defrag.MovedResources)
+		resource->EndMove();
+
+	defrag.MovedResources.clear();
+	defrag.PassAllocations.clear();
+	defrag.bPassInProgress = false;
+
+	if (vmaEndDefragmentationPass(s_AllocatorData->Allocator, defrag.Context, &defrag.PassInfo) == VK_SUCCESS)
+		EndDefragmentation();
+}
+
+// Allocations of the pass in progress can't be freed until the pass is finished
+static void FinishDefragmentationPassIfMoved(VmaAllocation allocation)
+{
+	auto& defrag = s_AllocatorData->Defragmentation;
+	if (defrag.bPassInProgress && defrag.PassAllocations.count(allocation))
+		FinishDefragmentationPass();
+}
+
+static VmaPool GetOrCreatePool(std::unordered_map<uint32_t, VmaPool>& pools, uint32_t memoryTypeIndex, const char* name)
+{
+	auto it = pools.find(memoryTypeIndex);
+	if (it != pools.end())
+		return it->second;
+
+	VmaPoolCreateInfo ci{};
+	ci.memoryTypeIndex = memoryTypeIndex;
+
+	VmaPool pool = VK_NULL_HANDLE;
+	VK_CHECK(vmaCreatePool(s_AllocatorData->Allocator, &ci, &pool));
+	vmaSetPoolName(s_AllocatorData->Allocator, pool, name);
+	pools.emplace(memoryTypeIndex, pool);
+
+	return pool;
+}
+
+// Allocates from the pool of the best suitable memory type.
+// If that memory type is exhausted, falls back to the next suitable one (the same way VMA does for default pools)
+template<typename FindMemoryTypeFunc, typename CreateFunc>
+static VkResult CreateInPools(std::unordered_map<uint32_t, VmaPool>& pools, const char* poolName, VmaAllocationCreateInfo ci, FindMemoryTypeFunc&& findMemoryType, CreateFunc&& create)
+{
+	VkResult result = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+	uint32_t memoryTypeIndex = 0;
+	ci.memoryTypeBits = UINT32_MAX;
+
+	while (findMemoryType(&ci, &memoryTypeIndex) == VK_SUCCESS)
+	{
+		VmaAllocationCreateInfo poolCI = ci;
+		poolCI.pool = GetOrCreatePool(pools, memoryTypeIndex, poolName);
+
+		result = create(&poolCI);
+		if (result == VK_SUCCESS)
+			break;
+
+		ci.memoryTypeBits &= ~(1u << memoryTypeIndex);
+	}
+
+	return result;
+}
+
 void VulkanAllocator::Init()
 {
 	const VulkanDevice* device = VulkanContext::GetDevice();
@@ -43,74 +246,115 @@ void VulkanAllocator::Init()
 
 void VulkanAllocator::Shutdown()
 {
-	vmaDestroyAllocator(s_AllocatorData->Allocator);
-
-	if (s_AllocatorData->TotalAllocatedBytes != s_AllocatorData->TotalFreedBytes)
+	auto& defrag = s_AllocatorData->Defragmentation;
+	if (defrag.bPassInProgress)
+		FinishDefragmentationPass();
+	if (defrag.Context)
 	{
-		std::cerr << "[Vulkan allocator] Memory leak detected! Totally allocated bytes = "
-			<< s_AllocatorData->TotalAllocatedBytes
-			<< "; Totally freed bytes = " << s_AllocatorData->TotalFreedBytes << '\n';
+		vmaEndDefragmentation(s_AllocatorData->Allocator, defrag.Context, nullptr);
+		defrag.Context = VK_NULL_HANDLE;
 	}
+	defrag.Cmd = VulkanCommandBuffer();
+	defrag.Fence.reset();
+	delete defrag.CommandManager;
+	defrag.CommandManager = nullptr;
+
+	ReportLeaks();
+
+	for (auto& it : s_AllocatorData->ImagePools)
+		vmaDestroyPool(s_AllocatorData->Allocator, it.second);
+	for (auto& it : s_AllocatorData->MappableBufferPools)
+		vmaDestroyPool(s_AllocatorData->Allocator, it.second);
+	s_AllocatorData->ImagePools.clear();
+	s_AllocatorData->MappableBufferPools.clear();
+
+	vmaDestroyAllocator(s_AllocatorData->Allocator);
 
 	delete s_AllocatorData;
 	s_AllocatorData = nullptr;
 }
 
-VmaAllocation VulkanAllocator::AllocateBuffer(const VkBufferCreateInfo* bufferCI, MemoryType usage, bool bSeparateAllocation, VkBuffer* outBuffer)
+VmaAllocation VulkanAllocator::AllocateBuffer(const VkBufferCreateInfo* bufferCI, MemoryType usage, GPUMemoryCategory category, bool bSeparateAllocation, VkBuffer* outBuffer, const std::string& debugName)
 {
 	VmaAllocationCreateInfo ci{};
 	ci.usage = MemoryTypeToVmaUsage(usage);
 	ci.flags = bSeparateAllocation ? VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT : 0;
 
-	VmaAllocation allocation;
-	vmaCreateBuffer(s_AllocatorData->Allocator, bufferCI, &ci, outBuffer, &allocation, nullptr);
-
-	VmaAllocationInfo allocationInfo{};
-	vmaGetAllocationInfo(s_AllocatorData->Allocator, allocation, &allocationInfo);
-	s_AllocatorData->TotalAllocatedBytes += allocationInfo.size;
+	VmaAllocation allocation = VK_NULL_HANDLE;
+	VmaAllocator allocator = s_AllocatorData->Allocator;
+	if (!bSeparateAllocation && usage != MemoryType::Gpu)
+	{
+		VK_CHECK(CreateInPools(s_AllocatorData->MappableBufferPools, "Mappable buffers", ci,
+			[allocator, bufferCI](const VmaAllocationCreateInfo* allocationCI, uint32_t* outMemoryTypeIndex)
+			{ return vmaFindMemoryTypeIndexForBufferInfo(allocator, bufferCI, allocationCI, outMemoryTypeIndex); },
+			[allocator, bufferCI, outBuffer, &allocation](const VmaAllocationCreateInfo* allocationCI)
+			{ return vmaCreateBuffer(allocator, bufferCI, allocationCI, outBuffer, &allocation, nullptr); }));
+	}
+	else
+		VK_CHECK(vmaCreateBuffer(allocator, bufferCI, &ci, outBuffer, &allocation, nullptr));
 
+	OnAllocated(allocation, category, debugName);
 	return allocation;
 }
 
-VmaAllocation VulkanAllocator::AllocateImage(const VkImageCreateInfo* imageCI, MemoryType usage, bool bSeparateAllocation, VkImage* outImage)
+VmaAllocation VulkanAllocator::AllocateImage(const VkImageCreateInfo* imageCI, MemoryType usage, GPUMemoryCategory category, bool bSeparateAllocation, VkImage* outImage, const std::string& debugName)
 {
 	VmaAllocationCreateInfo ci{};
 	ci.usage = MemoryTypeToVmaUsage(usage);
 	ci.flags = bSeparateAllocation ? VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT : 0;
 
-	VmaAllocation allocation;
-	vmaCreateImage(s_AllocatorData->Allocator, imageCI, &ci, outImage, &allocation, nullptr);
+	VmaAllocation allocation = VK_NULL_HANDLE;
+	VmaAllocator allocator = s_AllocatorData->Allocator;
 
-	VmaAllocationInfo allocationInfo{};
-	vmaGetAllocationInfo(s_AllocatorData->Allocator, allocation, &allocationInfo);
-	s_AllocatorData->TotalAllocatedBytes += allocationInfo.size;
+	// Transient attachments prefer lazily allocated memory that may never be backed on tilers.
+	// Falls back to the regular allocation if there's no such memory type
+	if ((imageCI->usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) && usage == MemoryType::Gpu)
+	{
+		VmaAllocationCreateInfo lazyCI = ci;
+		lazyCI.usage = VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED;
+		lazyCI.flags |= VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+		if (vmaCreateImage(allocator, imageCI, &lazyCI, outImage, &allocation, nullptr) == VK_SUCCESS)
+		{
+			OnAllocated(allocation, category, debugName);
+			return allocation;
+		}
+	}
+
+	if (!bSeparateAllocation && imageCI->tiling == VK_IMAGE_TILING_OPTIMAL)
+	{
+		VK_CHECK(CreateInPools(s_AllocatorData->ImagePools, "Images", ci,
+			[allocator, imageCI](const VmaAllocationCreateInfo* allocationCI, uint32_t* outMemoryTypeIndex)
+			{ return vmaFindMemoryTypeIndexForImageInfo(allocator, imageCI, allocationCI, outMemoryTypeIndex); },
+			[allocator, imageCI, outImage, &allocation](const VmaAllocationCreateInfo* allocationCI)
+			{ return vmaCreateImage(allocator, imageCI, allocationCI, outImage, &allocation, nullptr); }));
+	}
+	else
+		VK_CHECK(vmaCreateImage(allocator, imageCI, &ci, outImage, &allocation, nullptr));
 
+	OnAllocated(allocation, category, debugName);
 	return allocation;
 }
 
 void VulkanAllocator::Free(VmaAllocation allocation)
 {
-	VmaAllocationInfo allocationInfo{};
-	vmaGetAllocationInfo(s_AllocatorData->Allocator, allocation, &allocationInfo);
-	s_AllocatorData->TotalFreedBytes += allocationInfo.size;
+	FinishDefragmentationPassIfMoved(allocation);
+	OnFreed(allocation);
 
 	vmaFreeMemory(s_AllocatorData->Allocator, allocation);
 }
 
 void VulkanAllocator::DestroyImage(VkImage image, VmaAllocation allocation)
 {
-	VmaAllocationInfo allocationInfo{};
-	vmaGetAllocationInfo(s_AllocatorData->Allocator, allocation, &allocationInfo);
-	s_AllocatorData->TotalFreedBytes += allocationInfo.size;
+	FinishDefragmentationPassIfMoved(allocation);
+	OnFreed(allocation);
 
 	vmaDestroyImage(s_AllocatorData->Allocator, image, allocation);
 }
 
 void VulkanAllocator::DestroyBuffer(VkBuffer buffer, VmaAllocation allocation)
 {
-	VmaAllocationInfo allocationInfo{};
-	vmaGetAllocationInfo(s_AllocatorData->Allocator, allocation, &allocationInfo);
-	s_AllocatorData->TotalFreedBytes += allocationInfo.size;
+	FinishDefragmentationPassIfMoved(allocation);
+	OnFreed(allocation);
 
 	vmaDestroyBuffer(s_AllocatorData->Allocator, buffer, allocation);
 }
@@ -142,6 +386,113 @@ void VulkanAllocator::FlushMemory(VmaAllocation allocation)
 	vmaFlushAllocation(s_AllocatorData->Allocator, allocation, 0, VK_WHOLE_SIZE);
 }
 
+void VulkanAllocator::InvalidateMemory(VmaAllocation allocation)
+{
+	vmaInvalidateAllocation(s_AllocatorData->Allocator, allocation, 0, VK_WHOLE_SIZE);
+}
+
+void VulkanAllocator::BindBufferMemory(VmaAllocation allocation, VkBuffer buffer)
+{
+	VK_CHECK(vmaBindBufferMemory(s_AllocatorData->Allocator, allocation, buffer));
+}
+
+void VulkanAllocator::BindImageMemory(VmaAllocation allocation, VkImage image)
+{
+	VK_CHECK(vmaBindImageMemory(s_AllocatorData->Allocator, allocation, image));
+}
+
+void VulkanAllocator::SetDefragmentable(VmaAllocation allocation, VulkanDefragmentable* resource)
+{
+	s_AllocatorData->Defragmentables[allocation] = resource;
+}
+
+void VulkanAllocator::BeginDefragmentation(uint64_t maxBytesPerPass, uint32_t maxAllocationsPerPass)
+{
+	auto& defrag = s_AllocatorData->Defragmentation;
+	if (defrag.Context)
+		return;
+
+	if (!defrag.CommandManager)
+	{
+		defrag.CommandManager = new VulkanCommandManager(CommandQueueFamily::Graphics, true);
+		defrag.Cmd = defrag.CommandManager->AllocateCommandBuffer(false);
+		defrag.Fence = MakeRef<VulkanFence>(true);
+	}
+
+	// Mappable buffer pools are not defragmented since they can be mapped at any moment
+	defrag.Pools.clear();
+	defrag.Pools.push_back(VK_NULL_HANDLE);
+	for (auto& it : s_AllocatorData->ImagePools)
+		defrag.Pools.push_back(it.second);
+
+	defrag.PoolIndex = 0;
+	defrag.MaxBytesPerPass = maxBytesPerPass;
+	defrag.MaxAllocationsPerPass = maxAllocationsPerPass;
+	defrag.TotalStats = {};
+
+	BeginNextDefragmentation();
+}
+
+bool VulkanAllocator::IsDefragmenting()
+{
+	return s_AllocatorData->Defragmentation.Context != VK_NULL_HANDLE;
+}
+
+void VulkanAllocator::Defragment()
+{
+	auto& defrag = s_AllocatorData->Defragmentation;
+	if (!defrag.Context)
+		return;
+
+	if (defrag.bPassInProgress)
+	{
+		if (defrag.Fence->IsSignaled())
+			FinishDefragmentationPass();
+		return;
+	}
+
+	VkResult result = vmaBeginDefragmentationPass(s_AllocatorData->Allocator, defrag.Context, &defrag.PassInfo);
+	if (result == VK_SUCCESS)
+	{
+		// Nothing to move
+		EndDefragmentation();
+		return;
+	}
+	assert(result == VK_INCOMPLETE);
+
+	defrag.Fence->Reset();
+	defrag.Cmd.Begin();
+	VkCommandBuffer vkCmd = defrag.Cmd.GetVulkanCommandBuffer();
+
+	// Previously submitted writes must be visible to the copies.
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(vkCmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	for (uint32_t i = 0; i < defrag.PassInfo.moveCount; ++i)
+	{
+		VmaDefragmentationMove& move = defrag.PassInfo.pMoves[i];
+		defrag.PassAllocations.insert(move.srcAllocation);
+
+		auto it = s_AllocatorData->Defragmentables.find(move.srcAllocation);
+		if (it != s_AllocatorData->Defragmentables.end() && it->second->BeginMove(defrag.Cmd, move.dstTmpAllocation))
+			defrag.MovedResources.push_back(it->second);
+		else
+			move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+	}
+
+	// Copies must be visible to the frames that are submitted later
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+	vkCmdPipelineBarrier(vkCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	defrag.Cmd.End();
+	defrag.CommandManager->Submit(&defrag.Cmd, 1, defrag.Fence, nullptr, 0, nullptr, 0);
+	defrag.bPassInProgress = true;
+}
+
 GPUMemoryStats VulkanAllocator::GetStats()
 {
 	const auto& memoryProps = s_AllocatorData->Device->GetPhysicalDevice()->GetMemoryProperties();
@@ -159,3 +510,52 @@ GPUMemoryStats VulkanAllocator::GetStats()
 
 	return { usage, budget - usage };
 }
+
+GPUMemoryCategoryStats VulkanAllocator::GetCategoryStats(GPUMemoryCategory category)
+{
+	assert(category != GPUMemoryCategory::Count);
+	return s_AllocatorData->CategoryStats[size_t(category)];
+}
+
+const char* VulkanAllocator::GetCategoryName(GPUMemoryCategory category)
+{
+	switch (category)
+	{
+		case GPUMemoryCategory::Texture: return "Texture";
+		case GPUMemoryCategory::RenderTarget: return "RenderTarget";
+		case GPUMemoryCategory::VertexBuffer: return "VertexBuffer";
+		case GPUMemoryCategory::IndexBuffer: return "IndexBuffer";
+		case GPUMemoryCategory::UniformBuffer: return "UniformBuffer";
+		case GPUMemoryCategory::StorageBuffer: return "StorageBuffer";
+		case GPUMemoryCategory::Staging: return "Staging";
+		case GPUMemoryCategory::Other: return "Other";
+	}
+	assert(!"Unknown memory category");
+	return "Unknown";
+}
+
+std::string VulkanAllocator::BuildStatsString(bool bDetailedMap)
+{
+	char* statsString = nullptr;
+	vmaBuildStatsString(s_AllocatorData->Allocator, &statsString, bDetailedMap ? VK_TRUE : VK_FALSE);
+	std::string result = statsString ? statsString : "";
+	vmaFreeStatsString(s_AllocatorData->Allocator, statsString);
+
+	return result;
+}
+
+bool VulkanAllocator::DumpStats(const Path& path, bool bDetailedMap)
+{
+	if (path.has_parent_path())
+		std::filesystem::create_directories(path.parent_path());
+
+	std::ofstream fout(path);
+	if (!fout)
+	{
+		std::cerr << "[Vulkan allocator] Failed to open file to dump stats: " << path << '\n';
+		return false;
+	}
+
+	fout << BuildStatsString(bDetailedMap);
+	return true;
+}
@@ -1,25 +1,64 @@
 #pragma once
 
+#include "Vulkan.h"
 #include "VulkanMemoryAllocator/vk_mem_alloc.h"
 
+#include <string>
+
 struct GPUMemoryStats
 {
 	uint64_t Used = 0;
 	uint64_t Free = 0;
 };
 
+enum class GPUMemoryCategory
+{
+	Texture,
+	RenderTarget,
+	VertexBuffer,
+	IndexBuffer,
+	UniformBuffer,
+	StorageBuffer,
+	Staging,
+	Other,
+
+	Count
+};
+
+struct GPUMemoryCategoryStats
+{
+	uint64_t Bytes = 0;
+	uint64_t AllocationsCount = 0;
+};
+
 class VulkanDevice;
+class VulkanCommandBuffer;
 enum class MemoryType;
 
-// TODO: Add pools
+// Resource that can be relocated by the defragmentation
+class VulkanDefragmentable
+{
+public:
+	virtual ~VulkanDefragmentable() = default;
+
+	// Creates a new resource bound to `dstAllocation` and records the copy of the contents into `cmd`.
+	// From now on, the resource must use the new handle. Returns false if the resource can't be moved
+	virtual bool BeginMove(VulkanCommandBuffer& cmd, VmaAllocation dstAllocation) = 0;
+
+	// Called once the copy is complete on the GPU. The old resource must be destroyed here
+	virtual void EndMove() = 0;
+};
+
+// Optimal-tiling images and mappable buffers are allocated from separate pools so they never share VkDeviceMemory
 class VulkanAllocator
 {
 public:
 	static void Init();
 	static void Shutdown();
 
-	[[nodiscard]] static VmaAllocation AllocateBuffer(const VkBufferCreateInfo* bufferCI, MemoryType usage, bool bSeparateAllocation, VkBuffer* outBuffer);
-	[[nodiscard]] static VmaAllocation AllocateImage(const VkImageCreateInfo* imageCI, MemoryType usage, bool bSeparateAllocation, VkImage* outImage);
+	// @debugName. Stored in the allocation. Used by leak reports and stats dumps
+	[[nodiscard]] static VmaAllocation AllocateBuffer(const VkBufferCreateInfo* bufferCI, MemoryType usage, GPUMemoryCategory category, bool bSeparateAllocation, VkBuffer* outBuffer, const std::string& debugName = "");
+	[[nodiscard]] static VmaAllocation AllocateImage(const VkImageCreateInfo* imageCI, MemoryType usage, GPUMemoryCategory category, bool bSeparateAllocation, VkImage* outImage, const std::string& debugName = "");
 
 	static void Free(VmaAllocation allocation);
 	static void DestroyImage(VkImage image, VmaAllocation allocation);
@@ -29,6 +68,30 @@ public:
 	[[nodiscard]] static void* MapMemory(VmaAllocation allocation);
 	static void UnmapMemory(VmaAllocation allocation);
 	static void FlushMemory(VmaAllocation allocation);
+	static void InvalidateMemory(VmaAllocation allocation);
+
+	static void BindBufferMemory(VmaAllocation allocation, VkBuffer buffer);
+	static void BindImageMemory(VmaAllocation allocation, VkImage image);
+
+	// Allows the defragmentation to move the allocation. Automatically unregistered when the allocation is freed
+	static void SetDefragmentable(VmaAllocation allocation, VulkanDefragmentable* resource);
+
+	// Starts incremental defragmentation of device-local memory. Does nothing if it's already running
+	// @maxBytesPerPass, @maxAllocationsPerPass. Budget of a single `Defragment` call. 0 means no limit
+	static void BeginDefragmentation(uint64_t maxBytesPerPass = 16ull * 1024 * 1024, uint32_t maxAllocationsPerPass = 16);
+	static bool IsDefragmenting();
+
+	// Should be called once per frame. Finishes the previous pass if the GPU is done with it, otherwise records and submits the next one.
+	// Moves are submitted to the graphics queue, so they are ordered with frames by submission order
+	static void Defragment();
+
+	static GPUMemoryStats GetStats();
+
+	// Live totals of the allocations of the category
+	static GPUMemoryCategoryStats GetCategoryStats(GPUMemoryCategory category);
+	static const char* GetCategoryName(GPUMemoryCategory category);
 
-	GPUMemoryStats GetStats();
+	// JSON produced by `vmaBuildStatsString`. With `bDetailedMap`, includes every allocation with its name
+	static std::string BuildStatsString(bool bDetailedMap = true);
+	static bool DumpStats(const Path& path, bool bDetailedMap = true);
 };
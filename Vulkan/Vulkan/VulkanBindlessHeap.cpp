@@ -0,0 +1,280 @@
+#include "VulkanBindlessHeap.h"
+#include "VulkanContext.h"
+#include "VulkanImage.h"
+#include "VulkanSampler.h"
+#include "VulkanBuffer.h"
+
+#include <algorithm>
+#include <iostream>
+
+static constexpr uint32_t s_MaxTextures = 16384u;
+static constexpr uint32_t s_MaxBuffers = 4096u;
+
+struct FreedIndex
+{
+	uint32_t Index;
+	uint64_t Frame;
+};
+
+// Array of descriptors with stable indices
+struct BindlessArray
+{
+	std::vector<uint32_t> FreeIndices;
+	std::vector<FreedIndex> PendingFree; // Might still be accessed by frames in flight
+	uint32_t Capacity = 0;
+	uint32_t Next = 0;
+
+	uint32_t Allocate()
+	{
+		if (!FreeIndices.empty())
+		{
+			const uint32_t index = FreeIndices.back();
+			FreeIndices.pop_back();
+			return index;
+		}
+		return Next < Capacity ? Next++ : VulkanBindlessHeap::InvalidIndex;
+	}
+};
+
+struct VulkanBindlessHeapData
+{
+	VkDevice Device = VK_NULL_HANDLE;
+	VkDescriptorSetLayout SetLayout = VK_NULL_HANDLE;
+	VkDescriptorPool Pool = VK_NULL_HANDLE;
+	VkDescriptorSet DescriptorSet = VK_NULL_HANDLE;
+
+	BindlessArray Textures;
+	BindlessArray Buffers;
+	std::vector<VkDescriptorImageInfo> TextureInfos; // Index -> Info. Used to update moved resources
+	std::vector<VkDescriptorBufferInfo> BufferInfos;
+
+	uint64_t FrameNumber = 0;
+	uint32_t FramesInFlight = 0;
+};
+
+static VulkanBindlessHeapData* s_Data = nullptr;
+
+static void WriteTexture(uint32_t index)
+{
+	VkWriteDescriptorSet write{};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = s_Data->DescriptorSet;
+	write.dstBinding = VulkanBindlessHeap::TexturesBinding;
+	write.dstArrayElement = index;
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	write.pImageInfo = &s_Data->TextureInfos[index];
+	vkUpdateDescriptorSets(s_Data->Device, 1, &write, 0, nullptr);
+}
+
+static void WriteBuffer(uint32_t index)
+{
+	VkWriteDescriptorSet write{};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = s_Data->DescriptorSet;
+	write.dstBinding = VulkanBindlessHeap::BuffersBinding;
+	write.dstArrayElement = index;
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	write.pBufferInfo = &s_Data->BufferInfos[index];
+	vkUpdateDescriptorSets(s_Data->Device, 1, &write, 0, nullptr);
+}
+
+void VulkanBindlessHeap::Init(uint32_t framesInFlight)
+{
+	const VulkanPhysicalDevice* physicalDevice = VulkanContext::GetDevice()->GetPhysicalDevice();
+	if (!physicalDevice->GetExtensionSupport().SupportsDescriptorIndexing)
+	{
+		std::cout << "[Vulkan bindless heap] Descriptor indexing is not supported. Bindless heap is disabled\n";
+		return;
+	}
+
+	s_Data = new VulkanBindlessHeapData();
+	s_Data->Device = VulkanContext::GetDevice()->GetVulkanDevice();
+	s_Data->FramesInFlight = framesInFlight;
+
+	const auto& limits = physicalDevice->GetDescriptorIndexingProperties();
+	s_Data->Textures.Capacity = std::min({ s_MaxTextures, limits.maxDescriptorSetUpdateAfterBindSampledImages, limits.maxPerStageDescriptorUpdateAfterBindSampledImages,
+		limits.maxDescriptorSetUpdateAfterBindSamplers, limits.maxPerStageDescriptorUpdateAfterBindSamplers });
+	s_Data->Buffers.Capacity = std::min({ s_MaxBuffers, limits.maxDescriptorSetUpdateAfterBindStorageBuffers, limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers });
+	s_Data->TextureInfos.resize(s_Data->Textures.Capacity);
+	s_Data->BufferInfos.resize(s_Data->Buffers.Capacity);
+
+	VkDescriptorSetLayoutBinding bindings[2]{};
+	bindings[0].binding = TexturesBinding;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[0].descriptorCount = s_Data->Textures.Capacity;
+	bindings[0].stageFlags = VK_SHADER_STAGE_ALL;
+	bindings[1].binding = BuffersBinding;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[1].descriptorCount = s_Data->Buffers.Capacity;
+	bindings[1].stageFlags = VK_SHADER_STAGE_ALL;
+
+	// Not registered slots are never accessed, and registered ones can be written while other slots are in use by the GPU
+	const VkDescriptorBindingFlags bindingFlag = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+	const VkDescriptorBindingFlags bindingFlags[2] = { bindingFlag, bindingFlag };
+	VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsCI{};
+	bindingFlagsCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+	bindingFlagsCI.bindingCount = 2;
+	bindingFlagsCI.pBindingFlags = bindingFlags;
+
+	VkDescriptorSetLayoutCreateInfo layoutCI{};
+	layoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCI.pNext = &bindingFlagsCI;
+	layoutCI.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+	layoutCI.bindingCount = 2;
+	layoutCI.pBindings = bindings;
+	VK_CHECK(vkCreateDescriptorSetLayout(s_Data->Device, &layoutCI, nullptr, &s_Data->SetLayout));
+
+	const VkDescriptorPoolSize poolSizes[] =
+	{
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, s_Data->Textures.Capacity },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, s_Data->Buffers.Capacity }
+	};
+	VkDescriptorPoolCreateInfo poolCI{};
+	poolCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCI.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	poolCI.maxSets = 1;
+	poolCI.poolSizeCount = 2;
+	poolCI.pPoolSizes = poolSizes;
+	VK_CHECK(vkCreateDescriptorPool(s_Data->Device, &poolCI, nullptr, &s_Data->Pool));
+
+	VkDescriptorSetAllocateInfo allocateInfo{};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocateInfo.descriptorPool = s_Data->Pool;
+	allocateInfo.descriptorSetCount = 1;
+	allocateInfo.pSetLayouts = &s_Data->SetLayout;
+	VK_CHECK(vkAllocateDescriptorSets(s_Data->Device, &allocateInfo, &s_Data->DescriptorSet));
+}
+
+void VulkanBindlessHeap::Shutdown()
+{
+	if (!s_Data)
+		return;
+
+	vkDestroyDescriptorPool(s_Data->Device, s_Data->Pool, nullptr);
+	vkDestroyDescriptorSetLayout(s_Data->Device, s_Data->SetLayout, nullptr);
+
+	delete s_Data;
+	s_Data = nullptr;
+}
+
+void VulkanBindlessHeap::BeginFrame()
+{
+	if (!s_Data)
+		return;
+
+	++s_Data->FrameNumber;
+	for (BindlessArray* array : { &s_Data->Textures, &s_Data->Buffers })
+	{
+		auto& pending = array->PendingFree;
+		auto it = std::remove_if(pending.begin(), pending.end(), [array](const FreedIndex& freed)
+		{
+			if (s_Data->FrameNumber - freed.Frame < s_Data->FramesInFlight)
+				return false;
+
+			array->FreeIndices.push_back(freed.Index);
+			return true;
+		});
+		pending.erase(it, pending.end());
+	}
+}
+
+bool VulkanBindlessHeap::IsSupported()
+{
+	return s_Data != nullptr;
+}
+
+VkDescriptorSetLayout VulkanBindlessHeap::GetSetLayout()
+{
+	return s_Data ? s_Data->SetLayout : VK_NULL_HANDLE;
+}
+
+VkDescriptorSet VulkanBindlessHeap::GetDescriptorSet()
+{
+	return s_Data ? s_Data->DescriptorSet : VK_NULL_HANDLE;
+}
+
+uint32_t VulkanBindlessHeap::RegisterTexture(const VulkanImage* image, const VulkanSampler* sampler)
+{
+	if (!s_Data || !image->GetVulkanImageView() || !sampler)
+		return InvalidIndex;
+
+	const uint32_t index = s_Data->Textures.Allocate();
+	if (index == InvalidIndex)
+	{
+		std::cerr << "[Vulkan bindless heap] Out of texture slots\n";
+		return InvalidIndex;
+	}
+
+	s_Data->TextureInfos[index] = { sampler->GetVulkanSampler(), image->GetVulkanImageView(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+	WriteTexture(index);
+	return index;
+}
+
+uint32_t VulkanBindlessHeap::RegisterBuffer(const VulkanBuffer* buffer)
+{
+	if (!s_Data)
+		return InvalidIndex;
+
+	assert(buffer->HasUsage(BufferUsage::StorageBuffer));
+	const uint32_t index = s_Data->Buffers.Allocate();
+	if (index == InvalidIndex)
+	{
+		std::cerr << "[Vulkan bindless heap] Out of buffer slots\n";
+		return InvalidIndex;
+	}
+
+	s_Data->BufferInfos[index] = { buffer->GetVulkanBuffer(), 0, VK_WHOLE_SIZE };
+	WriteBuffer(index);
+	return index;
+}
+
+void VulkanBindlessHeap::UnregisterTexture(uint32_t index)
+{
+	if (!s_Data || index == InvalidIndex)
+		return;
+
+	s_Data->TextureInfos[index] = {};
+	s_Data->Textures.PendingFree.push_back({ index, s_Data->FrameNumber });
+}
+
+void VulkanBindlessHeap::UnregisterBuffer(uint32_t index)
+{
+	if (!s_Data || index == InvalidIndex)
+		return;
+
+	s_Data->BufferInfos[index] = {};
+	s_Data->Buffers.PendingFree.push_back({ index, s_Data->FrameNumber });
+}
+
+void VulkanBindlessHeap::OnBufferMoved(VkBuffer oldBuffer, VkBuffer newBuffer)
+{
+	if (!s_Data)
+		return;
+
+	for (uint32_t i = 0; i < s_Data->Buffers.Next; ++i)
+	{
+		if (s_Data->BufferInfos[i].buffer == oldBuffer)
+		{
+			s_Data->BufferInfos[i].buffer = newBuffer;
+			WriteBuffer(i);
+		}
+	}
+}
+
+void VulkanBindlessHeap::OnImageMoved(const std::unordered_map<VkImageView, VkImageView>& views)
+{
+	if (!s_Data)
+		return;
+
+	for (uint32_t i = 0; i < s_Data->Textures.Next; ++i)
+	{
+		auto it = views.find(s_Data->TextureInfos[i].imageView);
+		if (it != views.end())
+		{
+			s_Data->TextureInfos[i].imageView = it->second;
+			WriteTexture(i);
+		}
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Vulkan.h"
+
+#include <vector>
+#include <unordered_map>
+
+class VulkanImage;
+class VulkanSampler;
+class VulkanBuffer;
+
+// Global descriptor set with large update-after-bind arrays of textures and storage buffers.
+// Resources are registered once and get a stable index that shaders read from push constants or instance data.
+// Shaders declare the heap at set `VulkanBindlessHeap::Set`:
+//     layout(set = 3, binding = 0) uniform sampler2D g_Textures[];
+//     layout(set = 3, binding = 1) buffer Buffers { uint Data[]; } g_Buffers[];
+// Pipelines that use this set share the heap's layout and have it bound automatically
+class VulkanBindlessHeap
+{
+public:
+	static constexpr uint32_t Set = 3;
+	static constexpr uint32_t TexturesBinding = 0;
+	static constexpr uint32_t BuffersBinding = 1;
+	static constexpr uint32_t InvalidIndex = uint32_t(-1);
+
+	VulkanBindlessHeap() = delete;
+
+	// Does nothing if descriptor indexing is not supported
+	// @framesInFlight. Freed indices are reused only after this many frames
+	static void Init(uint32_t framesInFlight);
+	static void Shutdown();
+
+	// Should be called once per frame. Recycles indices that were freed `framesInFlight` frames ago
+	static void BeginFrame();
+
+	static bool IsSupported();
+	static VkDescriptorSetLayout GetSetLayout();
+	static VkDescriptorSet GetDescriptorSet();
+
+	// Image must be in `ImageReadAccess::PixelShaderRead` layout when it's sampled
+	static uint32_t RegisterTexture(const VulkanImage* image, const VulkanSampler* sampler);
+	static uint32_t RegisterBuffer(const VulkanBuffer* buffer);
+	static void UnregisterTexture(uint32_t index);
+	static void UnregisterBuffer(uint32_t index);
+
+	// Called when a resource was moved to a new memory location
+	static void OnBufferMoved(VkBuffer oldBuffer, VkBuffer newBuffer);
+	static void OnImageMoved(const std::unordered_map<VkImageView, VkImageView>& views);
+};
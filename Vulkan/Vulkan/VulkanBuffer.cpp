@@ -1,6 +1,23 @@
 #include "VulkanBuffer.h"
 #include "VulkanUtils.h"
 #include "VulkanContext.h"
+#include "VulkanCommandManager.h"
+#include "VulkanPipeline.h"
+
+static GPUMemoryCategory GetMemoryCategory(const BufferSpecifications& specs)
+{
+	if (specs.MemoryType != MemoryType::Gpu && (specs.Usage & ~(BufferUsage::TransferSrc | BufferUsage::TransferDst)) == BufferUsage::None)
+		return GPUMemoryCategory::Staging;
+	if (HasFlags(specs.Usage, BufferUsage::VertexBuffer))
+		return GPUMemoryCategory::VertexBuffer;
+	if (HasFlags(specs.Usage, BufferUsage::IndexBuffer))
+		return GPUMemoryCategory::IndexBuffer;
+	if (HasFlags(specs.Usage, BufferUsage::UniformBuffer))
+		return GPUMemoryCategory::UniformBuffer;
+	if (HasFlags(specs.Usage, BufferUsage::StorageBuffer))
+		return GPUMemoryCategory::StorageBuffer;
+	return GPUMemoryCategory::Other;
+}
 
 VulkanBuffer::VulkanBuffer(const BufferSpecifications& specs, const std::string& debugName)
 	: m_DebugName(debugName)
@@ -11,10 +28,13 @@ VulkanBuffer::VulkanBuffer(const BufferSpecifications& specs, const std::string&
 	info.size = specs.Size;
 	info.usage = BufferUsageToVulkan(specs.Usage);
 
-	m_Allocation = VulkanAllocator::AllocateBuffer(&info, specs.MemoryType, false, &m_Buffer);
+	m_Allocation = VulkanAllocator::AllocateBuffer(&info, specs.MemoryType, GetMemoryCategory(specs), false, &m_Buffer, m_DebugName);
 	
 	if (!m_DebugName.empty())
 		VulkanContext::AddResourceDebugName(m_Buffer, m_DebugName, VK_OBJECT_TYPE_BUFFER);
+
+	if (IsMovable())
+		VulkanAllocator::SetDefragmentable(m_Allocation, this);
 }
 
 VulkanBuffer& VulkanBuffer::operator=(VulkanBuffer&& other) noexcept
@@ -25,21 +45,68 @@ VulkanBuffer& VulkanBuffer::operator=(VulkanBuffer&& other) noexcept
 	m_Specs = other.m_Specs;
 	m_Buffer = other.m_Buffer;
 	m_Allocation = other.m_Allocation;
+	m_MovedBuffer = other.m_MovedBuffer;
 
 	other.m_Specs = {};
 	other.m_Buffer = VK_NULL_HANDLE;
 	other.m_Allocation = VK_NULL_HANDLE;
+	other.m_MovedBuffer = VK_NULL_HANDLE;
 	
 	if (!m_DebugName.empty())
 		VulkanContext::AddResourceDebugName(m_Buffer, m_DebugName, VK_OBJECT_TYPE_BUFFER);
 
+	if (IsMovable())
+		VulkanAllocator::SetDefragmentable(m_Allocation, this);
+
 	return *this;
 }
 
+bool VulkanBuffer::BeginMove(VulkanCommandBuffer& cmd, VmaAllocation dstAllocation)
+{
+	VkDevice device = VulkanContext::GetDevice()->GetVulkanDevice();
+
+	VkBufferCreateInfo info{};
+	info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	info.size = m_Specs.Size;
+	info.usage = BufferUsageToVulkan(m_Specs.Usage);
+
+	VkBuffer newBuffer = VK_NULL_HANDLE;
+	if (vkCreateBuffer(device, &info, nullptr, &newBuffer) != VK_SUCCESS)
+		return false;
+	VulkanAllocator::BindBufferMemory(dstAllocation, newBuffer);
+
+	VkBufferCopy region{};
+	region.size = m_Specs.Size;
+	vkCmdCopyBuffer(cmd.GetVulkanCommandBuffer(), m_Buffer, newBuffer, 1, &region);
+
+	if (!m_DebugName.empty())
+		VulkanContext::AddResourceDebugName(newBuffer, m_DebugName, VK_OBJECT_TYPE_BUFFER);
+
+	m_MovedBuffer = m_Buffer;
+	m_Buffer = newBuffer;
+	VulkanPipeline::OnBufferMoved(m_MovedBuffer, m_Buffer);
+	VulkanBindlessHeap::OnBufferMoved(m_MovedBuffer, m_Buffer);
+
+	return true;
+}
+
+void VulkanBuffer::EndMove()
+{
+	if (!m_MovedBuffer)
+		return;
+
+	if (!m_DebugName.empty())
+		VulkanContext::RemoveResourceDebugName(m_MovedBuffer);
+	VulkanPipeline::OnResourceReleased(m_MovedBuffer);
+	vkDestroyBuffer(VulkanContext::GetDevice()->GetVulkanDevice(), m_MovedBuffer, nullptr);
+	m_MovedBuffer = VK_NULL_HANDLE;
+}
+
 void VulkanBuffer::Release()
 {
 	if (m_Buffer)
 	{
+		VulkanPipeline::OnResourceReleased(m_Buffer);
 		VulkanAllocator::DestroyBuffer(m_Buffer, m_Allocation);
 		if (!m_DebugName.empty())
 			VulkanContext::RemoveResourceDebugName(m_Buffer);
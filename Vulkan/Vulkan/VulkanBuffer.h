@@ -12,7 +12,7 @@ struct BufferSpecifications
 	BufferUsage Usage = BufferUsage::None;
 };
 
-class VulkanBuffer
+class VulkanBuffer : public VulkanDefragmentable
 {
 public:
 	VulkanBuffer(const BufferSpecifications& specs, const std::string& debugName = "");
@@ -21,10 +21,15 @@ public:
 		m_Specs = other.m_Specs;
 		m_Buffer = other.m_Buffer;
 		m_Allocation = other.m_Allocation;
+		m_MovedBuffer = other.m_MovedBuffer;
 
 		other.m_Specs = {};
 		other.m_Buffer = VK_NULL_HANDLE;
 		other.m_Allocation = VK_NULL_HANDLE;
+		other.m_MovedBuffer = VK_NULL_HANDLE;
+
+		if (IsMovable())
+			VulkanAllocator::SetDefragmentable(m_Allocation, this);
 	}
 
 	virtual ~VulkanBuffer()
@@ -37,7 +42,10 @@ public:
 	[[nodiscard]] void* Map()
 	{
 		assert(VulkanAllocator::IsHostVisible(m_Allocation));
-		return VulkanAllocator::MapMemory(m_Allocation);
+		void* mapped = VulkanAllocator::MapMemory(m_Allocation);
+		if (m_Specs.MemoryType == MemoryType::GpuToCpu)
+			VulkanAllocator::InvalidateMemory(m_Allocation); // Make GPU writes visible to the host
+		return mapped;
 	}
 	void Unmap()
 	{
@@ -54,12 +62,22 @@ public:
 
 	VkBuffer GetVulkanBuffer() const { return m_Buffer; }
 
+	bool BeginMove(VulkanCommandBuffer& cmd, VmaAllocation dstAllocation) override;
+	void EndMove() override;
+
 private:
 	void Release();
 
+	// Only GPU buffers that can be copied are moved during defragmentation
+	bool IsMovable() const
+	{
+		return m_Buffer && m_Specs.MemoryType == MemoryType::Gpu && HasFlags(m_Specs.Usage, BufferUsage::TransferSrc | BufferUsage::TransferDst);
+	}
+
 private:
 	std::string m_DebugName;
 	BufferSpecifications m_Specs;
 	VkBuffer m_Buffer = VK_NULL_HANDLE;
 	VmaAllocation m_Allocation = VK_NULL_HANDLE;
+	VkBuffer m_MovedBuffer = VK_NULL_HANDLE; // Buffer that's being moved from. Destroyed once the move is complete
 };
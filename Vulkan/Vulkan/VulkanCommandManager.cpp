@@ -2,10 +2,12 @@
 #include "VulkanContext.h"
 #include "VulkanGraphicsPipeline.h"
 #include "VulkanComputePipeline.h"
+#include "VulkanComputeAutotuner.h"
 #include "VulkanFramebuffer.h"
 #include "VulkanImage.h"
 #include "VulkanBuffer.h"
 #include "VulkanStagingManager.h"
+#include "VulkanGeometryArena.h"
 #include "VulkanShader.h"
 
 static uint32_t SelectQueueFamilyIndex(CommandQueueFamily queueFamily, const QueueFamilyIndices& indices)
@@ -89,6 +91,22 @@ void VulkanCommandManager::Submit(VulkanCommandBuffer* cmdBuffers, uint32_t cmdB
 	const Ref<VulkanFence>& signalFence,
 	const VulkanSemaphore* waitSemaphores, uint32_t waitSemaphoresCount,
 	const VulkanSemaphore* signalSemaphores, uint32_t signalSemaphoresCount)
+{
+	std::vector<const VulkanSemaphore*> waitSemaphoresPtrs(waitSemaphoresCount);
+	for (uint32_t i = 0; i < waitSemaphoresCount; ++i)
+		waitSemaphoresPtrs[i] = waitSemaphores + i;
+
+	std::vector<const VulkanSemaphore*> signalSemaphoresPtrs(signalSemaphoresCount);
+	for (uint32_t i = 0; i < signalSemaphoresCount; ++i)
+		signalSemaphoresPtrs[i] = signalSemaphores + i;
+
+	Submit(cmdBuffers, cmdBuffersCount, signalFence, waitSemaphoresPtrs, signalSemaphoresPtrs);
+}
+
+void VulkanCommandManager::Submit(VulkanCommandBuffer* cmdBuffers, uint32_t cmdBuffersCount,
+	const Ref<VulkanFence>& signalFence,
+	const std::vector<const VulkanSemaphore*>& waitSemaphores,
+	const std::vector<const VulkanSemaphore*>& signalSemaphores)
 {
 	std::vector<VkCommandBuffer> vkCmdBuffers(cmdBuffersCount);
 	for (uint32_t i = 0; i < cmdBuffersCount; ++i)
@@ -107,15 +125,17 @@ void VulkanCommandManager::Submit(VulkanCommandBuffer* cmdBuffers, uint32_t cmdB
 		cmdBuffer->m_UsedStagingBuffers.clear();
 	}
 
+	const uint32_t signalSemaphoresCount = uint32_t(signalSemaphores.size());
 	std::vector<VkSemaphore> vkSignalSemaphores(signalSemaphoresCount);
 	for (uint32_t i = 0; i < signalSemaphoresCount; ++i)
-		vkSignalSemaphores[i] = (signalSemaphores + i)->GetVulkanSemaphore();
+		vkSignalSemaphores[i] = signalSemaphores[i]->GetVulkanSemaphore();
 
+	const uint32_t waitSemaphoresCount = uint32_t(waitSemaphores.size());
 	std::vector<VkSemaphore> vkWaitSemaphores(waitSemaphoresCount);
 	std::vector<VkPipelineStageFlags> vkDstStageMask(waitSemaphoresCount);
 	for (uint32_t i = 0; i < waitSemaphoresCount; ++i)
 	{
-		vkWaitSemaphores[i] = (waitSemaphores + i)->GetVulkanSemaphore();
+		vkWaitSemaphores[i] = waitSemaphores[i]->GetVulkanSemaphore();
 		vkDstStageMask[i] = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
 	}
 
@@ -149,6 +169,7 @@ VulkanCommandBuffer::VulkanCommandBuffer(const VulkanCommandManager& manager, bo
 	m_Device = VulkanContext::GetDevice()->GetVulkanDevice();
 	m_CommandPool = manager.m_CommandPool;
 	m_QueueFlags = manager.m_QueueFlags;
+	m_QueueFamilyIndex = manager.m_QueueFamilyIndex;
 
 	VkCommandBufferAllocateInfo info{};
 	info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -172,6 +193,7 @@ void VulkanCommandBuffer::Begin()
 	info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
 
 	VK_CHECK(vkBeginCommandBuffer(m_CommandBuffer, &info));
+	ResetBoundBuffers();
 }
 
 void VulkanCommandBuffer::End()
@@ -181,6 +203,10 @@ void VulkanCommandBuffer::End()
 
 void VulkanCommandBuffer::Dispatch(VulkanComputePipeline* pipeline, uint32_t numGroupsX, uint32_t numGroupsY, uint32_t numGroupsZ, const void* pushConstants)
 {
+	// Async pipeline is not compiled yet
+	if (pipeline->m_bAsync && !pipeline->IsReady())
+		return;
+
 	vkCmdBindPipeline(m_CommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->GetVulkanPipeline());
 	CommitDescriptors(pipeline, VK_PIPELINE_BIND_POINT_COMPUTE);
 
@@ -194,11 +220,35 @@ void VulkanCommandBuffer::Dispatch(VulkanComputePipeline* pipeline, uint32_t num
 	vkCmdDispatch(m_CommandBuffer, numGroupsX, numGroupsY, numGroupsZ);
 }
 
+void VulkanCommandBuffer::DispatchThreads(VulkanComputePipeline* pipeline, const glm::uvec3& threads, const void* pushConstants)
+{
+	assert(pipeline->m_State.TunedWorkgroupDimensions > 0);
+
+	// Selects the variant first, since the number of groups depends on its workgroup size
+	const uint32_t query = VulkanComputeAutotuner::BeginDispatch(m_CommandBuffer, pipeline);
+	const glm::uvec3 numGroups = CalcNumGroups(threads, pipeline->GetWorkgroupSize());
+	Dispatch(pipeline, numGroups.x, numGroups.y, numGroups.z, pushConstants);
+	VulkanComputeAutotuner::EndDispatch(m_CommandBuffer, query);
+}
+
 void VulkanCommandBuffer::BeginGraphics(VulkanGraphicsPipeline* pipeline)
 {
 	auto& state = pipeline->GetState();
 	m_CurrentGraphicsPipeline = pipeline;
 
+	if (!pipeline->m_RenderPass)
+	{
+		RenderingAttachments attachments;
+		for (auto& attachment : state.ColorAttachments)
+			attachments.ColorAttachments.push_back(attachment.Image);
+		for (auto& attachment : state.ResolveAttachments)
+			attachments.ResolveAttachments.push_back(attachment.Image);
+		attachments.DepthStencilAttachment = state.DepthStencilAttachment.Image;
+
+		BeginRendering(pipeline, attachments);
+		return;
+	}
+
 	size_t usedResolveAttachmentsCount = std::count_if(state.ResolveAttachments.begin(), state.ResolveAttachments.end(), [](const auto& attachment) { return attachment.Image; });
 	std::vector<VkClearValue> clearValues(state.ColorAttachments.size() + usedResolveAttachmentsCount);
 	size_t i = 0;
@@ -242,11 +292,12 @@ void VulkanCommandBuffer::BeginGraphics(VulkanGraphicsPipeline* pipeline)
 	scissor.extent = { pipeline->m_Width, pipeline->m_Height };
 	vkCmdSetScissor(m_CommandBuffer, 0, 1, &scissor);
 
-	vkCmdBindPipeline(m_CommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->m_GraphicsPipeline);
+	BindGraphicsPipeline(pipeline);
 }
 
 void VulkanCommandBuffer::BeginGraphics(VulkanGraphicsPipeline* pipeline, const VulkanFramebuffer& framebuffer)
 {
+	assert(pipeline->m_RenderPass);
 	auto& state = pipeline->GetState();
 	m_CurrentGraphicsPipeline = pipeline;
 
@@ -282,7 +333,7 @@ void VulkanCommandBuffer::BeginGraphics(VulkanGraphicsPipeline* pipeline, const
 	beginInfo.pClearValues = clearValues.data();
 	beginInfo.renderArea.extent = { size.x, size.y };
 	vkCmdBeginRenderPass(m_CommandBuffer, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
-	vkCmdBindPipeline(m_CommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->m_GraphicsPipeline);
+	BindGraphicsPipeline(pipeline);
 
 	VkViewport viewport{};
 	viewport.width = float(size.x);
@@ -296,9 +347,128 @@ void VulkanCommandBuffer::BeginGraphics(VulkanGraphicsPipeline* pipeline, const
 	vkCmdSetScissor(m_CommandBuffer, 0, 1, &scissor);
 }
 
+void VulkanCommandBuffer::BeginGraphics(VulkanGraphicsPipeline* pipeline, const RenderingAttachments& attachments)
+{
+	assert(!pipeline->m_RenderPass);
+	BeginRendering(pipeline, attachments);
+}
+
+void VulkanCommandBuffer::BeginRendering(VulkanGraphicsPipeline* pipeline, const RenderingAttachments& attachments)
+{
+	auto& state = pipeline->GetState();
+	assert(attachments.ColorAttachments.size() == state.ColorAttachments.size());
+	assert(attachments.ResolveAttachments.empty() || attachments.ResolveAttachments.size() == state.ResolveAttachments.size());
+	m_CurrentGraphicsPipeline = pipeline;
+	m_RenderingTransitions.clear();
+
+	// There's no render pass to transition attachments, so it's done here and in `EndRendering`.
+	// Barriers can't be recorded inside of rendering, so all of them are recorded before it begins
+	glm::uvec2 size{ 0u };
+	std::vector<VkRenderingAttachmentInfoKHR> colorAttachments(state.ColorAttachments.size());
+	for (size_t i = 0; i < colorAttachments.size(); ++i)
+	{
+		VkRenderingAttachmentInfoKHR& info = colorAttachments[i];
+		info.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+
+		VulkanImage* image = attachments.ColorAttachments[i];
+		if (!image)
+			continue;
+
+		const ColorAttachment& attachment = state.ColorAttachments[i];
+		assert(image->HasUsage(ImageUsage::ColorAttachment));
+		TransitionLayout(image, attachment.bClearEnabled ? ImageLayout(ImageLayoutType::Unknown) : attachment.InitialLayout, ImageLayoutType::RenderTarget);
+		m_RenderingTransitions.push_back({ image, ImageLayoutType::RenderTarget, attachment.FinalLayout });
+		size = glm::uvec2(image->GetSize());
+
+		info.imageView = image->GetVulkanImageView();
+		info.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		info.loadOp = attachment.bClearEnabled ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		info.storeOp = image->HasUsage(ImageUsage::TransientAttachment) ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+		memcpy(&info.clearValue, &attachment.ClearColor, sizeof(info.clearValue));
+
+		VulkanImage* resolveImage = (i < attachments.ResolveAttachments.size()) ? attachments.ResolveAttachments[i] : nullptr;
+		if (resolveImage)
+		{
+			// Resolve overwrites previous contents
+			assert(resolveImage->HasUsage(ImageUsage::ColorAttachment));
+			TransitionLayout(resolveImage, ImageLayoutType::Unknown, ImageLayoutType::RenderTarget);
+			m_RenderingTransitions.push_back({ resolveImage, ImageLayoutType::RenderTarget, state.ResolveAttachments[i].FinalLayout });
+
+			info.resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT;
+			info.resolveImageView = resolveImage->GetVulkanImageView();
+			info.resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		}
+	}
+
+	VkRenderingAttachmentInfoKHR depthAttachment{};
+	depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+	VkFormat depthStencilFormat = VK_FORMAT_UNDEFINED;
+	if (VulkanImage* image = attachments.DepthStencilAttachment)
+	{
+		const DepthStencilAttachment& attachment = state.DepthStencilAttachment;
+		assert(image->HasUsage(ImageUsage::DepthStencilAttachment));
+		TransitionLayout(image, attachment.bClearEnabled ? ImageLayout(ImageLayoutType::Unknown) : attachment.InitialLayout, ImageLayoutType::DepthStencilWrite);
+		m_RenderingTransitions.push_back({ image, ImageLayoutType::DepthStencilWrite, attachment.FinalLayout });
+		depthStencilFormat = image->GetVulkanFormat();
+		if (size.x == 0)
+			size = glm::uvec2(image->GetSize());
+
+		depthAttachment.imageView = image->GetVulkanImageView();
+		depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		depthAttachment.loadOp = attachment.bClearEnabled ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		depthAttachment.storeOp = image->HasUsage(ImageUsage::TransientAttachment) ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+		depthAttachment.clearValue.depthStencil = { attachment.DepthClearValue, attachment.StencilClearValue };
+	}
+
+	// Stencil contents are not stored, same as with render passes
+	VkRenderingAttachmentInfoKHR stencilAttachment = depthAttachment;
+	stencilAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+	VkRenderingInfoKHR renderingInfo{};
+	renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+	renderingInfo.renderArea.extent = { size.x, size.y };
+	renderingInfo.layerCount = 1;
+	renderingInfo.colorAttachmentCount = uint32_t(colorAttachments.size());
+	renderingInfo.pColorAttachments = colorAttachments.data();
+	renderingInfo.pDepthAttachment = HasDepth(depthStencilFormat) ? &depthAttachment : nullptr;
+	renderingInfo.pStencilAttachment = HasStencil(depthStencilFormat) ? &stencilAttachment : nullptr;
+	VulkanContext::GetFunctions().cmdBeginRenderingKHR(m_CommandBuffer, &renderingInfo);
+
+	VkViewport viewport{};
+	viewport.width  = float(size.x);
+	viewport.height = float(size.y);
+	viewport.minDepth = 0.f;
+	viewport.maxDepth = 1.f;
+	vkCmdSetViewport(m_CommandBuffer, 0, 1, &viewport);
+
+	VkRect2D scissor{};
+	scissor.extent = { size.x, size.y };
+	vkCmdSetScissor(m_CommandBuffer, 0, 1, &scissor);
+
+	BindGraphicsPipeline(pipeline);
+}
+
+void VulkanCommandBuffer::EndRendering()
+{
+	VulkanContext::GetFunctions().cmdEndRenderingKHR(m_CommandBuffer);
+
+	for (auto& transition : m_RenderingTransitions)
+		TransitionLayout(transition.Image, transition.AttachmentLayout, transition.FinalLayout);
+	m_RenderingTransitions.clear();
+}
+
 void VulkanCommandBuffer::EndGraphics()
 {
 	assert(m_CurrentGraphicsPipeline);
+	ResetBoundBuffers();
+
+	if (!m_CurrentGraphicsPipeline->m_RenderPass)
+	{
+		EndRendering();
+		m_CurrentGraphicsPipeline = nullptr;
+		m_bSkipDraws = false;
+		return;
+	}
 
 	auto& state = m_CurrentGraphicsPipeline->m_State;
 	for (auto& attachment : state.ColorAttachments)
@@ -311,11 +481,128 @@ void VulkanCommandBuffer::EndGraphics()
 
 	vkCmdEndRenderPass(m_CommandBuffer);
 	m_CurrentGraphicsPipeline = nullptr;
+	m_bSkipDraws = false;
+}
+
+void VulkanCommandBuffer::BindGraphicsPipeline(const VulkanGraphicsPipeline* pipeline)
+{
+	// Render pass is still begun when draws are skipped, so attachments are cleared and end up in their final layouts
+	VkPipeline vkPipeline = pipeline->GetPipelineToBind();
+	m_bSkipDraws = (vkPipeline == VK_NULL_HANDLE);
+	if (vkPipeline)
+		vkCmdBindPipeline(m_CommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vkPipeline);
+	pipeline->RecordUsage();
+
+	// Values of dynamic states are undefined until they're set
+	ResetDynamicState(pipeline->GetState());
+	ResetBoundBuffers();
+}
+
+void VulkanCommandBuffer::ResetBoundBuffers()
+{
+	m_BoundVertexBuffers[0] = m_BoundVertexBuffers[1] = VK_NULL_HANDLE;
+	m_BoundIndexBuffer = VK_NULL_HANDLE;
+}
+
+void VulkanCommandBuffer::ResetDynamicState(const GraphicsPipelineState& state)
+{
+	const ExtensionSupport& support = VulkanContext::GetDevice()->GetPhysicalDevice()->GetExtensionSupport();
+	if (support.SupportsExtendedDynamicState)
+	{
+		SetCullMode(state.CullMode);
+		SetFrontFace(state.FrontFace);
+		SetTopology(state.Topology);
+		SetDepthCompareOp(state.DepthStencilAttachment.DepthCompareOp);
+		SetDepthWrite(state.DepthStencilAttachment.bWriteDepth);
+	}
+
+	if (support.SupportsExtendedDynamicState2)
+	{
+		SetPrimitiveRestart(false);
+		SetRasterizerDiscard(false);
+	}
+
+	if (support.SupportsExtendedDynamicState3)
+	{
+		for (uint32_t i = 0; i < uint32_t(state.ColorAttachments.size()); ++i)
+			SetBlendState(i, state.ColorAttachments[i].bBlendEnabled, state.ColorAttachments[i].BlendingState);
+	}
+}
+
+void VulkanCommandBuffer::SetCullMode(CullMode cullMode)
+{
+	assert(VulkanContext::GetFunctions().cmdSetCullModeEXT);
+	VulkanContext::GetFunctions().cmdSetCullModeEXT(m_CommandBuffer, CullModeToVulkan(cullMode));
+}
+
+void VulkanCommandBuffer::SetFrontFace(FrontFace frontFace)
+{
+	assert(VulkanContext::GetFunctions().cmdSetFrontFaceEXT);
+	VulkanContext::GetFunctions().cmdSetFrontFaceEXT(m_CommandBuffer, FrontFaceToVulkan(frontFace));
+}
+
+void VulkanCommandBuffer::SetTopology(Topology topology)
+{
+	assert(VulkanContext::GetFunctions().cmdSetPrimitiveTopologyEXT);
+	assert(m_CurrentGraphicsPipeline);
+	assert(topology == m_CurrentGraphicsPipeline->GetState().Topology || VulkanContext::GetDevice()->GetPhysicalDevice()->GetExtensionSupport().SupportsUnrestrictedDynamicTopology);
+	VulkanContext::GetFunctions().cmdSetPrimitiveTopologyEXT(m_CommandBuffer, TopologyToVulkan(topology));
+}
+
+void VulkanCommandBuffer::SetDepthCompareOp(CompareOperation compareOp)
+{
+	const VulkanFunctions& functions = VulkanContext::GetFunctions();
+	assert(functions.cmdSetDepthTestEnableEXT && functions.cmdSetDepthCompareOpEXT);
+
+	const bool bDepthTestEnabled = (compareOp != CompareOperation::Never);
+	functions.cmdSetDepthTestEnableEXT(m_CommandBuffer, bDepthTestEnabled);
+	functions.cmdSetDepthCompareOpEXT(m_CommandBuffer, CompareOpToVulkan(compareOp));
+}
+
+void VulkanCommandBuffer::SetDepthWrite(bool bEnabled)
+{
+	assert(VulkanContext::GetFunctions().cmdSetDepthWriteEnableEXT);
+	VulkanContext::GetFunctions().cmdSetDepthWriteEnableEXT(m_CommandBuffer, bEnabled);
+}
+
+void VulkanCommandBuffer::SetPrimitiveRestart(bool bEnabled)
+{
+	assert(VulkanContext::GetFunctions().cmdSetPrimitiveRestartEnableEXT);
+	VulkanContext::GetFunctions().cmdSetPrimitiveRestartEnableEXT(m_CommandBuffer, bEnabled);
+}
+
+void VulkanCommandBuffer::SetRasterizerDiscard(bool bEnabled)
+{
+	assert(VulkanContext::GetFunctions().cmdSetRasterizerDiscardEnableEXT);
+	VulkanContext::GetFunctions().cmdSetRasterizerDiscardEnableEXT(m_CommandBuffer, bEnabled);
+}
+
+void VulkanCommandBuffer::SetBlendState(uint32_t colorAttachment, bool bEnabled, const BlendState& blendState)
+{
+#ifdef VK_EXT_extended_dynamic_state3
+	const VulkanFunctions& functions = VulkanContext::GetFunctions();
+	assert(functions.cmdSetColorBlendEnableEXT && functions.cmdSetColorBlendEquationEXT);
+
+	const VkBool32 bBlendEnabled = bEnabled;
+	VkColorBlendEquationEXT equation{};
+	equation.colorBlendOp = (VkBlendOp)blendState.BlendOp;
+	equation.alphaBlendOp = (VkBlendOp)blendState.BlendOpAlpha;
+	equation.srcColorBlendFactor = (VkBlendFactor)blendState.BlendSrc;
+	equation.dstColorBlendFactor = (VkBlendFactor)blendState.BlendDst;
+	equation.srcAlphaBlendFactor = (VkBlendFactor)blendState.BlendSrcAlpha;
+	equation.dstAlphaBlendFactor = (VkBlendFactor)blendState.BlendDstAlpha;
+	functions.cmdSetColorBlendEnableEXT(m_CommandBuffer, colorAttachment, 1, &bBlendEnabled);
+	functions.cmdSetColorBlendEquationEXT(m_CommandBuffer, colorAttachment, 1, &equation);
+#else
+	assert(!"Vulkan headers don't support extended dynamic state 3");
+#endif
 }
 
 void VulkanCommandBuffer::Draw(uint32_t vertexCount, uint32_t firstVertex)
 {
 	assert(m_CurrentGraphicsPipeline);
+	if (m_bSkipDraws)
+		return;
 
 	CommitDescriptors(m_CurrentGraphicsPipeline, VK_PIPELINE_BIND_POINT_GRAPHICS);
 	vkCmdDraw(m_CommandBuffer, vertexCount, 1, firstVertex, 0);
@@ -328,13 +615,14 @@ void VulkanCommandBuffer::DrawIndexedInstanced(const VulkanBuffer* vertexBuffer,
 	assert(vertexBuffer->HasUsage(BufferUsage::VertexBuffer));
 	assert(perInstanceBuffer->HasUsage(BufferUsage::VertexBuffer));
 	assert(indexBuffer->HasUsage(BufferUsage::IndexBuffer));
+	if (m_bSkipDraws)
+		return;
 
 	CommitDescriptors(m_CurrentGraphicsPipeline, VK_PIPELINE_BIND_POINT_GRAPHICS);
 
-	VkBuffer vertexBuffers[2] = { vertexBuffer->GetVulkanBuffer(), perInstanceBuffer->GetVulkanBuffer() };
-	VkDeviceSize offsets[] = { 0, 0 };
-	vkCmdBindVertexBuffers(m_CommandBuffer, 0, 2, vertexBuffers, offsets);
-	vkCmdBindIndexBuffer(m_CommandBuffer, indexBuffer->GetVulkanBuffer(), 0, VK_INDEX_TYPE_UINT32);
+	BindVertexBuffer(0, vertexBuffer);
+	BindVertexBuffer(1, perInstanceBuffer);
+	BindIndexBuffer(indexBuffer);
 	vkCmdDrawIndexed(m_CommandBuffer, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
 }
 
@@ -343,17 +631,51 @@ void VulkanCommandBuffer::DrawIndexed(const VulkanBuffer* vertexBuffer, const Vu
 	assert(m_CurrentGraphicsPipeline);
 	assert(vertexBuffer->HasUsage(BufferUsage::VertexBuffer));
 	assert(indexBuffer->HasUsage(BufferUsage::IndexBuffer));
+	if (m_bSkipDraws)
+		return;
+
 	CommitDescriptors(m_CurrentGraphicsPipeline, VK_PIPELINE_BIND_POINT_GRAPHICS);
 
-	VkDeviceSize offsets[] = { 0, 0 };
-	VkBuffer vkVertex = vertexBuffer->GetVulkanBuffer();
-	VkBuffer vkIndex = indexBuffer->GetVulkanBuffer();
-	vkCmdBindVertexBuffers(m_CommandBuffer, 0, 1, &vkVertex, offsets);
-	vkCmdBindIndexBuffer(m_CommandBuffer, vkIndex, 0, VK_INDEX_TYPE_UINT32);
+	BindVertexBuffer(0, vertexBuffer);
+	BindIndexBuffer(indexBuffer);
 
 	vkCmdDrawIndexed(m_CommandBuffer, indexCount, 1, firstIndex, vertexOffset, 0);
 }
 
+void VulkanCommandBuffer::DrawIndexed(const VulkanGeometryArena* arena, const GeometryAllocation& mesh)
+{
+	assert(mesh.IsValid());
+	DrawIndexed(arena->GetVertexBuffer(), arena->GetIndexBuffer(), mesh.IndexCount, mesh.FirstIndex, mesh.FirstVertex);
+}
+
+void VulkanCommandBuffer::DrawIndexedInstanced(const VulkanGeometryArena* arena, const GeometryAllocation& mesh, uint32_t instanceCount, uint32_t firstInstance, const VulkanBuffer* perInstanceBuffer)
+{
+	assert(mesh.IsValid());
+	DrawIndexedInstanced(arena->GetVertexBuffer(), arena->GetIndexBuffer(), mesh.IndexCount, mesh.FirstIndex, int32_t(mesh.FirstVertex), instanceCount, firstInstance, perInstanceBuffer);
+}
+
+void VulkanCommandBuffer::BindVertexBuffer(uint32_t binding, const VulkanBuffer* buffer)
+{
+	assert(binding < 2);
+	VkBuffer vkBuffer = buffer->GetVulkanBuffer();
+	if (m_BoundVertexBuffers[binding] == vkBuffer)
+		return;
+
+	const VkDeviceSize offset = 0;
+	vkCmdBindVertexBuffers(m_CommandBuffer, binding, 1, &vkBuffer, &offset);
+	m_BoundVertexBuffers[binding] = vkBuffer;
+}
+
+void VulkanCommandBuffer::BindIndexBuffer(const VulkanBuffer* buffer)
+{
+	VkBuffer vkBuffer = buffer->GetVulkanBuffer();
+	if (m_BoundIndexBuffer == vkBuffer)
+		return;
+
+	vkCmdBindIndexBuffer(m_CommandBuffer, vkBuffer, 0, VK_INDEX_TYPE_UINT32);
+	m_BoundIndexBuffer = vkBuffer;
+}
+
 void VulkanCommandBuffer::SetGraphicsRootConstants(const void* vertexRootConstants, const void* fragmentRootConstants)
 {
 	assert(m_CurrentGraphicsPipeline);
@@ -611,6 +933,118 @@ void VulkanCommandBuffer::CopyImageToBuffer(const VulkanImage* src, VulkanBuffer
 	vkCmdCopyImageToBuffer(m_CommandBuffer, src->GetVulkanImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, dst->GetVulkanBuffer(), uint32_t(regionsCount), imageCopyRegions.data());
 }
 
+void VulkanCommandBuffer::ReleaseOwnership(VulkanImage* image, ImageLayout oldLayout, ImageLayout newLayout, uint32_t dstQueueFamilyIndex)
+{
+	image->SetImageLayout(newLayout);
+	const VkImageLayout vkOldLayout = ImageLayoutToVulkan(oldLayout);
+	const VkImageLayout vkNewLayout = ImageLayoutToVulkan(newLayout);
+
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = vkOldLayout;
+	barrier.newLayout = vkNewLayout;
+	barrier.srcQueueFamilyIndex = m_QueueFamilyIndex;
+	barrier.dstQueueFamilyIndex = dstQueueFamilyIndex;
+	barrier.image = image->GetVulkanImage();
+	barrier.subresourceRange.levelCount = image->GetMipsCount();
+	barrier.subresourceRange.layerCount = image->GetLayersCount();
+	barrier.subresourceRange.aspectMask = image->GetTransitionAspectMask(oldLayout, newLayout);
+
+	VkPipelineStageFlags srcStage;
+	VkPipelineStageFlags dstStage;
+	GetTransitionStagesAndAccesses(vkOldLayout, m_QueueFlags, vkNewLayout, m_QueueFlags, &srcStage, &barrier.srcAccessMask, &dstStage, &barrier.dstAccessMask);
+
+	// Destination scope is ignored for release operations
+	dstStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+	barrier.dstAccessMask = 0;
+
+	vkCmdPipelineBarrier(m_CommandBuffer,
+		srcStage, dstStage,
+		0,
+		0, nullptr,
+		0, nullptr,
+		1, &barrier);
+}
+
+void VulkanCommandBuffer::AcquireOwnership(VulkanImage* image, ImageLayout oldLayout, ImageLayout newLayout, uint32_t srcQueueFamilyIndex)
+{
+	image->SetImageLayout(newLayout);
+	const VkImageLayout vkOldLayout = ImageLayoutToVulkan(oldLayout);
+	const VkImageLayout vkNewLayout = ImageLayoutToVulkan(newLayout);
+
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = vkOldLayout;
+	barrier.newLayout = vkNewLayout;
+	barrier.srcQueueFamilyIndex = srcQueueFamilyIndex;
+	barrier.dstQueueFamilyIndex = m_QueueFamilyIndex;
+	barrier.image = image->GetVulkanImage();
+	barrier.subresourceRange.levelCount = image->GetMipsCount();
+	barrier.subresourceRange.layerCount = image->GetLayersCount();
+	barrier.subresourceRange.aspectMask = image->GetTransitionAspectMask(oldLayout, newLayout);
+
+	VkPipelineStageFlags srcStage;
+	VkPipelineStageFlags dstStage;
+	GetTransitionStagesAndAccesses(vkOldLayout, m_QueueFlags, vkNewLayout, m_QueueFlags, &srcStage, &barrier.srcAccessMask, &dstStage, &barrier.dstAccessMask);
+
+	// Source scope is ignored for acquire operations. Ordering with the release is provided by a semaphore
+	srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+	barrier.srcAccessMask = 0;
+
+	vkCmdPipelineBarrier(m_CommandBuffer,
+		srcStage, dstStage,
+		0,
+		0, nullptr,
+		0, nullptr,
+		1, &barrier);
+}
+
+void VulkanCommandBuffer::ReleaseOwnership(VulkanBuffer* buffer, BufferLayout oldLayout, uint32_t dstQueueFamilyIndex)
+{
+	VkPipelineStageFlags srcStage;
+	VkAccessFlags srcAccess;
+	GetStageAndAccess(oldLayout, m_QueueFlags, &srcStage, &srcAccess);
+
+	VkBufferMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = srcAccess;
+	barrier.dstAccessMask = 0;
+	barrier.srcQueueFamilyIndex = m_QueueFamilyIndex;
+	barrier.dstQueueFamilyIndex = dstQueueFamilyIndex;
+	barrier.buffer = buffer->GetVulkanBuffer();
+	barrier.size = buffer->GetSize();
+
+	vkCmdPipelineBarrier(m_CommandBuffer,
+		srcStage, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+		0,
+		0, nullptr,
+		1, &barrier,
+		0, nullptr);
+}
+
+void VulkanCommandBuffer::AcquireOwnership(VulkanBuffer* buffer, BufferLayout newLayout, uint32_t srcQueueFamilyIndex)
+{
+	VkPipelineStageFlags dstStage;
+	VkAccessFlags dstAccess;
+	GetStageAndAccess(newLayout, m_QueueFlags, &dstStage, &dstAccess);
+
+	VkBufferMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = dstAccess;
+	barrier.srcQueueFamilyIndex = srcQueueFamilyIndex;
+	barrier.dstQueueFamilyIndex = m_QueueFamilyIndex;
+	barrier.buffer = buffer->GetVulkanBuffer();
+	barrier.size = buffer->GetSize();
+
+	vkCmdPipelineBarrier(m_CommandBuffer,
+		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStage,
+		0,
+		0, nullptr,
+		1, &barrier,
+		0, nullptr);
+}
+
 void VulkanCommandBuffer::Write(VulkanImage* image, const void* data, size_t size, ImageLayout initialLayout, ImageLayout finalLayout)
 {
 	assert(image->HasUsage(ImageUsage::TransferDst));
@@ -659,6 +1093,60 @@ void VulkanCommandBuffer::Write(VulkanBuffer* buffer, const void* data, size_t s
 		TransitionLayout(buffer, BufferLayoutType::CopyDest, finalLayout);
 }
 
+Ref<VulkanReadbackFuture> VulkanCommandBuffer::Read(VulkanImage* image, ImageLayout initialLayout, ImageLayout finalLayout)
+{
+	return Read(image, 0, glm::ivec3(0), image->GetSize(), initialLayout, finalLayout);
+}
+
+Ref<VulkanReadbackFuture> VulkanCommandBuffer::Read(VulkanImage* image, uint32_t mipLevel, const glm::ivec3& offset, const glm::uvec3& extent, ImageLayout initialLayout, ImageLayout finalLayout)
+{
+	assert(image->HasUsage(ImageUsage::TransferSrc));
+	assert(mipLevel < image->GetMipsCount());
+
+	const uint32_t layersCount = image->GetLayersCount();
+	const size_t size = CalculateImageMemorySize(image->GetFormat(), extent.x, extent.y) * extent.z * layersCount;
+
+	VulkanStagingBuffer* stagingBuffer = VulkanStagingManager::AcquireBuffer(size, true);
+	m_UsedStagingBuffers.insert(stagingBuffer);
+
+	const ImageView imageView{ mipLevel, 1, 0 };
+	if (initialLayout != ImageReadAccess::CopySource)
+		TransitionLayout(image, imageView, initialLayout, ImageReadAccess::CopySource);
+
+	VkBufferImageCopy region{};
+	region.imageSubresource.aspectMask = image->GetDefaultAspectMask();
+	region.imageSubresource.mipLevel = mipLevel;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = layersCount;
+	region.imageOffset = { offset.x, offset.y, offset.z };
+	region.imageExtent = { extent.x, extent.y, extent.z };
+
+	vkCmdCopyImageToBuffer(m_CommandBuffer, image->GetVulkanImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, stagingBuffer->GetVulkanBuffer(), 1, &region);
+
+	if (finalLayout != ImageReadAccess::CopySource)
+		TransitionLayout(image, imageView, ImageReadAccess::CopySource, finalLayout);
+
+	return MakeRef<VulkanReadbackFuture>(stagingBuffer, size);
+}
+
+Ref<VulkanReadbackFuture> VulkanCommandBuffer::Read(VulkanBuffer* buffer, size_t offset, size_t size, BufferLayout initialLayout, BufferLayout finalLayout)
+{
+	assert(offset + size <= buffer->GetSize());
+
+	VulkanStagingBuffer* stagingBuffer = VulkanStagingManager::AcquireBuffer(size, true);
+	m_UsedStagingBuffers.insert(stagingBuffer);
+
+	if (initialLayout != BufferReadAccess::CopySource)
+		TransitionLayout(buffer, initialLayout, BufferReadAccess::CopySource);
+
+	CopyBuffer(buffer, stagingBuffer->GetBuffer(), offset, 0, size);
+
+	if (finalLayout != BufferReadAccess::CopySource)
+		TransitionLayout(buffer, BufferReadAccess::CopySource, finalLayout);
+
+	return MakeRef<VulkanReadbackFuture>(stagingBuffer, size);
+}
+
 void VulkanCommandBuffer::GenerateMips(VulkanImage* image, ImageLayout initialLayout, ImageLayout finalLayout)
 {
 	assert(image->HasUsage(ImageUsage::TransferSrc | ImageUsage::TransferDst));
@@ -729,7 +1217,7 @@ void VulkanCommandBuffer::CommitDescriptors(VulkanPipeline* pipeline, VkPipeline
 	dirtyDatas.reserve(descriptorSetsData.size());
 	for (auto& it : descriptorSetsData)
 	{
-		if (it.second.IsDirty())
+		if (it.second.IsDirty() && it.first != pipeline->m_Layout->PushDescriptorSet)
 			dirtyDatas.push_back({ &it.second, it.first });
 	}
 
@@ -737,34 +1225,50 @@ void VulkanCommandBuffer::CommitDescriptors(VulkanPipeline* pipeline, VkPipeline
 	std::vector<DescriptorWriteData> writeDatas;
 	writeDatas.reserve(dirtyDataCount);
 
-	// Populating writeData. Allocating DescriptorSet if neccessary
-	auto& descriptorSets = pipeline->GetDescriptorSets();
+	// Populating writeData. Sets with the same contents are taken from the cache and are not rewritten
 	for (size_t i = 0; i < dirtyDataCount; ++i)
 	{
-		uint32_t set = dirtyDatas[i].Set;
 		const VulkanDescriptorSet* currentDescriptorSet = nullptr;
-
-		auto it = descriptorSets.find(set);
-		if (it == descriptorSets.end())
-			currentDescriptorSet = &pipeline->AllocateDescriptorSet(set);
+		if (pipeline->AcquireDescriptorSet(dirtyDatas[i].Set, *dirtyDatas[i].Data, &currentDescriptorSet))
+			writeDatas.push_back({ currentDescriptorSet, dirtyDatas[i].Data });
 		else
-			currentDescriptorSet = &it->second;
-
-		assert(currentDescriptorSet);
-		writeDatas.push_back({ currentDescriptorSet, dirtyDatas[i].Data });
+			dirtyDatas[i].Data->OnFlushed();
 	}
 
-	if (!dirtyDatas.empty())
+	if (!writeDatas.empty())
 		VulkanDescriptorManager::WriteDescriptors(pipeline, writeDatas);
 
+	// Transient sets are released at the end of the frame, so they need to be reacquired during the next commit
+	for (auto& writeData : writeDatas)
+	{
+		if (writeData.DescriptorSet->IsTransient())
+			writeData.DescriptorSetData->MarkDirty();
+	}
+
 	VkPipelineLayout vkPipelineLayout = pipeline->GetVulkanPipelineLayout();
-	for (auto& it : descriptorSetsData)
+	auto& descriptorSets = pipeline->GetDescriptorSets();
+	for (auto& data : descriptorSetsData)
 	{
-		uint32_t set = it.first;
+		uint32_t set = data.first;
+		if (set == pipeline->m_Layout->PushDescriptorSet)
+		{
+			// Pushed on every commit since binding another pipeline might have disturbed it
+			VulkanDescriptorManager::PushDescriptors(m_CommandBuffer, pipeline, data.second);
+			continue;
+		}
+
 		auto it = descriptorSets.find(set);
 		assert(it != descriptorSets.end());
 		
 		vkCmdBindDescriptorSets(m_CommandBuffer, bindPoint, vkPipelineLayout,
-			set, 1, &it->second.GetVulkanDescriptorSet(), 0, nullptr);
+			set, 1, &it->second->GetVulkanDescriptorSet(), 0, nullptr);
+	}
+
+	if (pipeline->m_Layout->bUsesBindlessHeap)
+	{
+		assert(descriptorSetsData.find(VulkanBindlessHeap::Set) == descriptorSetsData.end()); // Heap set can't be written by the pipeline
+		VkDescriptorSet heapSet = VulkanBindlessHeap::GetDescriptorSet();
+		vkCmdBindDescriptorSets(m_CommandBuffer, bindPoint, vkPipelineLayout,
+			VulkanBindlessHeap::Set, 1, &heapSet, 0, nullptr);
 	}
 }
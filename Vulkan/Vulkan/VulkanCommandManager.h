@@ -24,6 +24,11 @@ class VulkanFramebuffer;
 class VulkanImage;
 class VulkanBuffer;
 class VulkanStagingBuffer;
+class VulkanReadbackFuture;
+class VulkanGeometryArena;
+struct GeometryAllocation;
+struct RenderingAttachments;
+struct GraphicsPipelineState;
 
 class VulkanCommandManager
 {
@@ -50,6 +55,8 @@ public:
 	VulkanCommandManager& operator=(VulkanCommandManager&& other) noexcept = delete;
 
 	VkQueue GetVulkanQueue() const { return m_Queue; }
+	VkQueueFlags GetQueueFlags() const { return m_QueueFlags; }
+	uint32_t GetQueueFamilyIndex() const { return m_QueueFamilyIndex; }
 
 	VulkanCommandBuffer AllocateCommandBuffer(bool bBegin = true);
 	VulkanCommandBuffer AllocateSecondaryCommandbuffer(bool bBegin = true);
@@ -61,6 +68,10 @@ public:
 	void Submit(VulkanCommandBuffer* cmdBuffers, uint32_t cmdBuffersCount,
 		const VulkanSemaphore* waitSemaphores = nullptr,   uint32_t waitSemaphoresCount = 0,
 		const VulkanSemaphore* signalSemaphores = nullptr, uint32_t signalSemaphoresCount = 0);
+	void Submit(VulkanCommandBuffer* cmdBuffers, uint32_t cmdBuffersCount,
+		const Ref<VulkanFence>& signalFence,
+		const std::vector<const VulkanSemaphore*>& waitSemaphores,
+		const std::vector<const VulkanSemaphore*>& signalSemaphores);
 
 private:
 	VkCommandPool m_CommandPool = VK_NULL_HANDLE;
@@ -86,12 +97,14 @@ public:
 		m_CommandBuffer = other.m_CommandBuffer;
 		m_CurrentGraphicsPipeline = other.m_CurrentGraphicsPipeline;
 		m_QueueFlags = other.m_QueueFlags;
+		m_QueueFamilyIndex = other.m_QueueFamilyIndex;
 
 		other.m_Device = VK_NULL_HANDLE;
 		other.m_CommandBuffer = VK_NULL_HANDLE;
 		other.m_CommandPool = VK_NULL_HANDLE;
 		other.m_CurrentGraphicsPipeline = nullptr;
 		other.m_QueueFlags = 0;
+		other.m_QueueFamilyIndex = uint32_t(-1);
 	}
 	virtual ~VulkanCommandBuffer();
 
@@ -106,12 +119,14 @@ public:
 		m_CommandBuffer = other.m_CommandBuffer;
 		m_CurrentGraphicsPipeline = other.m_CurrentGraphicsPipeline;
 		m_QueueFlags = other.m_QueueFlags;
+		m_QueueFamilyIndex = other.m_QueueFamilyIndex;
 
 		other.m_Device = VK_NULL_HANDLE;
 		other.m_CommandBuffer = VK_NULL_HANDLE;
 		other.m_CommandPool = VK_NULL_HANDLE;
 		other.m_CurrentGraphicsPipeline = nullptr;
 		other.m_QueueFlags = 0;
+		other.m_QueueFamilyIndex = uint32_t(-1);
 
 		return *this;
 	}
@@ -120,17 +135,39 @@ public:
 	void End();
 
 	void Dispatch(VulkanComputePipeline* pipeline, uint32_t numGroupsX, uint32_t numGroupsY, uint32_t numGroupsZ, const void* pushConstants);
+	// Dispatches enough workgroups to cover `threads`. Should be used for pipelines with tuned workgroup sizes, since their size can change between dispatches
+	void DispatchThreads(VulkanComputePipeline* pipeline, const glm::uvec3& threads, const void* pushConstants);
 
 	void BeginGraphics(VulkanGraphicsPipeline* pipeline);
 	void BeginGraphics(VulkanGraphicsPipeline* pipeline, const VulkanFramebuffer& framebuffer);
+	// Renders into `attachments` instead of the images of the pipeline state. Layouts and load ops are taken from the state.
+	// Requires dynamic rendering. Images must match formats of the pipeline attachments
+	void BeginGraphics(VulkanGraphicsPipeline* pipeline, const RenderingAttachments& attachments);
 	void EndGraphics();
 	void Draw(uint32_t vertexCount, uint32_t firstVertex);
 	void DrawIndexedInstanced(const VulkanBuffer* vertexBuffer, const VulkanBuffer* indexBuffer, uint32_t indexCount, uint32_t firstIndex, int32_t vertexOffset,
 		uint32_t instanceCount, uint32_t firstInstance, const VulkanBuffer* perInstanceBuffer);
 	void DrawIndexed(const VulkanBuffer* vertexBuffer, const VulkanBuffer* indexBuffer, uint32_t indexCount, uint32_t firstIndex, uint32_t vertexOffset);
 
+	// Draws a mesh of the arena. Arena buffers are bound only if they're not bound already
+	void DrawIndexed(const VulkanGeometryArena* arena, const GeometryAllocation& mesh);
+	void DrawIndexedInstanced(const VulkanGeometryArena* arena, const GeometryAllocation& mesh, uint32_t instanceCount, uint32_t firstInstance, const VulkanBuffer* perInstanceBuffer);
+
 	void SetGraphicsRootConstants(const void* vertexRootConstants, const void* fragmentRootConstants);
 
+	// Override the state of the current graphics pipeline until another one is bound. Pipelines that only differ in these states share a `VkPipeline`.
+	// Require `SupportsExtendedDynamicState`
+	void SetCullMode(CullMode cullMode);
+	void SetFrontFace(FrontFace frontFace);
+	void SetTopology(Topology topology); // Must match the pipeline topology unless `SupportsUnrestrictedDynamicTopology`
+	void SetDepthCompareOp(CompareOperation compareOp); // `Never` disables depth test
+	void SetDepthWrite(bool bEnabled);
+	// Require `SupportsExtendedDynamicState2`
+	void SetPrimitiveRestart(bool bEnabled);
+	void SetRasterizerDiscard(bool bEnabled);
+	// Requires `SupportsExtendedDynamicState3`
+	void SetBlendState(uint32_t colorAttachment, bool bEnabled, const BlendState& blendState);
+
 	void StorageImageBarrier(VulkanImage* image) { TransitionLayout(image, ImageLayoutType::StorageImage, ImageLayoutType::StorageImage); }
 	void TransitionLayout(VulkanImage* image, ImageLayout oldLayout, ImageLayout newLayout);
 	void TransitionLayout(VulkanImage* image, const ImageView& imageView, ImageLayout oldLayout, ImageLayout newLayout);
@@ -150,16 +187,37 @@ public:
 	void CopyBufferToImage(const VulkanBuffer* src, VulkanImage* dst, const std::vector<BufferImageCopy>& regions);
 	void CopyImageToBuffer(const VulkanImage* src, VulkanBuffer* dst, const std::vector<BufferImageCopy>& regions);
 
+	// Queue family ownership transfer. Release is recorded on the source queue, acquire on the destination queue.
+	// Both sides must use the same layouts. Layout transition (if any) happens as a part of the ownership transfer
+	void ReleaseOwnership(VulkanImage* image, ImageLayout oldLayout, ImageLayout newLayout, uint32_t dstQueueFamilyIndex);
+	void AcquireOwnership(VulkanImage* image, ImageLayout oldLayout, ImageLayout newLayout, uint32_t srcQueueFamilyIndex);
+	void ReleaseOwnership(VulkanBuffer* buffer, BufferLayout oldLayout, uint32_t dstQueueFamilyIndex);
+	void AcquireOwnership(VulkanBuffer* buffer, BufferLayout newLayout, uint32_t srcQueueFamilyIndex);
+
 	// TODO: Implement writing to all mips
 	void Write(VulkanImage* image, const void* data, size_t size, ImageLayout initialLayout, ImageLayout finalLayout);
 	void Write(VulkanBuffer* buffer, const void* data, size_t size, size_t offset, BufferLayout initialLayout, BufferLayout finalLayout);
 
+	// Records a copy into a pooled CPU-readable staging buffer. Returned future becomes ready once the submission of this command buffer is complete.
+	// Image data is tightly packed. Image must have `TransferSrc` usage, buffer must have `TransferSrc` usage
+	[[nodiscard]] Ref<VulkanReadbackFuture> Read(VulkanImage* image, ImageLayout initialLayout, ImageLayout finalLayout);
+	[[nodiscard]] Ref<VulkanReadbackFuture> Read(VulkanImage* image, uint32_t mipLevel, const glm::ivec3& offset, const glm::uvec3& extent, ImageLayout initialLayout, ImageLayout finalLayout);
+	[[nodiscard]] Ref<VulkanReadbackFuture> Read(VulkanBuffer* buffer, size_t offset, size_t size, BufferLayout initialLayout, BufferLayout finalLayout);
+
 	void GenerateMips(VulkanImage* image, ImageLayout initialLayout, ImageLayout finalLayout);
 
+	// Buffers that are bound directly into it are not tracked, so such commands should be recorded between `BeginGraphics` and `EndGraphics`
 	VkCommandBuffer GetVulkanCommandBuffer() const { return m_CommandBuffer; }
 
 private:
 	void CommitDescriptors(VulkanPipeline* pipeline, VkPipelineBindPoint bindPoint);
+	void BeginRendering(VulkanGraphicsPipeline* pipeline, const RenderingAttachments& attachments);
+	void EndRendering();
+	void BindGraphicsPipeline(const VulkanGraphicsPipeline* pipeline);
+	void ResetDynamicState(const GraphicsPipelineState& state); // Sets supported dynamic states to the values of `state`
+	void BindVertexBuffer(uint32_t binding, const VulkanBuffer* buffer);
+	void BindIndexBuffer(const VulkanBuffer* buffer);
+	void ResetBoundBuffers(); // Buffers bound outside of `BindVertexBuffer` and `BindIndexBuffer` are unknown, so the next binds are always recorded
 
 private:
 	std::unordered_set<VulkanStagingBuffer*> m_UsedStagingBuffers;
@@ -167,7 +225,19 @@ private:
 	VkCommandPool m_CommandPool = VK_NULL_HANDLE;
 	VkCommandBuffer m_CommandBuffer = VK_NULL_HANDLE;
 	VkQueueFlags m_QueueFlags;
+	uint32_t m_QueueFamilyIndex = uint32_t(-1);
 	VulkanGraphicsPipeline* m_CurrentGraphicsPipeline = nullptr;
+	bool m_bSkipDraws = false; // Set if the current async graphics pipeline and its fallback are not compiled yet
+	VkBuffer m_BoundVertexBuffers[2] = { VK_NULL_HANDLE, VK_NULL_HANDLE }; // Per vertex and per instance bindings
+	VkBuffer m_BoundIndexBuffer = VK_NULL_HANDLE;
+
+	struct AttachmentTransition
+	{
+		VulkanImage* Image;
+		ImageLayout AttachmentLayout;
+		ImageLayout FinalLayout;
+	};
+	std::vector<AttachmentTransition> m_RenderingTransitions; // Attachments of the current dynamic rendering. Transitioned to final layouts once it ends
 
 	friend class VulkanCommandManager;
 };
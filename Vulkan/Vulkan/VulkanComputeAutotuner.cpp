@@ -0,0 +1,337 @@
+#include "VulkanComputeAutotuner.h"
+#include "VulkanComputePipeline.h"
+#include "VulkanContext.h"
+
+#include <unordered_map>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+static constexpr uint32_t s_ResultsFileMagic = 0x4E555441; // "ATUN"
+static constexpr uint32_t s_ResultsFileVersion = 2; // Should be bumped if the format of kernel keys changes
+static constexpr uint32_t s_MaxTimings = 64; // Timings that can be in flight at once. Each one takes two queries
+static constexpr uint32_t s_SamplesPerCandidate = 8; // The fastest sample is used, so occasional stalls don't affect the result
+
+// Candidates per dimensions count. Ones that exceed device limits are skipped
+static const std::vector<glm::uvec3> s_Candidates[3] =
+{
+	{ { 32, 1, 1 }, { 64, 1, 1 }, { 128, 1, 1 }, { 256, 1, 1 }, { 512, 1, 1 } },
+	{ { 8, 8, 1 }, { 16, 8, 1 }, { 8, 16, 1 }, { 16, 16, 1 }, { 32, 8, 1 }, { 32, 16, 1 }, { 32, 32, 1 } },
+	{ { 4, 4, 4 }, { 8, 4, 4 }, { 8, 8, 4 }, { 8, 8, 8 } }
+};
+// Used if sizes can't be tuned. They fit the minimal limits of the spec
+static const glm::uvec3 s_DefaultSizes[3] = { { 64, 1, 1 }, { 8, 8, 1 }, { 4, 4, 4 } };
+
+struct TuningSession
+{
+	PipelineKey Kernel;
+	std::vector<glm::uvec3> Candidates;
+	std::vector<uint64_t> BestTicks; // Per candidate
+	std::vector<uint32_t> Samples; // Per candidate
+	uint32_t NextCandidate = 0;
+};
+
+struct PendingTiming
+{
+	VulkanComputePipeline* Pipeline = nullptr;
+	uint32_t Candidate = 0;
+	uint32_t Query = 0;
+};
+
+struct VulkanComputeAutotunerData
+{
+	VkDevice Device = VK_NULL_HANDLE;
+	VkQueryPool QueryPool = VK_NULL_HANDLE; // Null if timestamps are not supported
+	float TimestampPeriod = 1.f; // Nanoseconds per tick
+	std::vector<uint32_t> FreeQueries; // First queries of free timings
+	std::vector<PendingTiming> PendingTimings;
+	std::unordered_map<VulkanComputePipeline*, TuningSession> Sessions;
+
+	std::unordered_map<PipelineKey, glm::uvec3, PipelineKeyHash> Results; // Kernel -> Workgroup size
+	std::filesystem::path ResultsPath;
+	bool bResultsChanged = false;
+};
+
+static VulkanComputeAutotunerData* s_Data = nullptr;
+
+// Tuning results are only valid for the device and driver they were measured with
+static std::filesystem::path GetResultsPath()
+{
+	const VkPhysicalDeviceProperties& props = VulkanContext::GetDevice()->GetPhysicalDevice()->GetProperties();
+
+	VkPhysicalDeviceIDProperties idProperties{};
+	idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+	VkPhysicalDeviceProperties2 properties2{};
+	properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	properties2.pNext = &idProperties;
+	vkGetPhysicalDeviceProperties2(VulkanContext::GetDevice()->GetPhysicalDevice()->GetVulkanPhysicalDevice(), &properties2);
+
+	std::stringstream fileName;
+	for (auto uuid_element : idProperties.deviceUUID)
+		fileName << (std::hex) << (std::uint32_t)uuid_element << (std::dec);
+	fileName << "_" << std::to_string(props.driverVersion) << "_compute.autotune";
+
+	return Path(Renderer::GetRendererCachePath()) / fileName.str();
+}
+
+static void LoadResults()
+{
+	std::ifstream in(s_Data->ResultsPath, std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
+	if (!in)
+		return;
+
+	// Sizes are checked against it, so a truncated or corrupted file can't make us allocate arbitrary amounts of memory
+	const size_t fileSize = size_t(in.tellg());
+	in.seekg(0, std::ios_base::beg);
+
+	uint32_t magic = 0, version = 0, count = 0;
+	in.read((char*)&magic, sizeof(magic));
+	in.read((char*)&version, sizeof(version));
+	in.read((char*)&count, sizeof(count));
+	if (!in || magic != s_ResultsFileMagic || version != s_ResultsFileVersion)
+		return;
+
+	std::vector<uint8_t> data;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		glm::uvec3 size{ 0u };
+		uint32_t keySize = 0;
+		in.read((char*)&size, sizeof(size));
+		in.read((char*)&keySize, sizeof(keySize));
+		if (!in)
+			break;
+
+		if (keySize > fileSize - size_t(in.tellg()))
+		{
+			std::cerr << "[Vulkan compute autotuner] Results file is corrupted: " << s_Data->ResultsPath << "\n";
+			break;
+		}
+
+		data.resize(keySize);
+		in.read((char*)data.data(), keySize);
+		if (!in)
+			break;
+
+		PipelineKey kernel;
+		kernel.Append(data.data(), data.size());
+		s_Data->Results[kernel] = size;
+	}
+}
+
+// Writes into a temporary file first and then replaces the old file with it
+static void SaveResults()
+{
+	std::error_code error;
+	std::filesystem::create_directories(s_Data->ResultsPath.parent_path(), error);
+
+	std::filesystem::path tempPath = s_Data->ResultsPath;
+	tempPath += ".tmp";
+
+	std::ofstream out(tempPath, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+	const uint32_t count = (uint32_t)s_Data->Results.size();
+	out.write((const char*)&s_ResultsFileMagic, sizeof(s_ResultsFileMagic));
+	out.write((const char*)&s_ResultsFileVersion, sizeof(s_ResultsFileVersion));
+	out.write((const char*)&count, sizeof(count));
+	for (auto& [kernel, size] : s_Data->Results)
+	{
+		const uint32_t keySize = (uint32_t)kernel.GetData().size();
+		out.write((const char*)&size, sizeof(size));
+		out.write((const char*)&keySize, sizeof(keySize));
+		out.write((const char*)kernel.GetData().data(), keySize);
+	}
+	out.close();
+
+	if (out)
+		std::filesystem::rename(tempPath, s_Data->ResultsPath, error);
+	if (!out || error)
+		std::cerr << "[Vulkan compute autotuner] Failed to save results to " << s_Data->ResultsPath << "\n";
+}
+
+// Drops the session of the pipeline with its pending timings
+static void EndTuning(VulkanComputePipeline* pipeline)
+{
+	if (s_Data->Sessions.erase(pipeline) == 0)
+		return;
+
+	auto& pending = s_Data->PendingTimings;
+	for (auto it = pending.begin(); it != pending.end();)
+	{
+		if (it->Pipeline == pipeline)
+		{
+			s_Data->FreeQueries.push_back(it->Query);
+			it = pending.erase(it);
+		}
+		else
+			++it;
+	}
+}
+
+static bool FitsLimits(const glm::uvec3& size, const VkPhysicalDeviceLimits& limits)
+{
+	return size.x <= limits.maxComputeWorkGroupSize[0]
+		&& size.y <= limits.maxComputeWorkGroupSize[1]
+		&& size.z <= limits.maxComputeWorkGroupSize[2]
+		&& size.x * size.y * size.z <= limits.maxComputeWorkGroupInvocations;
+}
+
+void VulkanComputeAutotuner::Init()
+{
+	assert(!s_Data);
+	s_Data = new VulkanComputeAutotunerData();
+	s_Data->Device = VulkanContext::GetDevice()->GetVulkanDevice();
+	s_Data->ResultsPath = GetResultsPath();
+	LoadResults();
+
+	// All graphics and compute queues support timestamps if it's set
+	const VkPhysicalDeviceLimits& limits = VulkanContext::GetDevice()->GetPhysicalDevice()->GetProperties().limits;
+	if (!limits.timestampComputeAndGraphics)
+	{
+		std::cout << "[Vulkan compute autotuner] Timestamps are not supported. Default workgroup sizes are used\n";
+		return;
+	}
+
+	// Queries are reset on the host when they're freed. Resetting them in a command buffer could leave results of their previous timing
+	// available until that command buffer is executed, and they would be credited to the next candidate
+	if (!VulkanContext::GetDevice()->GetPhysicalDevice()->GetExtensionSupport().SupportsHostQueryReset)
+	{
+		std::cout << "[Vulkan compute autotuner] Host query reset is not supported. Default workgroup sizes are used\n";
+		return;
+	}
+
+	s_Data->TimestampPeriod = limits.timestampPeriod;
+
+	VkQueryPoolCreateInfo queryPoolCI{};
+	queryPoolCI.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolCI.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolCI.queryCount = s_MaxTimings * 2;
+	VK_CHECK(vkCreateQueryPool(s_Data->Device, &queryPoolCI, nullptr, &s_Data->QueryPool));
+	vkResetQueryPool(s_Data->Device, s_Data->QueryPool, 0, queryPoolCI.queryCount);
+
+	s_Data->FreeQueries.reserve(s_MaxTimings);
+	for (uint32_t i = 0; i < s_MaxTimings; ++i)
+		s_Data->FreeQueries.push_back(i * 2);
+}
+
+void VulkanComputeAutotuner::Shutdown()
+{
+	if (!s_Data->Sessions.empty())
+		std::cerr << "[Vulkan compute autotuner] " << s_Data->Sessions.size() << " pipelines are still being tuned\n";
+
+	if (s_Data->bResultsChanged)
+		SaveResults();
+
+	if (s_Data->QueryPool)
+		vkDestroyQueryPool(s_Data->Device, s_Data->QueryPool, nullptr);
+
+	delete s_Data;
+	s_Data = nullptr;
+}
+
+void VulkanComputeAutotuner::Update()
+{
+	auto& pending = s_Data->PendingTimings;
+	for (auto it = pending.begin(); it != pending.end();)
+	{
+		// Timestamp and availability of both queries. Never waits for the GPU
+		uint64_t results[4] = {};
+		const VkResult result = vkGetQueryPoolResults(s_Data->Device, s_Data->QueryPool, it->Query, 2, sizeof(results), results, sizeof(uint64_t) * 2,
+			VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+		if (result == VK_NOT_READY || !results[1] || !results[3])
+		{
+			++it;
+			continue;
+		}
+
+		vkResetQueryPool(s_Data->Device, s_Data->QueryPool, it->Query, 2);
+		s_Data->FreeQueries.push_back(it->Query);
+		auto sessionIt = s_Data->Sessions.find(it->Pipeline);
+		TuningSession& session = sessionIt->second;
+		session.BestTicks[it->Candidate] = std::min(session.BestTicks[it->Candidate], results[2] - results[0]);
+		++session.Samples[it->Candidate];
+		it = pending.erase(it);
+
+		if (std::any_of(session.Samples.begin(), session.Samples.end(), [](uint32_t samples) { return samples < s_SamplesPerCandidate; }))
+			continue;
+
+		// Every candidate was timed enough times. Remaining timings of the pipeline are dropped
+		VulkanComputePipeline* pipeline = sessionIt->first;
+		const uint32_t winner = uint32_t(std::min_element(session.BestTicks.begin(), session.BestTicks.end()) - session.BestTicks.begin());
+		const glm::uvec3& size = session.Candidates[winner];
+		pipeline->m_CurrentVariant = winner;
+		s_Data->Results[session.Kernel] = size;
+		s_Data->bResultsChanged = true;
+
+		std::cout << "[Vulkan compute autotuner] Picked workgroup size " << size.x << "x" << size.y << "x" << size.z << " for "
+			<< pipeline->m_State.ComputeShader->GetPath() << " (" << session.BestTicks[winner] * s_Data->TimestampPeriod / 1000.f << " us)\n";
+
+		EndTuning(pipeline);
+		it = pending.begin();
+	}
+}
+
+std::vector<glm::uvec3> VulkanComputeAutotuner::GetWorkgroupSizes(const PipelineKey& kernel, uint32_t dimensions)
+{
+	assert(dimensions >= 1 && dimensions <= 3);
+
+	auto it = s_Data->Results.find(kernel);
+	if (it != s_Data->Results.end())
+		return { it->second };
+
+	if (!s_Data->QueryPool)
+		return { s_DefaultSizes[dimensions - 1] };
+
+	const VkPhysicalDeviceLimits& limits = VulkanContext::GetDevice()->GetPhysicalDevice()->GetProperties().limits;
+	std::vector<glm::uvec3> candidates;
+	for (auto& size : s_Candidates[dimensions - 1])
+		if (FitsLimits(size, limits))
+			candidates.push_back(size);
+
+	if (candidates.empty())
+		candidates.push_back(s_DefaultSizes[dimensions - 1]);
+	return candidates;
+}
+
+void VulkanComputeAutotuner::BeginTuning(VulkanComputePipeline* pipeline, const PipelineKey& kernel, const std::vector<glm::uvec3>& candidates)
+{
+	assert(s_Data->QueryPool && candidates.size() > 1);
+
+	TuningSession& session = s_Data->Sessions[pipeline];
+	session.Kernel = kernel;
+	session.Candidates = candidates;
+	session.BestTicks.assign(candidates.size(), UINT64_MAX);
+	session.Samples.assign(candidates.size(), 0);
+}
+
+void VulkanComputeAutotuner::OnPipelineDestroyed(VulkanComputePipeline* pipeline)
+{
+	EndTuning(pipeline);
+}
+
+uint32_t VulkanComputeAutotuner::BeginDispatch(VkCommandBuffer cmd, VulkanComputePipeline* pipeline)
+{
+	auto it = s_Data->Sessions.find(pipeline);
+	if (it == s_Data->Sessions.end())
+		return uint32_t(-1);
+
+	TuningSession& session = it->second;
+	const uint32_t candidate = session.NextCandidate;
+	session.NextCandidate = (candidate + 1) % (uint32_t)session.Candidates.size();
+	pipeline->m_CurrentVariant = candidate;
+
+	// Variants that are still compiling are not timed, since a dispatch of an async pipeline is skipped
+	if (s_Data->FreeQueries.empty() || !pipeline->IsReady())
+		return uint32_t(-1);
+
+	const uint32_t query = s_Data->FreeQueries.back();
+	s_Data->FreeQueries.pop_back();
+	s_Data->PendingTimings.push_back({ pipeline, candidate, query });
+
+	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, s_Data->QueryPool, query);
+	return query;
+}
+
+void VulkanComputeAutotuner::EndDispatch(VkCommandBuffer cmd, uint32_t query)
+{
+	if (query != uint32_t(-1))
+		vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, s_Data->QueryPool, query + 1);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Vulkan.h"
+#include "VulkanPipelineRegistry.h"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+class VulkanComputePipeline;
+
+// Picks workgroup sizes of compute pipelines by timing candidate sizes with timestamp queries.
+// Candidates are timed in turn by the regular dispatches of a pipeline, so tuning doesn't need dedicated dispatches.
+// Winners are persisted in the renderer cache per device UUID, so only the first run of a kernel is tuned
+class VulkanComputeAutotuner
+{
+public:
+	VulkanComputeAutotuner() = delete;
+
+	static void Init();
+	static void Shutdown();
+
+	// Should be called once per frame. Reads finished timings and picks winners of pipelines whose candidates were all timed
+	static void Update();
+
+	// Returns the persisted winner of `kernel` if there's one. Otherwise candidates that fit device limits.
+	// If timestamps are not supported, returns a single default size
+	static std::vector<glm::uvec3> GetWorkgroupSizes(const PipelineKey& kernel, uint32_t dimensions);
+
+	// Should be called once the variants of candidate sizes are created. `GetWorkgroupSizes` should have returned more than one size
+	static void BeginTuning(VulkanComputePipeline* pipeline, const PipelineKey& kernel, const std::vector<glm::uvec3>& candidates);
+	// Drops pending timings of the pipeline
+	static void OnPipelineDestroyed(VulkanComputePipeline* pipeline);
+
+	// Selects the variant that the next dispatch of `pipeline` uses and begins its timing if the pipeline is being tuned.
+	// Returns the first query of the timing that should be passed to `EndDispatch`
+	static uint32_t BeginDispatch(VkCommandBuffer cmd, VulkanComputePipeline* pipeline);
+	static void EndDispatch(VkCommandBuffer cmd, uint32_t query);
+};
@@ -1,76 +1,150 @@
 #include "VulkanComputePipeline.h"
-#include "VulkanPipelineCache.h"
+#include "VulkanPipelineCompiler.h"
+#include "VulkanComputeAutotuner.h"
 
-VulkanComputePipeline::VulkanComputePipeline(const ComputePipelineState& state, const VulkanComputePipeline* parentPipeline)
-	: m_State(state)
+// Everything that `VkComputePipelineCreateInfo` points to. Kept alive until the pipeline is compiled by a worker
+struct ComputePipelineCreateData
 {
-	assert(m_State.ComputeShader->GetType() == ShaderType::Compute);
+	ComputePipelineCreateData() = default;
+	ComputePipelineCreateData(const ComputePipelineCreateData&) = delete;
+	ComputePipelineCreateData& operator=(const ComputePipelineCreateData&) = delete;
 
-	VkDevice device = VulkanContext::GetDevice()->GetVulkanDevice();
-	// Pipeline layout
+	VkSpecializationInfo SpecializationInfo{};
+	std::vector<VkSpecializationMapEntry> MapEntries;
+	std::vector<uint8_t> SpecializationData;
+	VkComputePipelineCreateInfo PipelineCI{};
+};
+
+static void AppendString(PipelineKey& key, const std::string& str)
+{
+	key.Append(str.size());
+	key.Append(str.data(), str.size());
+}
+
+// Identifies a kernel across sessions, so tuning results can be persisted. Doesn't reference objects of the session.
+// Binary hash is included, so results of a shader are not reused once its source changes
+static PipelineKey MakeKernelKey(const ComputePipelineState& state)
+{
+	PipelineKey key;
+	AppendString(key, state.ComputeShader->GetPath().string());
+	key.Append(state.ComputeShader->GetBinaryHash());
+	key.Append(state.ComputeShader->GetDefines().size());
+	for (auto& [name, value] : state.ComputeShader->GetDefines())
 	{
-		m_SetBindings = state.ComputeShader->GeLayoutSetBindings();
-		const uint32_t setsCount = (uint32_t)m_SetBindings.size();
+		AppendString(key, name);
+		AppendString(key, value);
+	}
 
-		m_SetLayouts.clear();
-		m_SetLayouts.resize(setsCount);
-		for (uint32_t i = 0; i < setsCount; ++i)
+	const ShaderSpecializationInfo& info = state.ComputeSpecializationInfo;
+	const bool bUsed = info.Data && (info.Size > 0);
+	key.Append(bUsed);
+	if (bUsed)
+	{
+		key.Append(info.MapEntries.size());
+		for (auto& entry : info.MapEntries)
 		{
-			VkDescriptorSetLayoutCreateInfo layoutInfo{};
-			layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-			layoutInfo.bindingCount = (uint32_t)m_SetBindings[i].size();
-			layoutInfo.pBindings = m_SetBindings[i].data();
-
-			VK_CHECK(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &m_SetLayouts[i]));
+			key.Append(entry.ConstantID);
+			key.Append(entry.Offset);
+			key.Append(uint64_t(entry.Size));
 		}
-
-		std::vector<VkPushConstantRange> pushConstants;
-		for (auto& range : state.ComputeShader->GetPushConstantRanges())
-			pushConstants.push_back(range);
-
-		VkPipelineLayoutCreateInfo pipelineLayoutCI{};
-		pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-		pipelineLayoutCI.setLayoutCount = setsCount;
-		pipelineLayoutCI.pSetLayouts = m_SetLayouts.data();
-		pipelineLayoutCI.pushConstantRangeCount = (uint32_t)pushConstants.size();
-		pipelineLayoutCI.pPushConstantRanges = pushConstants.data();
-
-		VK_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutCI, nullptr, &m_PipelineLayout));
+		key.Append(info.Size);
+		key.Append(info.Data, info.Size);
 	}
 
+	key.Append(state.TunedWorkgroupDimensions);
+	return key;
+}
+
+// Tuned workgroup dimensions are appended to the specialization constants of the state
+static std::shared_future<VkPipeline> SubmitVariant(const ComputePipelineState& state, VkPipelineLayout pipelineLayout, const glm::uvec3& workgroupSize, std::shared_future<VkPipeline> parent)
+{
+	VkDevice device = VulkanContext::GetDevice()->GetVulkanDevice();
+	std::shared_ptr<ComputePipelineCreateData> createData = std::make_shared<ComputePipelineCreateData>();
 	VkPipelineShaderStageCreateInfo shaderStage = state.ComputeShader->GetPipelineShaderStageInfo();
-	VkSpecializationInfo specializationInfo{};
-	std::vector<VkSpecializationMapEntry> mapEntries;
+	VkSpecializationInfo& specializationInfo = createData->SpecializationInfo;
+	std::vector<VkSpecializationMapEntry>& mapEntries = createData->MapEntries;
+	std::vector<uint8_t>& specializationData = createData->SpecializationData;
 	if (state.ComputeSpecializationInfo.Data && (state.ComputeSpecializationInfo.Size > 0))
 	{
-		const size_t mapEntriesCount = state.ComputeSpecializationInfo.MapEntries.size();
-		mapEntries.reserve(mapEntriesCount);
 		for (auto& entry : state.ComputeSpecializationInfo.MapEntries)
 			mapEntries.emplace_back(VkSpecializationMapEntry{ entry.ConstantID, entry.Offset, entry.Size });
 
-		specializationInfo.pData = state.ComputeSpecializationInfo.Data;
-		specializationInfo.dataSize = state.ComputeSpecializationInfo.Size;
-		specializationInfo.mapEntryCount = (uint32_t)mapEntriesCount;
+		// Copied since the state only points to the data
+		const uint8_t* data = static_cast<const uint8_t*>(state.ComputeSpecializationInfo.Data);
+		specializationData.assign(data, data + state.ComputeSpecializationInfo.Size);
+	}
+
+	for (uint32_t i = 0; i < state.TunedWorkgroupDimensions; ++i)
+	{
+		const uint32_t offset = (uint32_t)specializationData.size();
+		mapEntries.emplace_back(VkSpecializationMapEntry{ VulkanComputePipeline::s_WorkgroupSizeConstantID + i, offset, sizeof(uint32_t) });
+		specializationData.resize(offset + sizeof(uint32_t));
+		memcpy(specializationData.data() + offset, &workgroupSize[i], sizeof(uint32_t));
+	}
+
+	if (!mapEntries.empty())
+	{
+		specializationInfo.pData = specializationData.data();
+		specializationInfo.dataSize = specializationData.size();
+		specializationInfo.mapEntryCount = (uint32_t)mapEntries.size();
 		specializationInfo.pMapEntries = mapEntries.data();
 		shaderStage.pSpecializationInfo = &specializationInfo;
 	}
 
-	VkComputePipelineCreateInfo info{};
+	VkComputePipelineCreateInfo& info = createData->PipelineCI;
 	info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
 	info.stage = shaderStage;
-	info.layout = m_PipelineLayout;
+	info.layout = pipelineLayout;
 	info.basePipelineIndex = -1;
-	info.basePipelineHandle = parentPipeline ? parentPipeline->m_ComputePipeline : VK_NULL_HANDLE;
-	VK_CHECK(vkCreateComputePipelines(device, VulkanPipelineCache::GetCache(), 1, &info, nullptr, &m_ComputePipeline));
+
+	return VulkanPipelineCompiler::Submit([device, createData, parent](VkPipelineCache cache)
+	{
+		VkComputePipelineCreateInfo& info = createData->PipelineCI;
+		info.basePipelineHandle = parent.valid() ? parent.get() : VK_NULL_HANDLE;
+
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		VK_CHECK(vkCreateComputePipelines(device, cache, 1, &info, nullptr, &pipeline));
+		return pipeline;
+	});
 }
 
-VulkanComputePipeline::~VulkanComputePipeline()
+VulkanComputePipeline::VulkanComputePipeline(const ComputePipelineState& state, const VulkanComputePipeline* parentPipeline)
+	: m_State(state)
 {
-	VkDevice device = VulkanContext::GetDevice()->GetVulkanDevice();
+	assert(m_State.ComputeShader->GetType() == ShaderType::Compute);
+	assert(m_State.TunedWorkgroupDimensions <= 3);
 
-	vkDestroyPipeline(device, m_ComputePipeline, nullptr);
-	vkDestroyPipelineLayout(device, m_PipelineLayout, nullptr);
+	AcquireLayout(VK_PIPELINE_BIND_POINT_COMPUTE, { state.ComputeShader }, state.PushDescriptorSet);
 
-	m_ComputePipeline = VK_NULL_HANDLE;
-	m_PipelineLayout = VK_NULL_HANDLE;
+	std::shared_future<VkPipeline> parent = parentPipeline ? parentPipeline->m_Variants[parentPipeline->m_CurrentVariant].Pipeline : std::shared_future<VkPipeline>();
+	if (state.TunedWorkgroupDimensions == 0)
+	{
+		m_Variants.push_back({ glm::uvec3(0u), SubmitVariant(state, GetVulkanPipelineLayout(), glm::uvec3(0u), parent) });
+		return;
+	}
+
+	// Every candidate is compiled up front, so tuning doesn't wait for compilation between dispatches
+	const PipelineKey kernel = MakeKernelKey(state);
+	const std::vector<glm::uvec3> workgroupSizes = VulkanComputeAutotuner::GetWorkgroupSizes(kernel, state.TunedWorkgroupDimensions);
+	m_Variants.reserve(workgroupSizes.size());
+	for (auto& size : workgroupSizes)
+		m_Variants.push_back({ size, SubmitVariant(state, GetVulkanPipelineLayout(), size, parent) });
+
+	if (m_Variants.size() > 1)
+		VulkanComputeAutotuner::BeginTuning(this, kernel, workgroupSizes);
+}
+
+VulkanComputePipeline::~VulkanComputePipeline()
+{
+	VulkanComputeAutotuner::OnPipelineDestroyed(this);
+	for (auto& variant : m_Variants)
+		VulkanPipelineCompiler::DestroyPipeline(variant.Pipeline);
+	m_Variants.clear();
+}
+
+VulkanComputePipeline* VulkanComputePipeline::RequestAsync(const ComputePipelineState& state)
+{
+	VulkanComputePipeline* pipeline = new VulkanComputePipeline(state);
+	pipeline->m_bAsync = true;
+	return pipeline;
 }
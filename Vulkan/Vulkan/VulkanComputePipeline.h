@@ -3,11 +3,20 @@
 #include "Vulkan.h"
 #include "VulkanPipeline.h"
 #include "VulkanShader.h"
+#include "VulkanPipelineRegistry.h"
+
+#include <glm/glm.hpp>
+#include <future>
+#include <chrono>
 
 struct ComputePipelineState
 {
 	VulkanShader* ComputeShader = nullptr;
 	ShaderSpecializationInfo ComputeSpecializationInfo;
+	uint32_t PushDescriptorSet = uint32_t(-1); // Optional. Set that is pushed into the command buffer instead of being allocated. Falls back to a regular set if push descriptors are not supported
+	// Optional. If set, the first 1-3 workgroup dimensions are specialized with sizes picked by `VulkanComputeAutotuner`.
+	// Shader should declare them with `local_size_{x,y,z}_id` starting at `VulkanComputePipeline::s_WorkgroupSizeConstantID`
+	uint32_t TunedWorkgroupDimensions = 0;
 };
 
 inline uint32_t CalcNumGroups(uint32_t size, uint32_t groupSize)
@@ -25,19 +34,45 @@ inline glm::uvec3 CalcNumGroups(glm::uvec3 size, uint32_t groupSize)
 	return (size + groupSize - 1u) / groupSize;
 }
 
+inline glm::uvec3 CalcNumGroups(glm::uvec3 size, glm::uvec3 groupSize)
+{
+	return (size + groupSize - 1u) / groupSize;
+}
+
 class VulkanComputePipeline : public VulkanPipeline
 {
 public:
 	VulkanComputePipeline(const ComputePipelineState& state, const VulkanComputePipeline* parentPipeline = nullptr);
 	virtual ~VulkanComputePipeline();
 
-	VkPipeline GetVulkanPipeline() const { return m_ComputePipeline; }
-	virtual VkPipelineLayout GetVulkanPipelineLayout() const override { return m_PipelineLayout; }
+	// Pipelines are compiled on `VulkanPipelineCompiler` workers. Waits if the pipeline is not compiled yet.
+	// While the workgroup size is tuned, it's the variant of the candidate that the next dispatch uses
+	VkPipeline GetVulkanPipeline() const { return m_Variants[m_CurrentVariant].Pipeline.get(); }
+	bool IsReady() const { return m_Variants[m_CurrentVariant].Pipeline.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }
+
+	// Workgroup size that the current variant is specialized with. Can change between dispatches while the size is tuned
+	const glm::uvec3& GetWorkgroupSize() const { return m_Variants[m_CurrentVariant].WorkgroupSize; }
+
+	// Unlike the constructor, the returned pipeline never stalls command recording. Dispatches are skipped until it's compiled
+	static VulkanComputePipeline* RequestAsync(const ComputePipelineState& state);
+
+	// IDs of specialization constants of tuned workgroup dimensions are consecutive
+	static constexpr uint32_t s_WorkgroupSizeConstantID = 100;
 
 private:
+	struct Variant
+	{
+		glm::uvec3 WorkgroupSize{ 0u }; // Zero if the size is not specialized
+		std::shared_future<VkPipeline> Pipeline;
+	};
+
 	ComputePipelineState m_State;
-	VkPipeline m_ComputePipeline = VK_NULL_HANDLE;
-	VkPipelineLayout m_PipelineLayout = VK_NULL_HANDLE;
+	// A variant per candidate while the workgroup size is tuned, since dispatches take turns with them.
+	// Variants that lost are kept until destruction since frames in flight can still use them
+	std::vector<Variant> m_Variants;
+	uint32_t m_CurrentVariant = 0;
+	bool m_bAsync = false; // If set, command buffers don't wait for the pipeline
 
 	friend class VulkanCommandBuffer;
+	friend class VulkanComputeAutotuner;
 };
@@ -225,4 +225,32 @@ void VulkanContext::InitDevices(VkSurfaceKHR surface, bool bRequireSurface)
 void VulkanContext::InitFunctions()
 {
 	m_Functions.setDebugUtilsObjectNameEXT = (PFN_vkSetDebugUtilsObjectNameEXT)(void*)vkGetDeviceProcAddr(m_Device->GetVulkanDevice(), "vkSetDebugUtilsObjectNameEXT");
+	if (m_PhysicalDevice->GetExtensionSupport().SupportsPushDescriptors)
+		m_Functions.cmdPushDescriptorSetWithTemplateKHR = (PFN_vkCmdPushDescriptorSetWithTemplateKHR)(void*)vkGetDeviceProcAddr(m_Device->GetVulkanDevice(), "vkCmdPushDescriptorSetWithTemplateKHR");
+	if (m_PhysicalDevice->GetExtensionSupport().SupportsDynamicRendering)
+	{
+		m_Functions.cmdBeginRenderingKHR = (PFN_vkCmdBeginRenderingKHR)(void*)vkGetDeviceProcAddr(m_Device->GetVulkanDevice(), "vkCmdBeginRenderingKHR");
+		m_Functions.cmdEndRenderingKHR = (PFN_vkCmdEndRenderingKHR)(void*)vkGetDeviceProcAddr(m_Device->GetVulkanDevice(), "vkCmdEndRenderingKHR");
+	}
+	if (m_PhysicalDevice->GetExtensionSupport().SupportsExtendedDynamicState)
+	{
+		m_Functions.cmdSetCullModeEXT = (PFN_vkCmdSetCullModeEXT)(void*)vkGetDeviceProcAddr(m_Device->GetVulkanDevice(), "vkCmdSetCullModeEXT");
+		m_Functions.cmdSetFrontFaceEXT = (PFN_vkCmdSetFrontFaceEXT)(void*)vkGetDeviceProcAddr(m_Device->GetVulkanDevice(), "vkCmdSetFrontFaceEXT");
+		m_Functions.cmdSetPrimitiveTopologyEXT = (PFN_vkCmdSetPrimitiveTopologyEXT)(void*)vkGetDeviceProcAddr(m_Device->GetVulkanDevice(), "vkCmdSetPrimitiveTopologyEXT");
+		m_Functions.cmdSetDepthTestEnableEXT = (PFN_vkCmdSetDepthTestEnableEXT)(void*)vkGetDeviceProcAddr(m_Device->GetVulkanDevice(), "vkCmdSetDepthTestEnableEXT");
+		m_Functions.cmdSetDepthWriteEnableEXT = (PFN_vkCmdSetDepthWriteEnableEXT)(void*)vkGetDeviceProcAddr(m_Device->GetVulkanDevice(), "vkCmdSetDepthWriteEnableEXT");
+		m_Functions.cmdSetDepthCompareOpEXT = (PFN_vkCmdSetDepthCompareOpEXT)(void*)vkGetDeviceProcAddr(m_Device->GetVulkanDevice(), "vkCmdSetDepthCompareOpEXT");
+	}
+	if (m_PhysicalDevice->GetExtensionSupport().SupportsExtendedDynamicState2)
+	{
+		m_Functions.cmdSetPrimitiveRestartEnableEXT = (PFN_vkCmdSetPrimitiveRestartEnableEXT)(void*)vkGetDeviceProcAddr(m_Device->GetVulkanDevice(), "vkCmdSetPrimitiveRestartEnableEXT");
+		m_Functions.cmdSetRasterizerDiscardEnableEXT = (PFN_vkCmdSetRasterizerDiscardEnableEXT)(void*)vkGetDeviceProcAddr(m_Device->GetVulkanDevice(), "vkCmdSetRasterizerDiscardEnableEXT");
+	}
+#ifdef VK_EXT_extended_dynamic_state3
+	if (m_PhysicalDevice->GetExtensionSupport().SupportsExtendedDynamicState3)
+	{
+		m_Functions.cmdSetColorBlendEnableEXT = (PFN_vkCmdSetColorBlendEnableEXT)(void*)vkGetDeviceProcAddr(m_Device->GetVulkanDevice(), "vkCmdSetColorBlendEnableEXT");
+		m_Functions.cmdSetColorBlendEquationEXT = (PFN_vkCmdSetColorBlendEquationEXT)(void*)vkGetDeviceProcAddr(m_Device->GetVulkanDevice(), "vkCmdSetColorBlendEquationEXT");
+	}
+#endif
 }
@@ -9,6 +9,21 @@
 struct VulkanFunctions
 {
 	PFN_vkSetDebugUtilsObjectNameEXT setDebugUtilsObjectNameEXT;
+	PFN_vkCmdPushDescriptorSetWithTemplateKHR cmdPushDescriptorSetWithTemplateKHR = nullptr;
+	PFN_vkCmdBeginRenderingKHR cmdBeginRenderingKHR = nullptr;
+	PFN_vkCmdEndRenderingKHR cmdEndRenderingKHR = nullptr;
+	PFN_vkCmdSetCullModeEXT cmdSetCullModeEXT = nullptr;
+	PFN_vkCmdSetFrontFaceEXT cmdSetFrontFaceEXT = nullptr;
+	PFN_vkCmdSetPrimitiveTopologyEXT cmdSetPrimitiveTopologyEXT = nullptr;
+	PFN_vkCmdSetDepthTestEnableEXT cmdSetDepthTestEnableEXT = nullptr;
+	PFN_vkCmdSetDepthWriteEnableEXT cmdSetDepthWriteEnableEXT = nullptr;
+	PFN_vkCmdSetDepthCompareOpEXT cmdSetDepthCompareOpEXT = nullptr;
+	PFN_vkCmdSetPrimitiveRestartEnableEXT cmdSetPrimitiveRestartEnableEXT = nullptr;
+	PFN_vkCmdSetRasterizerDiscardEnableEXT cmdSetRasterizerDiscardEnableEXT = nullptr;
+#ifdef VK_EXT_extended_dynamic_state3
+	PFN_vkCmdSetColorBlendEnableEXT cmdSetColorBlendEnableEXT = nullptr;
+	PFN_vkCmdSetColorBlendEquationEXT cmdSetColorBlendEquationEXT = nullptr;
+#endif
 };
 
 class VulkanContext
@@ -3,184 +3,285 @@
 #include "VulkanPipeline.h"
 
 #include <iostream>
-#include <string>
+#include <deque>
+#include <algorithm>
 
-static constexpr uint32_t s_MaxSets = 40960u;
-static constexpr uint32_t s_NumDescriptors = 81920u;
+// Pools start small and double in size when they run out, up to `s_MaxPoolSets`
+static constexpr uint32_t s_InitialPoolSets = 64u;
+static constexpr uint32_t s_MaxPoolSets = 4096u;
+static constexpr uint32_t s_DescriptorsPerSet = 4u; // Of each type
 
-static VkDevice s_Device = VK_NULL_HANDLE;
-static VkDescriptorPool s_DescriptorPool = VK_NULL_HANDLE;
+struct DescriptorPool
+{
+    VkDescriptorPool Pool = VK_NULL_HANDLE;
+    uint32_t MaxSets = 0;
+    uint32_t AllocatedSets = 0;
+};
 
-//-------------------
-// DESCRIPTOR MANAGER
-//-------------------
-void VulkanDescriptorManager::Init()
+struct RetiredDescriptorSet
+{
+    VkDescriptorPool Pool = VK_NULL_HANDLE;
+    VkDescriptorSet Set = VK_NULL_HANDLE;
+};
+
+struct FrameDescriptorPools
+{
+    std::vector<DescriptorPool> Pools; // Linear. Never freed individually, reset all at once
+    std::deque<VulkanDescriptorSet> Sets; // Deque keeps returned pointers stable
+    std::vector<RetiredDescriptorSet> RetiredSets; // Persistent sets released during this frame. Freed once the frame's fence is signaled
+    size_t CurrentPool = 0;
+};
+
+struct VulkanDescriptorManagerData
+{
+    VkDevice Device = VK_NULL_HANDLE;
+    std::vector<DescriptorPool> PersistentPools;
+    std::vector<FrameDescriptorPools> FramePools;
+    uint32_t CurrentFrame = 0;
+};
+
+static VulkanDescriptorManagerData* s_Data = nullptr;
+
+// @requiredBindings. Bindings of the set layout that the pool is created for. Pool fits at least one set of it, even if it needs more descriptors than the default
+static DescriptorPool CreatePool(uint32_t maxSets, bool bFreeable, const std::vector<VkDescriptorSetLayoutBinding>& requiredBindings = {})
 {
-    constexpr VkDescriptorPoolSize poolSizes[] =
+    const uint32_t numDescriptors = maxSets * s_DescriptorsPerSet;
+    std::vector<VkDescriptorPoolSize> poolSizes =
     {
-        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, s_NumDescriptors },
-        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, s_NumDescriptors },
-        { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, s_NumDescriptors },
-        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, s_NumDescriptors },
-        { VK_DESCRIPTOR_TYPE_SAMPLER, s_NumDescriptors },
-        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, s_NumDescriptors }
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, numDescriptors },
+        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, numDescriptors },
+        { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, numDescriptors },
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, numDescriptors },
+        { VK_DESCRIPTOR_TYPE_SAMPLER, numDescriptors },
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, numDescriptors }
     };
 
-    assert(!s_Device);
-    s_Device = VulkanContext::GetDevice()->GetVulkanDevice();
+    // Total count per type, since a layout can have several bindings of the same type
+    std::vector<VkDescriptorPoolSize> required;
+    for (auto& binding : requiredBindings)
+    {
+        auto it = std::find_if(required.begin(), required.end(), [type = binding.descriptorType](const VkDescriptorPoolSize& size) { return size.type == type; });
+        if (it == required.end())
+            required.push_back({ binding.descriptorType, binding.descriptorCount });
+        else
+            it->descriptorCount += binding.descriptorCount;
+    }
+    for (auto& requiredSize : required)
+    {
+        auto it = std::find_if(poolSizes.begin(), poolSizes.end(), [type = requiredSize.type](const VkDescriptorPoolSize& size) { return size.type == type; });
+        if (it == poolSizes.end())
+            poolSizes.push_back(requiredSize);
+        else
+            it->descriptorCount = std::max(it->descriptorCount, requiredSize.descriptorCount);
+    }
 
     VkDescriptorPoolCreateInfo info{};
     info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    info.poolSizeCount = sizeof(poolSizes) / sizeof(VkDescriptorPoolSize);
-    info.pPoolSizes = poolSizes;
-    info.maxSets = s_MaxSets;
-    info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
-    VK_CHECK(vkCreateDescriptorPool(s_Device, &info, nullptr, &s_DescriptorPool));
+    info.poolSizeCount = uint32_t(poolSizes.size());
+    info.pPoolSizes = poolSizes.data();
+    info.maxSets = maxSets;
+    info.flags = bFreeable ? VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT : 0;
+
+    DescriptorPool pool;
+    pool.MaxSets = maxSets;
+    VK_CHECK(vkCreateDescriptorPool(s_Data->Device, &info, nullptr, &pool.Pool));
+    return pool;
+}
+
+static uint32_t GetNextPoolSize(const std::vector<DescriptorPool>& pools)
+{
+    return pools.empty() ? s_InitialPoolSets : std::min(pools.back().MaxSets * 2u, s_MaxPoolSets);
+}
+
+static VkResult TryAllocate(DescriptorPool& pool, VkDescriptorSetLayout layout, VkDescriptorSet* outSet)
+{
+    VkDescriptorSetAllocateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    info.descriptorPool = pool.Pool;
+    info.descriptorSetCount = 1;
+    info.pSetLayouts = &layout;
+
+    VkResult result = vkAllocateDescriptorSets(s_Data->Device, &info, outSet);
+    if (result == VK_SUCCESS)
+        ++pool.AllocatedSets;
+    else
+        assert(result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL);
+
+    return result;
+}
+
+static void FreeRetiredDescriptorSet(const RetiredDescriptorSet& retired)
+{
+    auto& pools = s_Data->PersistentPools;
+    auto it = std::find_if(pools.begin(), pools.end(), [vkPool = retired.Pool](const DescriptorPool& pool) { return pool.Pool == vkPool; });
+    assert(it != pools.end());
+
+    vkFreeDescriptorSets(s_Data->Device, retired.Pool, 1, &retired.Set);
+    --it->AllocatedSets;
+
+    // Empty pools are released, except the last one
+    if (it->AllocatedSets == 0 && pools.size() > 1)
+    {
+        vkDestroyDescriptorPool(s_Data->Device, retired.Pool, nullptr);
+        pools.erase(it);
+    }
+}
+
+static void FreeRetiredDescriptorSets(FrameDescriptorPools& frame)
+{
+    for (auto& retired : frame.RetiredSets)
+        FreeRetiredDescriptorSet(retired);
+    frame.RetiredSets.clear();
+}
+
+//-------------------
+// DESCRIPTOR MANAGER
+//-------------------
+void VulkanDescriptorManager::Init(uint32_t framesInFlight)
+{
+    assert(!s_Data);
+    s_Data = new VulkanDescriptorManagerData();
+    s_Data->Device = VulkanContext::GetDevice()->GetVulkanDevice();
+    s_Data->FramePools.resize(framesInFlight);
+
+    s_Data->PersistentPools.push_back(CreatePool(s_InitialPoolSets, true));
+    for (auto& frame : s_Data->FramePools)
+        frame.Pools.push_back(CreatePool(s_InitialPoolSets, false));
 }
 
 void VulkanDescriptorManager::Shutdown()
 {
-    if (s_DescriptorPool)
-        vkDestroyDescriptorPool(s_Device, s_DescriptorPool, nullptr);
+    for (auto& frame : s_Data->FramePools)
+    {
+        FreeRetiredDescriptorSets(frame);
+        frame.Sets.clear();
+        for (auto& pool : frame.Pools)
+            vkDestroyDescriptorPool(s_Data->Device, pool.Pool, nullptr);
+    }
 
-    s_DescriptorPool = VK_NULL_HANDLE;
-    s_Device = VK_NULL_HANDLE;
+    for (auto& pool : s_Data->PersistentPools)
+    {
+        if (pool.AllocatedSets)
+            std::cerr << "[Vulkan descriptor manager] " << pool.AllocatedSets << " descriptor sets were not freed\n";
+        vkDestroyDescriptorPool(s_Data->Device, pool.Pool, nullptr);
+    }
+
+    delete s_Data;
+    s_Data = nullptr;
 }
 
-VulkanDescriptorSet VulkanDescriptorManager::AllocateDescriptorSet(const VulkanPipeline* pipeline, uint32_t set)
+void VulkanDescriptorManager::BeginFrame(uint32_t frameIndex)
 {
-    return VulkanDescriptorSet(pipeline, s_DescriptorPool, set);
+    assert(frameIndex < s_Data->FramePools.size());
+    s_Data->CurrentFrame = frameIndex;
+
+    auto& frame = s_Data->FramePools[frameIndex];
+    frame.Sets.clear();
+    FreeRetiredDescriptorSets(frame);
+
+    // Pools that weren't needed during the last use of the frame are released
+    const size_t usedPools = frame.CurrentPool + 1;
+    for (size_t i = usedPools; i < frame.Pools.size(); ++i)
+        vkDestroyDescriptorPool(s_Data->Device, frame.Pools[i].Pool, nullptr);
+    frame.Pools.resize(std::min(usedPools, frame.Pools.size()));
+
+    for (auto& pool : frame.Pools)
+    {
+        if (pool.AllocatedSets)
+            VK_CHECK(vkResetDescriptorPool(s_Data->Device, pool.Pool, 0));
+        pool.AllocatedSets = 0;
+    }
+    frame.CurrentPool = 0;
 }
 
-void VulkanDescriptorManager::WriteDescriptors(const VulkanPipeline* pipeline, const std::vector<DescriptorWriteData>& writeDatas)
+VulkanDescriptorSet VulkanDescriptorManager::AllocateDescriptorSet(const VulkanPipeline* pipeline, uint32_t set)
 {
-    std::vector<VkDescriptorBufferInfo> buffers;
-    std::vector<VkDescriptorImageInfo> images;
-    std::vector<VkWriteDescriptorSet> vkWriteDescriptorSets;
-    size_t buffersInfoCount = 0;
-    size_t imagesInfoCount = 0;
+    VkDescriptorSetLayout layout = pipeline->GetDescriptorSetLayout(set);
+    auto& pools = s_Data->PersistentPools;
 
-    for (auto& writeData : writeDatas)
+    // Newer pools are bigger and more likely to have free space
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    for (auto it = pools.rbegin(); it != pools.rend(); ++it)
     {
-        uint32_t set = writeData.DescriptorSet->GetSetIndex();
-        const auto& setBindings = pipeline->GetSetBindings(set);
-        const auto& setBindingsData = writeData.DescriptorSetData->GetBindings();
+        if (it->AllocatedSets < it->MaxSets && TryAllocate(*it, layout, &descriptorSet) == VK_SUCCESS)
+            return VulkanDescriptorSet(descriptorSet, it->Pool, set, false);
+    }
 
-        for (auto& binding : setBindings)
+    // New pool always fits the layout
+    DescriptorPool& pool = pools.emplace_back(CreatePool(GetNextPoolSize(pools), true, pipeline->GetSetBindings(set)));
+    VK_CHECK(TryAllocate(pool, layout, &descriptorSet));
+    return VulkanDescriptorSet(descriptorSet, pool.Pool, set, false);
+}
+
+const VulkanDescriptorSet* VulkanDescriptorManager::AllocateTransientDescriptorSet(const VulkanPipeline* pipeline, uint32_t set)
+{
+    VkDescriptorSetLayout layout = pipeline->GetDescriptorSetLayout(set);
+    auto& frame = s_Data->FramePools[s_Data->CurrentFrame];
+
+    // Each existing pool is tried once. If none of them has space, a new pool is created that always fits the layout
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    while (TryAllocate(frame.Pools[frame.CurrentPool], layout, &descriptorSet) != VK_SUCCESS)
+    {
+        ++frame.CurrentPool;
+        if (frame.CurrentPool == frame.Pools.size())
         {
-            const auto& bindingData = setBindingsData.at(binding.binding);
-            
-            if (IsBufferType(binding.descriptorType))
-                buffersInfoCount += binding.descriptorCount;
-            else if (IsImageType(binding.descriptorType))
-                imagesInfoCount += binding.descriptorCount;
-            else if (IsSamplerType(binding.descriptorType))
-                imagesInfoCount += bindingData.ImageBindings[0].Sampler ? 1 : 0;
+            frame.Pools.push_back(CreatePool(GetNextPoolSize(frame.Pools), false, pipeline->GetSetBindings(set)));
+            VK_CHECK(TryAllocate(frame.Pools.back(), layout, &descriptorSet));
+            break;
         }
     }
 
-    buffers.reserve(buffersInfoCount);
-    images.reserve(imagesInfoCount);
+    return &frame.Sets.emplace_back(VulkanDescriptorSet(descriptorSet, frame.Pools[frame.CurrentPool].Pool, set, true));
+}
 
+void VulkanDescriptorManager::FreeDescriptorSet(VkDescriptorPool vkPool, VkDescriptorSet set)
+{
+    // Frames in flight might still be reading the set. It's freed when the current frame index begins again,
+    // by then the fences of all frames that could have used the set are signaled
+    s_Data->FramePools[s_Data->CurrentFrame].RetiredSets.push_back({ vkPool, set });
+}
+
+void VulkanDescriptorManager::WriteDescriptors(VulkanPipeline* pipeline, const std::vector<DescriptorWriteData>& writeDatas)
+{
     for (auto& writeData : writeDatas)
     {
-        uint32_t set = writeData.DescriptorSet->GetSetIndex();
-        const auto& setBindings = pipeline->GetSetBindings(set);
-        const auto& setBindingsData = writeData.DescriptorSetData->GetBindings();
+        const uint32_t set = writeData.DescriptorSet->GetSetIndex();
+        assert(set < pipeline->m_Layout->UpdateTemplates.size());
+        auto& updateTemplate = pipeline->m_Layout->UpdateTemplates[set];
+        uint8_t* payload = pipeline->m_TemplatePayloads[set].data();
+        assert(updateTemplate.Template);
 
-        for (auto& binding : setBindings)
-        {
-            const auto& bindingData = setBindingsData.at(binding.binding);
-
-            if (IsBufferType(binding.descriptorType))
-            {
-                if (bindingData.BufferBindings.empty())
-                    continue;
-
-                const size_t startIdx = buffers.size();
-                for (auto& buffer : bindingData.BufferBindings)
-                {
-                    VkBuffer vkBuffer = buffer.Buffer;
-                    if (vkBuffer == VK_NULL_HANDLE)
-                        std::cerr << "Error! Invalid buffer binding for binding " << std::to_string(binding.binding) << ", set " << std::to_string(set) << '\n';
-
-                    buffers.push_back({ vkBuffer, buffer.Offset, buffer.Range });
-                }
-                
-                uint32_t descriptorCount = std::min(binding.descriptorCount, (uint32_t)bindingData.BufferBindings.size());
-                VkWriteDescriptorSet& writeDescriptorSet = vkWriteDescriptorSets.emplace_back();
-                writeDescriptorSet = {};
-                writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-                writeDescriptorSet.descriptorCount = descriptorCount;
-                writeDescriptorSet.descriptorType = binding.descriptorType;
-                writeDescriptorSet.dstBinding = binding.binding;
-                writeDescriptorSet.dstSet = writeData.DescriptorSet->GetVulkanDescriptorSet();
-                writeDescriptorSet.pBufferInfo = &buffers[startIdx];
-            }
-            else if (IsImageType(binding.descriptorType) || IsSamplerType(binding.descriptorType))
-            {
-                if (bindingData.ImageBindings.empty())
-                    continue;
-
-                const size_t startIdx = images.size();
-                if (IsSamplerType(binding.descriptorType))
-                {
-                    images.push_back({ bindingData.ImageBindings[0].Sampler, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_UNDEFINED });
-                }
-                else
-                {
-                    for (auto& image : bindingData.ImageBindings)
-                    {
-                        VkSampler sampler = image.Sampler;
-                        VkImageView imageView = image.View;
-                        VkImageLayout imageLayout;
-                        if ((binding.descriptorType == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE) || (binding.descriptorType == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER))
-                            imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-                        else
-                            imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-
-                        images.push_back({ sampler, imageView, imageLayout });
-                    }
-                }
-
-                uint32_t descriptorCount = std::min(binding.descriptorCount, (uint32_t)bindingData.ImageBindings.size());
-                VkWriteDescriptorSet& writeDescriptorSet = vkWriteDescriptorSets.emplace_back();
-                writeDescriptorSet = {};
-                writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-                writeDescriptorSet.descriptorCount = descriptorCount;
-                writeDescriptorSet.descriptorType = binding.descriptorType;
-                writeDescriptorSet.dstBinding = binding.binding;
-                writeDescriptorSet.dstSet = writeData.DescriptorSet->GetVulkanDescriptorSet();
-                writeDescriptorSet.pImageInfo = &images[startIdx];
-            }
-            else
-            {
-                std::cerr << "Unknown binding\n";
-                assert(false);
-            }
-        }
+        writeData.DescriptorSetData->WriteTemplatePayload(updateTemplate.Entries, payload);
+        vkUpdateDescriptorSetWithTemplate(s_Data->Device, writeData.DescriptorSet->GetVulkanDescriptorSet(), updateTemplate.Template, payload);
 
         writeData.DescriptorSetData->OnFlushed();
     }
+}
+
+void VulkanDescriptorManager::PushDescriptors(VkCommandBuffer cmd, VulkanPipeline* pipeline, DescriptorSetData& data)
+{
+    const uint32_t set = pipeline->m_Layout->PushDescriptorSet;
+    assert(set < pipeline->m_Layout->UpdateTemplates.size());
+    auto& updateTemplate = pipeline->m_Layout->UpdateTemplates[set];
+    uint8_t* payload = pipeline->m_TemplatePayloads[set].data();
+
+    if (data.IsDirty())
+    {
+        // Push payload belongs to this pipeline and its data only, so only changed bindings are rewritten
+        data.WriteTemplatePayload(updateTemplate.Entries, payload, true);
+        data.OnFlushed();
+    }
 
-    vkUpdateDescriptorSets(s_Device, (uint32_t)vkWriteDescriptorSets.size(), vkWriteDescriptorSets.data(), 0, nullptr);
+    VulkanContext::GetFunctions().cmdPushDescriptorSetWithTemplateKHR(cmd, updateTemplate.Template, pipeline->GetVulkanPipelineLayout(), set, payload);
 }
 
 //-------------------
 //  DESCRIPTOR SET
 //-------------------
-VulkanDescriptorSet::VulkanDescriptorSet(const VulkanPipeline* pipeline, VkDescriptorPool pool, uint32_t set)
-    : m_Device(VulkanContext::GetDevice()->GetVulkanDevice())
+VulkanDescriptorSet::VulkanDescriptorSet(VkDescriptorSet descriptorSet, VkDescriptorPool pool, uint32_t set, bool bTransient)
+    : m_Device(s_Data->Device)
+    , m_DescriptorSet(descriptorSet)
     , m_DescriptorPool(pool)
     , m_SetIndex(set)
-{
-    VkDescriptorSetLayout setLayout = pipeline->GetDescriptorSetLayout(set);
-
-    VkDescriptorSetAllocateInfo info{};
-    info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    info.descriptorPool = pool;
-    info.descriptorSetCount = 1;
-    info.pSetLayouts = &setLayout;
-
-    VK_CHECK(vkAllocateDescriptorSets(m_Device, &info, &m_DescriptorSet));
-}
+    , m_bTransient(bTransient)
+{}
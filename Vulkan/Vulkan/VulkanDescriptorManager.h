@@ -20,10 +20,29 @@ private:
 	VulkanDescriptorManager() = default;
 
 public:
-	static void Init();
+	// @framesInFlight. Number of per-frame pools
+	static void Init(uint32_t framesInFlight);
 	static void Shutdown();
+
+	// Should be called once the fence of the frame `frameIndex` is signaled. Resets the pools of that frame and frees persistent sets released during it
+	static void BeginFrame(uint32_t frameIndex);
+
+	// Allocated from the chain of persistent pools. Retired when the returned set is destroyed and freed once the frames in flight are done with it
 	static VulkanDescriptorSet AllocateDescriptorSet(const VulkanPipeline* pipeline, uint32_t set);
-	static void WriteDescriptors(const VulkanPipeline* pipeline, const std::vector<DescriptorWriteData>& writeDatas);
+
+	// Allocated from the pools of the current frame. Set is valid until the same frame index begins again
+	static const VulkanDescriptorSet* AllocateTransientDescriptorSet(const VulkanPipeline* pipeline, uint32_t set);
+
+	// Writes each set with the update template of its layout. Payload is filled in place, no allocations are made
+	static void WriteDescriptors(VulkanPipeline* pipeline, const std::vector<DescriptorWriteData>& writeDatas);
+
+	// Records `data` into `cmd` as the push descriptor set of the pipeline. Payload is refilled only if `data` is dirty
+	static void PushDescriptors(VkCommandBuffer cmd, VulkanPipeline* pipeline, DescriptorSetData& data);
+
+private:
+	static void FreeDescriptorSet(VkDescriptorPool pool, VkDescriptorSet set);
+
+	friend class VulkanDescriptorSet;
 };
 
 class VulkanDescriptorSet
@@ -35,6 +54,8 @@ public:
 		m_Device = other.m_Device;
 		m_DescriptorSet = other.m_DescriptorSet;
 		m_DescriptorPool = other.m_DescriptorPool;
+		m_SetIndex = other.m_SetIndex;
+		m_bTransient = other.m_bTransient;
 
 		other.m_Device = VK_NULL_HANDLE;
 		other.m_DescriptorSet = VK_NULL_HANDLE;
@@ -42,12 +63,13 @@ public:
 	}
 	VulkanDescriptorSet& operator=(VulkanDescriptorSet&& other) noexcept
 	{
-		if (m_DescriptorSet)
-			vkFreeDescriptorSets(m_Device, m_DescriptorPool, 1, &m_DescriptorSet);
+		Release();
 
 		m_Device = other.m_Device;
 		m_DescriptorSet = other.m_DescriptorSet;
 		m_DescriptorPool = other.m_DescriptorPool;
+		m_SetIndex = other.m_SetIndex;
+		m_bTransient = other.m_bTransient;
 
 		other.m_Device = VK_NULL_HANDLE;
 		other.m_DescriptorSet = VK_NULL_HANDLE;
@@ -58,20 +80,30 @@ public:
 
 	virtual ~VulkanDescriptorSet()
 	{
-		if (m_DescriptorSet)
-			vkFreeDescriptorSets(m_Device, m_DescriptorPool, 1, &m_DescriptorSet);
+		Release();
 	}
 
 	uint32_t GetSetIndex() const { return m_SetIndex; }
 	const VkDescriptorSet& GetVulkanDescriptorSet() const { return m_DescriptorSet; }
 
+	bool IsTransient() const { return m_bTransient; }
+
 private:
-	VulkanDescriptorSet(const VulkanPipeline* pipeline, VkDescriptorPool pool, uint32_t set);
+	VulkanDescriptorSet(VkDescriptorSet descriptorSet, VkDescriptorPool pool, uint32_t set, bool bTransient);
+
+	// Transient sets are released all at once by resetting their pool
+	void Release()
+	{
+		if (m_DescriptorSet && !m_bTransient)
+			VulkanDescriptorManager::FreeDescriptorSet(m_DescriptorPool, m_DescriptorSet);
+		m_DescriptorSet = VK_NULL_HANDLE;
+	}
 
 private:
 	VkDevice m_Device = VK_NULL_HANDLE;
 	VkDescriptorSet m_DescriptorSet = VK_NULL_HANDLE;
 	VkDescriptorPool m_DescriptorPool = VK_NULL_HANDLE;
 	uint32_t m_SetIndex = 0;
+	bool m_bTransient = false;
 	friend class VulkanDescriptorManager;
 };
@@ -159,6 +159,144 @@ VulkanPhysicalDevice::VulkanPhysicalDevice(VkSurfaceKHR surface, bool bRequirePr
 		m_ExtensionSupport.SupportsConservativeRasterization = true;
 		m_DeviceExtensions.push_back(VK_EXT_CONSERVATIVE_RASTERIZATION_EXTENSION_NAME);
 	}
+
+	// Descriptor indexing and host query reset are core in Vulkan 1.2
+	vkGetPhysicalDeviceProperties(m_PhysicalDevice, &m_Properties); // Might contain properties of another device after the selection
+	if (m_Properties.apiVersion >= VK_API_VERSION_1_2)
+	{
+		VkPhysicalDeviceHostQueryResetFeatures hostQueryResetFeatures{};
+		hostQueryResetFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_QUERY_RESET_FEATURES;
+		VkPhysicalDeviceDescriptorIndexingFeatures indexingFeatures{};
+		indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+		indexingFeatures.pNext = &hostQueryResetFeatures;
+		VkPhysicalDeviceFeatures2 features2{};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = &indexingFeatures;
+		vkGetPhysicalDeviceFeatures2(m_PhysicalDevice, &features2);
+
+		m_ExtensionSupport.SupportsDescriptorIndexing = indexingFeatures.runtimeDescriptorArray &&
+			indexingFeatures.descriptorBindingPartiallyBound &&
+			indexingFeatures.descriptorBindingUpdateUnusedWhilePending &&
+			indexingFeatures.descriptorBindingSampledImageUpdateAfterBind &&
+			indexingFeatures.descriptorBindingStorageBufferUpdateAfterBind &&
+			indexingFeatures.shaderSampledImageArrayNonUniformIndexing &&
+			indexingFeatures.shaderStorageBufferArrayNonUniformIndexing;
+		m_ExtensionSupport.SupportsHostQueryReset = hostQueryResetFeatures.hostQueryReset;
+
+		m_DescriptorIndexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+		VkPhysicalDeviceProperties2 properties2{};
+		properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+		properties2.pNext = &m_DescriptorIndexingProperties;
+		vkGetPhysicalDeviceProperties2(m_PhysicalDevice, &properties2);
+		m_DescriptorIndexingProperties.pNext = nullptr;
+	}
+
+	if (AreExtensionsSupported(m_PhysicalDevice, std::vector<const char*>{ VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME }))
+	{
+		m_ExtensionSupport.SupportsPushDescriptors = true;
+		m_DeviceExtensions.push_back(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
+
+		m_PushDescriptorProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PUSH_DESCRIPTOR_PROPERTIES_KHR;
+		VkPhysicalDeviceProperties2 properties2{};
+		properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+		properties2.pNext = &m_PushDescriptorProperties;
+		vkGetPhysicalDeviceProperties2(m_PhysicalDevice, &properties2);
+		m_PushDescriptorProperties.pNext = nullptr;
+	}
+
+	// Dependencies of dynamic rendering (create_renderpass2 and depth_stencil_resolve) are core in Vulkan 1.2
+	if (m_Properties.apiVersion >= VK_API_VERSION_1_2 && AreExtensionsSupported(m_PhysicalDevice, std::vector<const char*>{ VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME }))
+	{
+		VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures{};
+		dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+		VkPhysicalDeviceFeatures2 features2{};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = &dynamicRenderingFeatures;
+		vkGetPhysicalDeviceFeatures2(m_PhysicalDevice, &features2);
+
+		if (dynamicRenderingFeatures.dynamicRendering)
+		{
+			m_ExtensionSupport.SupportsDynamicRendering = true;
+			m_DeviceExtensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+		}
+	}
+
+	if (m_Properties.apiVersion >= VK_API_VERSION_1_2 && AreExtensionsSupported(m_PhysicalDevice, std::vector<const char*>{ VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME }))
+	{
+		VkPhysicalDeviceExtendedDynamicStateFeaturesEXT dynamicStateFeatures{};
+		dynamicStateFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT;
+		VkPhysicalDeviceFeatures2 features2{};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = &dynamicStateFeatures;
+		vkGetPhysicalDeviceFeatures2(m_PhysicalDevice, &features2);
+
+		if (dynamicStateFeatures.extendedDynamicState)
+		{
+			m_ExtensionSupport.SupportsExtendedDynamicState = true;
+			m_DeviceExtensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME);
+		}
+	}
+
+	if (m_ExtensionSupport.SupportsExtendedDynamicState && AreExtensionsSupported(m_PhysicalDevice, std::vector<const char*>{ VK_EXT_EXTENDED_DYNAMIC_STATE_2_EXTENSION_NAME }))
+	{
+		VkPhysicalDeviceExtendedDynamicState2FeaturesEXT dynamicState2Features{};
+		dynamicState2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_2_FEATURES_EXT;
+		VkPhysicalDeviceFeatures2 features2{};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = &dynamicState2Features;
+		vkGetPhysicalDeviceFeatures2(m_PhysicalDevice, &features2);
+
+		if (dynamicState2Features.extendedDynamicState2)
+		{
+			m_ExtensionSupport.SupportsExtendedDynamicState2 = true;
+			m_DeviceExtensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_2_EXTENSION_NAME);
+		}
+	}
+
+#ifdef VK_EXT_extended_dynamic_state3
+	if (m_ExtensionSupport.SupportsExtendedDynamicState && AreExtensionsSupported(m_PhysicalDevice, std::vector<const char*>{ VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME }))
+	{
+		VkPhysicalDeviceExtendedDynamicState3FeaturesEXT dynamicState3Features{};
+		dynamicState3Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT;
+		VkPhysicalDeviceFeatures2 features2{};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = &dynamicState3Features;
+		vkGetPhysicalDeviceFeatures2(m_PhysicalDevice, &features2);
+
+		if (dynamicState3Features.extendedDynamicState3ColorBlendEnable && dynamicState3Features.extendedDynamicState3ColorBlendEquation)
+		{
+			m_ExtensionSupport.SupportsExtendedDynamicState3 = true;
+			m_DeviceExtensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME);
+
+			VkPhysicalDeviceExtendedDynamicState3PropertiesEXT dynamicState3Properties{};
+			dynamicState3Properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_PROPERTIES_EXT;
+			VkPhysicalDeviceProperties2 properties2{};
+			properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+			properties2.pNext = &dynamicState3Properties;
+			vkGetPhysicalDeviceProperties2(m_PhysicalDevice, &properties2);
+			m_ExtensionSupport.SupportsUnrestrictedDynamicTopology = dynamicState3Properties.dynamicPrimitiveTopologyUnrestricted;
+		}
+	}
+#endif
+
+#ifdef VK_EXT_graphics_pipeline_library
+	if (m_Properties.apiVersion >= VK_API_VERSION_1_2 && AreExtensionsSupported(m_PhysicalDevice, std::vector<const char*>{ VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME, VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME }))
+	{
+		VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT pipelineLibraryFeatures{};
+		pipelineLibraryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+		VkPhysicalDeviceFeatures2 features2{};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = &pipelineLibraryFeatures;
+		vkGetPhysicalDeviceFeatures2(m_PhysicalDevice, &features2);
+
+		if (pipelineLibraryFeatures.graphicsPipelineLibrary)
+		{
+			m_ExtensionSupport.SupportsGraphicsPipelineLibrary = true;
+			m_DeviceExtensions.push_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+			m_DeviceExtensions.push_back(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+		}
+	}
+#endif
 }
 
 SwapchainSupportDetails VulkanPhysicalDevice::QuerySwapchainSupportDetails(VkSurfaceKHR surface) const
@@ -213,8 +351,86 @@ VulkanDevice::VulkanDevice(const std::unique_ptr<VulkanPhysicalDevice>& physical
 		queueCreateInfos.push_back(additionalQueueCI);
 	}
 
+	VkPhysicalDeviceVulkan12Features vulkan12Features{};
+	vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	if (physicalDevice->GetExtensionSupport().SupportsDescriptorIndexing)
+	{
+		vulkan12Features.runtimeDescriptorArray = VK_TRUE;
+		vulkan12Features.descriptorBindingPartiallyBound = VK_TRUE;
+		vulkan12Features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+		vulkan12Features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+		vulkan12Features.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+		vulkan12Features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+		vulkan12Features.shaderStorageBufferArrayNonUniformIndexing = VK_TRUE;
+	}
+	if (physicalDevice->GetExtensionSupport().SupportsHostQueryReset)
+		vulkan12Features.hostQueryReset = VK_TRUE;
+
+	VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures{};
+	dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+	dynamicRenderingFeatures.dynamicRendering = VK_TRUE;
+
+	VkPhysicalDeviceExtendedDynamicStateFeaturesEXT dynamicStateFeatures{};
+	dynamicStateFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT;
+	dynamicStateFeatures.extendedDynamicState = VK_TRUE;
+
+	VkPhysicalDeviceExtendedDynamicState2FeaturesEXT dynamicState2Features{};
+	dynamicState2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_2_FEATURES_EXT;
+	dynamicState2Features.extendedDynamicState2 = VK_TRUE;
+
+#ifdef VK_EXT_extended_dynamic_state3
+	VkPhysicalDeviceExtendedDynamicState3FeaturesEXT dynamicState3Features{};
+	dynamicState3Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT;
+	dynamicState3Features.extendedDynamicState3ColorBlendEnable = VK_TRUE;
+	dynamicState3Features.extendedDynamicState3ColorBlendEquation = VK_TRUE;
+#endif
+
+#ifdef VK_EXT_graphics_pipeline_library
+	VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT pipelineLibraryFeatures{};
+	pipelineLibraryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+	pipelineLibraryFeatures.graphicsPipelineLibrary = VK_TRUE;
+#endif
+
+	// Only supported features are chained
+	void* features = nullptr;
+	if (physicalDevice->GetExtensionSupport().SupportsDescriptorIndexing || physicalDevice->GetExtensionSupport().SupportsHostQueryReset)
+	{
+		vulkan12Features.pNext = features;
+		features = &vulkan12Features;
+	}
+	if (physicalDevice->GetExtensionSupport().SupportsDynamicRendering)
+	{
+		dynamicRenderingFeatures.pNext = features;
+		features = &dynamicRenderingFeatures;
+	}
+	if (physicalDevice->GetExtensionSupport().SupportsExtendedDynamicState)
+	{
+		dynamicStateFeatures.pNext = features;
+		features = &dynamicStateFeatures;
+	}
+	if (physicalDevice->GetExtensionSupport().SupportsExtendedDynamicState2)
+	{
+		dynamicState2Features.pNext = features;
+		features = &dynamicState2Features;
+	}
+#ifdef VK_EXT_extended_dynamic_state3
+	if (physicalDevice->GetExtensionSupport().SupportsExtendedDynamicState3)
+	{
+		dynamicState3Features.pNext = features;
+		features = &dynamicState3Features;
+	}
+#endif
+#ifdef VK_EXT_graphics_pipeline_library
+	if (physicalDevice->GetExtensionSupport().SupportsGraphicsPipelineLibrary)
+	{
+		pipelineLibraryFeatures.pNext = features;
+		features = &pipelineLibraryFeatures;
+	}
+#endif
+
 	VkDeviceCreateInfo deviceCI{};
 	deviceCI.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	deviceCI.pNext = features;
 	deviceCI.pEnabledFeatures = &enabledFeatures;
 	deviceCI.pQueueCreateInfos = queueCreateInfos.data();
 	deviceCI.queueCreateInfoCount = (uint32_t)queueCreateInfos.size();
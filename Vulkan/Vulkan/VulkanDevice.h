@@ -32,6 +32,15 @@ struct SwapchainSupportDetails
 struct ExtensionSupport
 {
 	bool SupportsConservativeRasterization = false;
+	bool SupportsDescriptorIndexing = false; // Non-uniform indexing, partially bound, update-after-bind sampled images and storage buffers
+	bool SupportsPushDescriptors = false;
+	bool SupportsDynamicRendering = false; // Rendering begins without render pass and framebuffer objects. Pipelines only depend on attachment formats
+	bool SupportsExtendedDynamicState = false; // Cull mode, front face, topology and depth state are set by command buffers
+	bool SupportsExtendedDynamicState2 = false; // Primitive restart and rasterizer discard are set by command buffers
+	bool SupportsExtendedDynamicState3 = false; // Color blend enable and equation are set by command buffers
+	bool SupportsUnrestrictedDynamicTopology = false; // Dynamic topology isn't limited to the topology class of the pipeline
+	bool SupportsGraphicsPipelineLibrary = false; // Parts of graphics pipelines are compiled separately and linked
+	bool SupportsHostQueryReset = false; // Queries can be reset by the host
 };
 
 enum class ImageFormat;
@@ -51,6 +60,8 @@ public:
 
 	const VkPhysicalDeviceProperties& GetProperties() const { return m_Properties; }
 	const VkPhysicalDeviceMemoryProperties& GetMemoryProperties() const { return m_MemoryProperties; }
+	const VkPhysicalDeviceDescriptorIndexingProperties& GetDescriptorIndexingProperties() const { return m_DescriptorIndexingProperties; }
+	const VkPhysicalDevicePushDescriptorPropertiesKHR& GetPushDescriptorProperties() const { return m_PushDescriptorProperties; }
 
 	static std::unique_ptr<VulkanPhysicalDevice> Select(VkSurfaceKHR surface, bool bRequirePresentSupport) { return std::make_unique<VulkanPhysicalDevice>(surface, bRequirePresentSupport); }
 
@@ -60,6 +71,8 @@ private:
 	QueueFamilyIndices m_FamilyIndices;
 	VkPhysicalDeviceProperties m_Properties;
 	VkPhysicalDeviceMemoryProperties m_MemoryProperties;
+	VkPhysicalDeviceDescriptorIndexingProperties m_DescriptorIndexingProperties{};
+	VkPhysicalDevicePushDescriptorPropertiesKHR m_PushDescriptorProperties{};
 	ExtensionSupport m_ExtensionSupport;
 	bool m_RequiresPresentQueue = false;
 };
@@ -28,9 +28,11 @@ public:
 	{
 		m_Device = other.m_Device;
 		m_Fence = other.m_Fence;
+		m_ResetCount = other.m_ResetCount;
 
 		other.m_Device = VK_NULL_HANDLE;
 		other.m_Fence = VK_NULL_HANDLE;
+		other.m_ResetCount = 0;
 	}
 
 	VulkanFence& operator=(VulkanFence&& other) noexcept
@@ -40,9 +42,11 @@ public:
 
 		m_Device = other.m_Device;
 		m_Fence = other.m_Fence;
+		m_ResetCount = other.m_ResetCount;
 
 		other.m_Device = VK_NULL_HANDLE;
 		other.m_Fence = VK_NULL_HANDLE;
+		other.m_ResetCount = 0;
 
 		return *this;
 	}
@@ -59,10 +63,15 @@ public:
 		VulkanCheckResult(result);
 		return false;
 	}
-	void Reset() { VK_CHECK(vkResetFences(m_Device, 1, &m_Fence)); }
+	void Reset() { VK_CHECK(vkResetFences(m_Device, 1, &m_Fence)); ++m_ResetCount; }
 	void Wait(uint64_t timeout = UINT64_MAX) { VK_CHECK(vkWaitForFences(m_Device, 1, &m_Fence, VK_FALSE, timeout)); }
 
+	// Identifies the submission that the fence is used for. Fences are only reset after their submission has completed,
+	// so if the count changed since a submission, that submission has completed too
+	uint64_t GetResetCount() const { return m_ResetCount; }
+
 private:
 	VkDevice m_Device;
 	VkFence m_Fence = VK_NULL_HANDLE;
+	uint64_t m_ResetCount = 0;
 };
@@ -0,0 +1,135 @@
+#include "VulkanGeometryArena.h"
+#include "VulkanCommandManager.h"
+
+#include <iostream>
+#include <iterator>
+
+RangeAllocator::RangeAllocator(uint32_t capacity)
+	: m_Capacity(capacity)
+{
+	if (capacity)
+		m_FreeRanges[0] = capacity;
+}
+
+uint32_t RangeAllocator::Allocate(uint32_t size)
+{
+	if (size == 0)
+		return 0;
+
+	for (auto it = m_FreeRanges.begin(); it != m_FreeRanges.end(); ++it)
+	{
+		if (it->second < size)
+			continue;
+
+		const uint32_t offset = it->first;
+		const uint32_t remaining = it->second - size;
+		m_FreeRanges.erase(it);
+		if (remaining)
+			m_FreeRanges[offset + size] = remaining;
+
+		m_Used += size;
+		return offset;
+	}
+
+	return InvalidOffset;
+}
+
+void RangeAllocator::Free(uint32_t offset, uint32_t size)
+{
+	if (size == 0 || offset == InvalidOffset)
+		return;
+
+	assert(offset + size <= m_Capacity);
+	assert(m_Used >= size);
+	m_Used -= size;
+
+	auto next = m_FreeRanges.lower_bound(offset);
+	assert(next == m_FreeRanges.end() || next->first >= offset + size); // Double free
+
+	// Merge with the following range
+	if (next != m_FreeRanges.end() && next->first == offset + size)
+	{
+		size += next->second;
+		next = m_FreeRanges.erase(next);
+	}
+
+	// Merge with the preceding range
+	if (next != m_FreeRanges.begin())
+	{
+		auto prev = std::prev(next);
+		assert(prev->first + prev->second <= offset); // Double free
+		if (prev->first + prev->second == offset)
+		{
+			prev->second += size;
+			return;
+		}
+	}
+
+	m_FreeRanges[offset] = size;
+}
+
+VulkanGeometryArena::VulkanGeometryArena(uint32_t vertexStride, uint32_t maxVertices, uint32_t maxIndices, const std::string& debugName)
+	: m_VertexBuffer({ size_t(vertexStride) * maxVertices, MemoryType::Gpu, BufferUsage::VertexBuffer | BufferUsage::TransferSrc | BufferUsage::TransferDst }, debugName + "_Vertices")
+	, m_IndexBuffer({ size_t(maxIndices) * sizeof(uint32_t), MemoryType::Gpu, BufferUsage::IndexBuffer | BufferUsage::TransferSrc | BufferUsage::TransferDst }, debugName + "_Indices")
+	, m_VertexAllocator(maxVertices)
+	, m_IndexAllocator(maxIndices)
+	, m_VertexStride(vertexStride)
+{}
+
+GeometryAllocation VulkanGeometryArena::Allocate(uint32_t vertexCount, uint32_t indexCount)
+{
+	GeometryAllocation allocation;
+	allocation.FirstVertex = m_VertexAllocator.Allocate(vertexCount);
+	allocation.FirstIndex = m_IndexAllocator.Allocate(indexCount);
+
+	if (!allocation.IsValid())
+	{
+		std::cerr << "[Vulkan geometry arena] Out of space. Requested " << vertexCount << " vertices and " << indexCount << " indices with "
+			<< m_VertexAllocator.GetCapacity() - m_VertexAllocator.GetUsed() << " vertices and " << m_IndexAllocator.GetCapacity() - m_IndexAllocator.GetUsed()
+			<< " indices free in total. Arena doesn't grow, so it should be created with a bigger capacity\n";
+		m_VertexAllocator.Free(allocation.FirstVertex, vertexCount);
+		m_IndexAllocator.Free(allocation.FirstIndex, indexCount);
+		return {};
+	}
+
+	allocation.VertexCount = vertexCount;
+	allocation.IndexCount = indexCount;
+	return allocation;
+}
+
+void VulkanGeometryArena::Free(const GeometryAllocation& allocation)
+{
+	if (!allocation.IsValid())
+		return;
+
+	m_VertexAllocator.Free(allocation.FirstVertex, allocation.VertexCount);
+	m_IndexAllocator.Free(allocation.FirstIndex, allocation.IndexCount);
+}
+
+void VulkanGeometryArena::Write(const GeometryAllocation& allocation, const void* vertices, const uint32_t* indices)
+{
+	assert(allocation.IsValid());
+
+	if (vertices && allocation.VertexCount)
+	{
+		const uint8_t* data = static_cast<const uint8_t*>(vertices);
+		const size_t size = size_t(allocation.VertexCount) * m_VertexStride;
+		m_PendingWrites.push_back({ &m_VertexBuffer, size_t(allocation.FirstVertex) * m_VertexStride, std::vector<uint8_t>(data, data + size) });
+	}
+	if (indices && allocation.IndexCount)
+	{
+		const uint8_t* data = reinterpret_cast<const uint8_t*>(indices);
+		const size_t size = size_t(allocation.IndexCount) * sizeof(uint32_t);
+		m_PendingWrites.push_back({ &m_IndexBuffer, size_t(allocation.FirstIndex) * sizeof(uint32_t), std::vector<uint8_t>(data, data + size) });
+	}
+}
+
+void VulkanGeometryArena::Flush(VulkanCommandBuffer& cmd)
+{
+	for (auto& write : m_PendingWrites)
+	{
+		const BufferLayout layout = write.Buffer == &m_VertexBuffer ? BufferReadAccess::Vertex : BufferReadAccess::Index;
+		cmd.Write(write.Buffer, write.Data.data(), write.Data.size(), write.Offset, layout, layout);
+	}
+	m_PendingWrites.clear();
+}
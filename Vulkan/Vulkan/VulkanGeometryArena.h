@@ -0,0 +1,86 @@
+#pragma once
+
+#include "VulkanBuffer.h"
+
+#include <map>
+#include <vector>
+#include <string>
+
+// First-fit free-list allocator of ranges. Adjacent free ranges are merged on free
+class RangeAllocator
+{
+public:
+	static constexpr uint32_t InvalidOffset = uint32_t(-1);
+
+	RangeAllocator(uint32_t capacity);
+
+	// Returns `InvalidOffset` if there's no free range that's big enough
+	uint32_t Allocate(uint32_t size);
+	void Free(uint32_t offset, uint32_t size);
+
+	uint32_t GetCapacity() const { return m_Capacity; }
+	uint32_t GetUsed() const { return m_Used; }
+
+private:
+	std::map<uint32_t, uint32_t> m_FreeRanges; // Offset -> Size
+	uint32_t m_Capacity = 0;
+	uint32_t m_Used = 0;
+};
+
+// Location of a mesh inside of a geometry arena. Offsets and counts are in vertices and indices, not bytes
+struct GeometryAllocation
+{
+	uint32_t FirstVertex = RangeAllocator::InvalidOffset;
+	uint32_t VertexCount = 0;
+	uint32_t FirstIndex = RangeAllocator::InvalidOffset;
+	uint32_t IndexCount = 0;
+
+	bool IsValid() const { return FirstVertex != RangeAllocator::InvalidOffset && FirstIndex != RangeAllocator::InvalidOffset; }
+};
+
+// Shared vertex and index buffers that are sub-allocated by meshes, so that many meshes can be drawn without rebinding buffers.
+// Indices are relative to the first vertex of their mesh; it's passed as `vertexOffset` when drawing.
+// Written data is uploaded on the graphics queue by `Flush` since the buffers are constantly in use by it.
+// Arena never grows, so its capacity should fit all meshes that are alive at once
+class VulkanGeometryArena
+{
+public:
+	VulkanGeometryArena(uint32_t vertexStride, uint32_t maxVertices, uint32_t maxIndices, const std::string& debugName = "");
+
+	VulkanGeometryArena(const VulkanGeometryArena&) = delete;
+	VulkanGeometryArena& operator=(const VulkanGeometryArena&) = delete;
+
+	// Returns invalid allocation if the arena is full. Such allocations can't be written or drawn
+	GeometryAllocation Allocate(uint32_t vertexCount, uint32_t indexCount);
+
+	// Freed ranges can be reused immediately. The caller must stop recording draws of the allocation
+	void Free(const GeometryAllocation& allocation);
+
+	// Data is copied and uploaded during the next `Flush`
+	void Write(const GeometryAllocation& allocation, const void* vertices, const uint32_t* indices);
+
+	// Records all pending writes. Must be called outside of a render pass
+	void Flush(VulkanCommandBuffer& cmd);
+
+	const VulkanBuffer* GetVertexBuffer() const { return &m_VertexBuffer; }
+	const VulkanBuffer* GetIndexBuffer() const { return &m_IndexBuffer; }
+	uint32_t GetVertexStride() const { return m_VertexStride; }
+
+	const RangeAllocator& GetVertexAllocator() const { return m_VertexAllocator; }
+	const RangeAllocator& GetIndexAllocator() const { return m_IndexAllocator; }
+
+private:
+	struct PendingWrite
+	{
+		VulkanBuffer* Buffer;
+		size_t Offset;
+		std::vector<uint8_t> Data;
+	};
+
+	VulkanBuffer m_VertexBuffer;
+	VulkanBuffer m_IndexBuffer;
+	RangeAllocator m_VertexAllocator;
+	RangeAllocator m_IndexAllocator;
+	std::vector<PendingWrite> m_PendingWrites;
+	uint32_t m_VertexStride = 0;
+};
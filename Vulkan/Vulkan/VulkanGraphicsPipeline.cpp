@@ -1,6 +1,7 @@
 #include "VulkanGraphicsPipeline.h"
 #include "VulkanContext.h"
-#include "VulkanPipelineCache.h"
+#include "VulkanPipelineRegistry.h"
+#include "VulkanPipelineCompiler.h"
 #include "VulkanDescriptorManager.h"
 #include "VulkanSwapchain.h"
 #include "VulkanTexture2D.h"
@@ -28,155 +29,370 @@ static const VkPipelineDepthStencilStateCreateInfo s_DefaultDepthStencilCI
 	0.f	 // maxDepthBounds
 };
 
-static void MergeDescriptorSetLayoutBindings(std::vector<VkDescriptorSetLayoutBinding>& dstBindings,
-	const std::vector<VkDescriptorSetLayoutBinding>& srcBindings)
+// Everything that `VkGraphicsPipelineCreateInfo` points to. Kept alive until the pipeline is compiled by a worker
+struct GraphicsPipelineCreateData
 {
-	std::vector<VkDescriptorSetLayoutBinding> newBindings;
-	newBindings.reserve(srcBindings.size());
+	GraphicsPipelineCreateData() = default;
+	GraphicsPipelineCreateData(const GraphicsPipelineCreateData&) = delete;
+	GraphicsPipelineCreateData& operator=(const GraphicsPipelineCreateData&) = delete;
+
+	std::vector<VkPipelineShaderStageCreateInfo> Stages;
+	VkSpecializationInfo VertexSpecializationInfo{};
+	VkSpecializationInfo FragmentSpecializationInfo{};
+	std::vector<VkSpecializationMapEntry> VertexMapEntries;
+	std::vector<VkSpecializationMapEntry> FragmentMapEntries;
+	std::vector<uint8_t> VertexSpecializationData;
+	std::vector<uint8_t> FragmentSpecializationData;
+
+	std::array<VkVertexInputBindingDescription, 2> VertexInputBindings{};
+	std::vector<VkVertexInputAttributeDescription> VertexAttribs;
+	std::vector<VkPipelineColorBlendAttachmentState> ColorBlendAttachmentStates;
+	std::vector<VkDynamicState> DynamicStates;
+
+	VkPipelineVertexInputStateCreateInfo VertexInput{};
+	VkPipelineInputAssemblyStateCreateInfo InputAssembly{};
+	VkPipelineViewportStateCreateInfo ViewportState{};
+	VkPipelineRasterizationConservativeStateCreateInfoEXT ConservativeRasterization{};
+	VkPipelineRasterizationStateCreateInfo Rasterization{};
+	VkPipelineMultisampleStateCreateInfo Multisampling{};
+	VkPipelineColorBlendStateCreateInfo ColorBlending{};
+	VkPipelineDepthStencilStateCreateInfo DepthStencil{};
+	VkPipelineDynamicStateCreateInfo DynamicState{};
+	std::vector<VkFormat> ColorAttachmentFormats;
+	VkPipelineRenderingCreateInfoKHR Rendering{}; // Used instead of a render pass if dynamic rendering is supported
+	VkGraphicsPipelineCreateInfo PipelineCI{};
+
+#ifdef VK_EXT_graphics_pipeline_library
+	// Parts of `PipelineCI` that are compiled separately if libraries are used. Indexed by `GraphicsPipelineLibrary`
+	std::vector<VkPipelineShaderStageCreateInfo> PreRasterizationStages;
+	std::array<VkGraphicsPipelineLibraryCreateInfoEXT, 4> LibraryInfos{};
+	std::array<VkGraphicsPipelineCreateInfo, 4> LibraryCIs{};
+#endif
+};
+
+// Complete pipelines, fast-linked pipelines and libraries are kept in the same registry, so keys start with their type
+enum class GraphicsPipelineKeyType : uint8_t
+{
+	Complete,
+	FastLinked,
+	Library
+};
+
+enum class GraphicsPipelineLibrary : uint8_t
+{
+	VertexInput,
+	PreRasterization,
+	FragmentShader,
+	FragmentOutput,
+	Count
+};
+
+static void AppendShader(PipelineKey& key, const VulkanShader* shader)
+{
+	// Binary hash instead of the module, so separately loaded copies of a shader share pipelines
+	key.Append(shader != nullptr);
+	key.Append(shader ? shader->GetBinaryHash() : Hash128{});
+}
+
+// Pipeline keys and descriptions are written through the same field lists below, so a field can't be added to one of them and forgotten in the other.
+// Descriptions are read back through them as well
+class StateWriter
+{
+public:
+	StateWriter(PipelineKey& key) : m_Key(key) {}
 
-	auto cmp = [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b)
+	template<typename T>
+	void operator()(const T& value) { m_Key.Append(value); }
+
+	template<typename T>
+	bool Count(const std::vector<T>& values) { m_Key.Append(values.size()); return true; }
+
+	// For vectors that have as many elements as a vector that was already counted
+	template<typename T>
+	void Match(const std::vector<T>& values, size_t count) { assert(values.size() == count); }
+
+	bool Data(const ShaderSpecializationInfo& info, std::vector<uint8_t>*) { m_Key.Append(info.Data, info.Size); return true; }
+
+private:
+	PipelineKey& m_Key;
+};
+
+class StateReader
+{
+public:
+	StateReader(PipelineKeyReader& reader) : m_Reader(reader) {}
+
+	template<typename T>
+	void operator()(T& value) { m_Reader.Read(value); }
+
+	template<typename T>
+	bool Count(std::vector<T>& values)
 	{
-		return a.binding < b.binding;
-	};
+		size_t count = 0;
+		if (!m_Reader.Read(count) || count > m_Reader.GetRemainingSize())
+			return false;
+
+		values.resize(count);
+		return true;
+	}
 
-	auto dstIt = dstBindings.begin();
-	for (auto& srcBinding : srcBindings)
+	template<typename T>
+	void Match(std::vector<T>& values, size_t count) { values.resize(count); }
+
+	// Specialization data is read into `data` since the info only points to it
+	bool Data(ShaderSpecializationInfo& info, std::vector<uint8_t>* data)
 	{
-		dstIt = std::lower_bound(dstIt, dstBindings.end(), srcBinding, cmp);
+		if (info.Size > m_Reader.GetRemainingSize())
+			return false;
 
-		if (dstIt == dstBindings.end() || dstIt->binding > srcBinding.binding)
-			newBindings.push_back(srcBinding);
-		else
-			dstIt->stageFlags |= srcBinding.stageFlags;
+		data->resize(info.Size);
+		info.Data = data->data();
+		return m_Reader.Read(data->data(), data->size());
 	}
 
-	dstBindings.insert(dstBindings.end(), newBindings.begin(), newBindings.end());
-	std::sort(dstBindings.begin(), dstBindings.end(), cmp);
+private:
+	PipelineKeyReader& m_Reader;
+};
+
+// `data` is only used by `StateReader`
+template<typename Archive, typename Info>
+static bool SerializeSpecializationInfo(Archive& ar, Info& info, std::vector<uint8_t>* data = nullptr)
+{
+	bool bUsed = info.Data && (info.Size > 0);
+	ar(bUsed);
+	if (!bUsed)
+		return true;
+
+	if (!ar.Count(info.MapEntries))
+		return false;
+	for (auto& entry : info.MapEntries)
+	{
+		ar(entry.ConstantID);
+		ar(entry.Offset);
+		ar(entry.Size);
+	}
+	ar(info.Size);
+	return ar.Data(info, data);
 }
 
-static void MergeDescriptorSetLayoutBindings(std::vector<std::vector<VkDescriptorSetLayoutBinding>>& dstSetBindings,
-	const std::vector<std::vector<VkDescriptorSetLayoutBinding>>& srcSetBindings)
+template<typename Archive, typename State>
+static bool SerializePerInstanceAttribs(Archive& ar, State& state)
 {
-	if (srcSetBindings.size() > dstSetBindings.size())
-		dstSetBindings.resize(srcSetBindings.size());
+	if (!ar.Count(state.PerInstanceAttribs))
+		return false;
 
-	for (std::size_t i = 0; i < srcSetBindings.size(); i++)
-		MergeDescriptorSetLayoutBindings(dstSetBindings[i], srcSetBindings[i]);
+	for (auto& attrib : state.PerInstanceAttribs)
+		ar(attrib.Location);
+	return true;
 }
 
-VulkanGraphicsPipeline::VulkanGraphicsPipeline(const GraphicsPipelineState& state, const VulkanGraphicsPipeline* parentPipeline)
-	: m_State(state)
+// Dynamic with extended dynamic state
+template<typename Archive, typename State>
+static void SerializeCullState(Archive& ar, State& state)
 {
-	assert(state.VertexShader->GetType() == ShaderType::Vertex);
-	assert(state.FragmentShader->GetType() == ShaderType::Fragment);
-	if (state.GeometryShader)
-		assert(state.GeometryShader->GetType() == ShaderType::Geometry);
+	ar(state.CullMode);
+	ar(state.FrontFace);
+}
 
-	const VkDevice device = VulkanContext::GetDevice()->GetVulkanDevice();
-	const size_t colorAttachmentsCount = state.ColorAttachments.size();
-	const bool bDeviceSupportsConservativeRasterization = VulkanContext::GetDevice()->GetPhysicalDevice()->GetExtensionSupport().SupportsConservativeRasterization;
+// Dynamic with extended dynamic state
+template<typename Archive, typename State>
+static void SerializeDepthState(Archive& ar, State& state)
+{
+	ar(state.DepthStencilAttachment.DepthCompareOp);
+	ar(state.DepthStencilAttachment.bWriteDepth);
+}
 
-	VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
-	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-	inputAssembly.topology = TopologyToVulkan(state.Topology);
+// Dynamic with extended dynamic state 3
+template<typename Archive, typename Attachment>
+static void SerializeBlendState(Archive& ar, Attachment& attachment)
+{
+	ar(attachment.bBlendEnabled);
+	ar(attachment.BlendingState.BlendOp);
+	ar(attachment.BlendingState.BlendOpAlpha);
+	ar(attachment.BlendingState.BlendSrc);
+	ar(attachment.BlendingState.BlendDst);
+	ar(attachment.BlendingState.BlendSrcAlpha);
+	ar(attachment.BlendingState.BlendDstAlpha);
+}
 
-	VkPipelineViewportStateCreateInfo viewportState{};
-	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-	viewportState.scissorCount = 1;
-	viewportState.viewportCount = 1;
+template<typename Archive, typename Format>
+static void SerializeAttachmentFormat(Archive& ar, Format& format)
+{
+	ar(format.Format);
+	ar(format.Samples);
+}
 
-	VkPipelineRasterizationConservativeStateCreateInfoEXT conservativeRasterizationCI{};
-	conservativeRasterizationCI.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_CONSERVATIVE_STATE_CREATE_INFO_EXT;
-	conservativeRasterizationCI.conservativeRasterizationMode = VK_CONSERVATIVE_RASTERIZATION_MODE_OVERESTIMATE_EXT; // TODO: Test different modes
+static void AppendSpecializationInfo(PipelineKey& key, const ShaderSpecializationInfo& info)
+{
+	StateWriter writer(key);
+	SerializeSpecializationInfo(writer, info);
+}
 
-	VkPipelineRasterizationStateCreateInfo rasterization{};
-	rasterization.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-	rasterization.rasterizerDiscardEnable = VK_FALSE; // No geometry passes rasterization stage if set to TRUE
-	rasterization.polygonMode = VK_POLYGON_MODE_FILL;
-	rasterization.lineWidth = state.LineWidth;
-	rasterization.cullMode = CullModeToVulkan(state.CullMode);
-	rasterization.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-	rasterization.pNext = (state.bEnableConservativeRasterization && bDeviceSupportsConservativeRasterization) ? &conservativeRasterizationCI : nullptr;
+// Attachment formats, samples and load ops are covered by the render pass since only identical render passes are shared.
+// With dynamic rendering there's no render pass and pipelines only depend on formats and samples
+static void AppendAttachments(PipelineKey& key, const AttachmentFormats& formats, VkRenderPass renderPass)
+{
+	key.Append(renderPass);
+	if (renderPass)
+		return;
+
+	StateWriter writer(key);
+	writer.Count(formats.ColorAttachments);
+	for (auto& format : formats.ColorAttachments)
+		SerializeAttachmentFormat(writer, format);
+	SerializeAttachmentFormat(writer, formats.DepthStencilAttachment);
+}
 
-	if (state.bEnableConservativeRasterization && !bDeviceSupportsConservativeRasterization)
-		std::cerr << "[Renderer::WARN] Conservation rasterization was requested but device doesn't support it. So it was not enabled\n";
+// Dynamic states are set by command buffers, so pipelines that only differ in them are shared
+static void AppendVertexInputState(PipelineKey& key, const GraphicsPipelineState& state)
+{
+	// Vertex attributes are taken from the vertex shader
+	AppendShader(key, state.VertexShader);
+	StateWriter writer(key);
+	SerializePerInstanceAttribs(writer, state);
+
+	const ExtensionSupport& support = VulkanContext::GetDevice()->GetPhysicalDevice()->GetExtensionSupport();
+	if (!support.SupportsExtendedDynamicState || !support.SupportsUnrestrictedDynamicTopology)
+		writer(state.Topology); // Each topology is a class of its own
+}
 
-	VkPipelineMultisampleStateCreateInfo multisampling{};
-	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-	multisampling.rasterizationSamples = GetVulkanSamplesCount(state.GetSamplesCount());
+static void AppendRasterizationState(PipelineKey& key, const GraphicsPipelineState& state, bool bConservativeRasterization)
+{
+	StateWriter writer(key);
+	if (!VulkanContext::GetDevice()->GetPhysicalDevice()->GetExtensionSupport().SupportsExtendedDynamicState)
+		SerializeCullState(writer, state);
+	writer(state.LineWidth);
+	writer(bConservativeRasterization);
+}
 
-	std::vector<VkPipelineColorBlendAttachmentState> colorBlendAttachmentStates(colorAttachmentsCount);
-	VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-	colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-	for (size_t i = 0; i < colorAttachmentsCount; ++i)
+static void AppendDepthState(PipelineKey& key, const GraphicsPipelineState& state)
+{
+	StateWriter writer(key);
+	if (!VulkanContext::GetDevice()->GetPhysicalDevice()->GetExtensionSupport().SupportsExtendedDynamicState)
+		SerializeDepthState(writer, state);
+}
+
+static void AppendBlendState(PipelineKey& key, const GraphicsPipelineState& state)
+{
+	StateWriter writer(key);
+	writer.Count(state.ColorAttachments);
+	if (VulkanContext::GetDevice()->GetPhysicalDevice()->GetExtensionSupport().SupportsExtendedDynamicState3)
+		return;
+
+	for (auto& attachment : state.ColorAttachments)
+		SerializeBlendState(writer, attachment);
+}
+
+// The key only depends on the contents of objects, so pipelines of the warm-up match pipelines requested later.
+// Fast-linked pipelines have the same contents as complete ones and only differ in type
+static PipelineKey MakePipelineKey(GraphicsPipelineKeyType type, const GraphicsPipelineState& state, const AttachmentFormats& formats, VkRenderPass renderPass, VkPipelineLayout pipelineLayout, bool bConservativeRasterization)
+{
+	PipelineKey key;
+	key.Append(type);
+	AppendAttachments(key, formats, renderPass);
+	key.Append(pipelineLayout);
+
+	AppendVertexInputState(key, state);
+	AppendShader(key, state.FragmentShader);
+	AppendShader(key, state.GeometryShader);
+	AppendSpecializationInfo(key, state.VertexSpecializationInfo);
+	AppendSpecializationInfo(key, state.FragmentSpecializationInfo);
+
+	AppendRasterizationState(key, state, bConservativeRasterization);
+	AppendBlendState(key, state);
+	AppendDepthState(key, state);
+
+	return key;
+}
+
+// Each library only depends on the state of its part, so it's shared by pipelines that differ in other parts
+static PipelineKey MakeLibraryKey(GraphicsPipelineLibrary library, const GraphicsPipelineState& state, const AttachmentFormats& formats, VkRenderPass renderPass, VkPipelineLayout pipelineLayout, bool bConservativeRasterization)
+{
+	PipelineKey key;
+	key.Append(GraphicsPipelineKeyType::Library);
+	key.Append(library);
+
+	if (library == GraphicsPipelineLibrary::VertexInput)
 	{
-		colorBlendAttachment.blendEnable = state.ColorAttachments[i].bBlendEnabled;
-		
-		const BlendState& blendState = state.ColorAttachments[i].BlendingState;
-		colorBlendAttachment.colorBlendOp = (VkBlendOp)blendState.BlendOp;
-		colorBlendAttachment.alphaBlendOp = (VkBlendOp)blendState.BlendOpAlpha;
-		colorBlendAttachment.srcColorBlendFactor = (VkBlendFactor)blendState.BlendSrc;
-		colorBlendAttachment.dstColorBlendFactor = (VkBlendFactor)blendState.BlendDst;
-		colorBlendAttachment.srcAlphaBlendFactor = (VkBlendFactor)blendState.BlendSrcAlpha;
-		colorBlendAttachment.dstAlphaBlendFactor = (VkBlendFactor)blendState.BlendDstAlpha;
+		AppendVertexInputState(key, state);
+		return key;
+	}
 
-		colorBlendAttachmentStates[i] = colorBlendAttachment;
+	AppendAttachments(key, formats, renderPass);
+	switch (library)
+	{
+	case GraphicsPipelineLibrary::PreRasterization:
+		key.Append(pipelineLayout);
+		AppendShader(key, state.VertexShader);
+		AppendShader(key, state.GeometryShader);
+		AppendSpecializationInfo(key, state.VertexSpecializationInfo);
+		AppendRasterizationState(key, state, bConservativeRasterization);
+		break;
+	case GraphicsPipelineLibrary::FragmentShader:
+		key.Append(pipelineLayout);
+		AppendShader(key, state.FragmentShader);
+		AppendSpecializationInfo(key, state.FragmentSpecializationInfo);
+		AppendDepthState(key, state);
+		break;
+	case GraphicsPipelineLibrary::FragmentOutput:
+		AppendBlendState(key, state);
+		break;
+	default:
+		assert(!"Unknown pipeline library");
 	}
 
-	VkPipelineColorBlendStateCreateInfo colorBlending{};
-	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-	colorBlending.logicOpEnable = VK_FALSE;
-	colorBlending.attachmentCount = (uint32_t)colorBlendAttachmentStates.size();
-	colorBlending.pAttachments = colorBlendAttachmentStates.data();
+	return key;
+}
 
-	// Pipeline layout
+static AttachmentFormat GetAttachmentFormat(const VulkanImage* image)
+{
+	AttachmentFormat format;
+	if (image)
 	{
-		m_SetBindings = state.VertexShader->GeLayoutSetBindings();
-		if (state.GeometryShader)
-			MergeDescriptorSetLayoutBindings(m_SetBindings, state.GeometryShader->GeLayoutSetBindings());
-		MergeDescriptorSetLayoutBindings(m_SetBindings, state.FragmentShader->GeLayoutSetBindings());
-		const uint32_t setsCount = (uint32_t)m_SetBindings.size();
-
-		m_SetLayouts.clear();
-		m_SetLayouts.resize(setsCount);
-		for (uint32_t i = 0; i < setsCount; ++i)
-		{
-			VkDescriptorSetLayoutCreateInfo layoutInfo{};
-			layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-			layoutInfo.bindingCount = (uint32_t)m_SetBindings[i].size();
-			layoutInfo.pBindings = m_SetBindings[i].data();
+		format.Format = image->GetVulkanFormat();
+		format.Samples = image->GetSamplesCount();
+		format.bTransient = image->HasUsage(ImageUsage::TransientAttachment);
+	}
+	return format;
+}
 
-			VK_CHECK(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &m_SetLayouts[i]));
-		}
+static AttachmentFormats GetAttachmentFormats(const GraphicsPipelineState& state)
+{
+	AttachmentFormats formats;
+	formats.ColorAttachments.reserve(state.ColorAttachments.size());
+	for (auto& attachment : state.ColorAttachments)
+		formats.ColorAttachments.push_back(GetAttachmentFormat(attachment.Image));
 
-		std::vector<VkPushConstantRange> pushConstants;
-		for (auto& range : state.VertexShader->GetPushConstantRanges())
-			pushConstants.push_back(range);
+	formats.ResolveAttachments.reserve(state.ResolveAttachments.size());
+	for (auto& attachment : state.ResolveAttachments)
+		formats.ResolveAttachments.push_back(GetAttachmentFormat(attachment.Image));
 
-		if (state.GeometryShader)
-			for (auto& range : state.GeometryShader->GetPushConstantRanges())
-				pushConstants.push_back(range);
+	formats.DepthStencilAttachment = GetAttachmentFormat(state.DepthStencilAttachment.Image);
+	return formats;
+}
 
-		for (auto& range : state.FragmentShader->GetPushConstantRanges())
-			pushConstants.push_back(range);
+// Color and depth attachments must have the same samples count
+static SamplesCount GetSamplesCount(const AttachmentFormats& formats)
+{
+	if (formats.DepthStencilAttachment.Format != VK_FORMAT_UNDEFINED)
+		return formats.DepthStencilAttachment.Samples;
 
-		VkPipelineLayoutCreateInfo pipelineLayoutCI{};
-		pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-		pipelineLayoutCI.setLayoutCount = setsCount;
-		pipelineLayoutCI.pSetLayouts = m_SetLayouts.data();
-		pipelineLayoutCI.pushConstantRangeCount = (uint32_t)pushConstants.size();
-		pipelineLayoutCI.pPushConstantRanges = pushConstants.data();
+	for (auto& format : formats.ColorAttachments)
+		if (format.Format != VK_FORMAT_UNDEFINED)
+			return format.Samples;
 
-		VK_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutCI, nullptr, &m_PipelineLayout));
-	}
+	assert(!"Pipeline has no attachments");
+	return SamplesCount::Samples1;
+}
 
-	// Render pass
+// Only identical render passes are shared through the registry
+static VkRenderPass AcquireRenderPass(const GraphicsPipelineState& state, const AttachmentFormats& formats)
+{
+	const size_t colorAttachmentsCount = state.ColorAttachments.size();
 	std::vector<VkAttachmentDescription> attachmentDescs;
 	std::vector<VkAttachmentReference> colorRefs(colorAttachmentsCount);
 	std::vector<VkAttachmentReference> resolveRefs;
 	std::vector<VkAttachmentReference> depthRef;
-	std::vector<VkImageView> attachmentsImageViews;
-	attachmentsImageViews.reserve(colorAttachmentsCount);
 
 	if (state.ResolveAttachments.size())
 	{
@@ -190,83 +406,68 @@ VulkanGraphicsPipeline::VulkanGraphicsPipeline(const GraphicsPipelineState& stat
 
 	for (size_t i = 0; i < colorAttachmentsCount; ++i)
 	{
-		const VulkanImage* renderTarget = state.ColorAttachments[i].Image;
-		if (!renderTarget)
+		const AttachmentFormat& format = formats.ColorAttachments[i];
+		if (format.Format == VK_FORMAT_UNDEFINED)
 		{
 			colorRefs[i] = { VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED };
 			continue;
 		}
 
-		assert(renderTarget->HasUsage(ImageUsage::ColorAttachment));
-
 		uint32_t attachmentIndex = (uint32_t)attachmentDescs.size();
 		const bool bClearEnabled = state.ColorAttachments[i].bClearEnabled;
 		auto& desc = attachmentDescs.emplace_back();
-		desc.samples = GetVulkanSamplesCount(renderTarget->GetSamplesCount());
+		desc.samples = GetVulkanSamplesCount(format.Samples);
 		desc.loadOp = bClearEnabled ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-		desc.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		desc.storeOp = format.bTransient ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE; // Transient contents don't outlive the render pass
 		desc.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		desc.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		desc.format = renderTarget->GetVulkanFormat();
+		desc.format = format.Format;
 		desc.initialLayout = bClearEnabled ? VK_IMAGE_LAYOUT_UNDEFINED : ImageLayoutToVulkan(state.ColorAttachments[i].InitialLayout);
 		desc.finalLayout = ImageLayoutToVulkan(state.ColorAttachments[i].FinalLayout);
 
 		colorRefs[i] = { attachmentIndex, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
-		attachmentsImageViews.push_back(renderTarget->GetVulkanImageView());
 	}
 
 	for (size_t i = 0; i < state.ResolveAttachments.size(); ++i)
 	{
-		const VulkanImage* renderTarget = state.ResolveAttachments[i].Image;
-		if (!renderTarget)
+		const AttachmentFormat& format = formats.ResolveAttachments[i];
+		if (format.Format == VK_FORMAT_UNDEFINED)
 		{
-			colorRefs[i] = { VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED };
+			resolveRefs[i] = { VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED };
 			continue;
 		}
 
-		assert(renderTarget->HasUsage(ImageUsage::ColorAttachment));
-
 		uint32_t attachmentIndex = (uint32_t)attachmentDescs.size();
 		attachmentDescs.push_back({});
 		auto& desc = attachmentDescs.back();
-		desc.samples = GetVulkanSamplesCount(renderTarget->GetSamplesCount());
+		desc.samples = GetVulkanSamplesCount(format.Samples);
 		desc.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		desc.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 		desc.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		desc.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		desc.format = renderTarget->GetVulkanFormat();
+		desc.format = format.Format;
 		desc.initialLayout = ImageLayoutToVulkan(state.ResolveAttachments[i].InitialLayout);
 		desc.finalLayout = ImageLayoutToVulkan(state.ResolveAttachments[i].FinalLayout);
 
 		resolveRefs[i] = { attachmentIndex, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
-		attachmentsImageViews.push_back(renderTarget->GetVulkanImageView());
 	}
 
-	VkPipelineDepthStencilStateCreateInfo depthStencilCI = s_DefaultDepthStencilCI;
-	const VulkanImage* depthStencilImage = state.DepthStencilAttachment.Image;
-	if (depthStencilImage)
+	const AttachmentFormat& depthStencilFormat = formats.DepthStencilAttachment;
+	if (depthStencilFormat.Format != VK_FORMAT_UNDEFINED)
 	{
-		assert(depthStencilImage->HasUsage(ImageUsage::DepthStencilAttachment));
-
 		const bool bClearEnabled = state.DepthStencilAttachment.bClearEnabled;
 		std::uint32_t attachmentIndex = static_cast<std::uint32_t>(attachmentDescs.size());
 		auto& desc = attachmentDescs.emplace_back();
-		desc.samples = GetVulkanSamplesCount(depthStencilImage->GetSamplesCount());
+		desc.samples = GetVulkanSamplesCount(depthStencilFormat.Samples);
 		desc.loadOp = bClearEnabled ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-		desc.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		desc.storeOp = depthStencilFormat.bTransient ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
 		desc.stencilLoadOp = bClearEnabled ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		desc.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		desc.format = depthStencilImage->GetVulkanFormat();
+		desc.format = depthStencilFormat.Format;
 		desc.initialLayout = bClearEnabled ? VK_IMAGE_LAYOUT_UNDEFINED : ImageLayoutToVulkan(state.DepthStencilAttachment.InitialLayout);
 		desc.finalLayout = ImageLayoutToVulkan(state.DepthStencilAttachment.FinalLayout);
 
-		const bool bDepthTestEnabled = (state.DepthStencilAttachment.DepthCompareOp != CompareOperation::Never);
-		depthStencilCI.depthTestEnable = bDepthTestEnabled;
-		depthStencilCI.depthCompareOp = bDepthTestEnabled ? CompareOpToVulkan(state.DepthStencilAttachment.DepthCompareOp) : VK_COMPARE_OP_NEVER;
-		depthStencilCI.depthWriteEnable = state.DepthStencilAttachment.bWriteDepth;
-
 		depthRef.push_back({ attachmentIndex, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL });
-		attachmentsImageViews.push_back(depthStencilImage->GetVulkanImageView());
 	}
 
 	assert(depthRef.size() == 0 || depthRef.size() == 1);
@@ -303,47 +504,277 @@ VulkanGraphicsPipeline::VulkanGraphicsPipeline(const GraphicsPipelineState& stat
 	renderPassCI.pDependencies = dependencies.data();
 	renderPassCI.pSubpasses = &subpassDesc;
 	renderPassCI.subpassCount = 1;
-	VK_CHECK(vkCreateRenderPass(device, &renderPassCI, nullptr, &m_RenderPass));
+	return VulkanPipelineRegistry::AcquireRenderPass(renderPassCI);
+}
 
-	if (colorAttachmentsCount)
+// Description of a pipeline that doesn't reference objects of the session. Recorded by `VulkanPipelineRegistry` for the warm-up
+struct GraphicsPipelineDescription
+{
+	struct Shader
 	{
-		auto& size = state.ColorAttachments[0].Image->GetSize();
-		m_Width  = size.x;
-		m_Height = size.y;
+		std::string Path; // Empty if the stage is not used
+		ShaderDefines Defines;
+	};
+
+	GraphicsPipelineState State; // Without images and shaders
+	AttachmentFormats Formats;
+	Shader Shaders[3]; // Vertex, Fragment, Geometry
+	std::vector<uint8_t> VertexSpecializationData;
+	std::vector<uint8_t> FragmentSpecializationData;
+};
+
+static void AppendString(PipelineKey& key, const std::string& str)
+{
+	key.Append(str.size());
+	key.Append(str.data(), str.size());
+}
+
+static bool ReadString(PipelineKeyReader& reader, std::string& str)
+{
+	size_t size = 0;
+	if (!reader.Read(size) || size > reader.GetRemainingSize())
+		return false;
+
+	str.resize(size);
+	return reader.Read(str.data(), size);
+}
+
+static void AppendShaderDescription(PipelineKey& key, const VulkanShader* shader)
+{
+	AppendString(key, shader ? shader->GetPath().string() : std::string());
+	if (!shader)
+		return;
+
+	key.Append(shader->GetDefines().size());
+	for (auto& [name, value] : shader->GetDefines())
+	{
+		AppendString(key, name);
+		AppendString(key, value);
 	}
-	else if (depthStencilImage)
+}
+
+static bool ReadShaderDescription(PipelineKeyReader& reader, GraphicsPipelineDescription::Shader& shader)
+{
+	if (!ReadString(reader, shader.Path))
+		return false;
+	if (shader.Path.empty())
+		return true;
+
+	size_t definesCount = 0;
+	if (!reader.Read(definesCount) || definesCount > reader.GetRemainingSize())
+		return false;
+
+	shader.Defines.resize(definesCount);
+	for (auto& [name, value] : shader.Defines)
+		if (!ReadString(reader, name) || !ReadString(reader, value))
+			return false;
+
+	return true;
+}
+
+// Formats are stored along with the rest of the attachment since they're not part of the state
+template<typename Archive, typename Format, typename Attachment>
+static void SerializeAttachmentDescription(Archive& ar, Format& format, Attachment& attachment)
+{
+	SerializeAttachmentFormat(ar, format);
+	ar(format.bTransient);
+	ar(attachment.InitialLayout);
+	ar(attachment.FinalLayout);
+}
+
+// Everything of the state except shaders and images. `...SpecializationData` are only used by `StateReader`
+template<typename Archive, typename State, typename Formats>
+static bool SerializeDescription(Archive& ar, State& state, Formats& formats, std::vector<uint8_t>* vertexSpecializationData = nullptr, std::vector<uint8_t>* fragmentSpecializationData = nullptr)
+{
+	if (!SerializeSpecializationInfo(ar, state.VertexSpecializationInfo, vertexSpecializationData) ||
+		!SerializeSpecializationInfo(ar, state.FragmentSpecializationInfo, fragmentSpecializationData) ||
+		!SerializePerInstanceAttribs(ar, state))
+		return false;
+
+	ar(state.Topology);
+	SerializeCullState(ar, state);
+	ar(state.LineWidth);
+	ar(state.bEnableConservativeRasterization);
+	ar(state.PushDescriptorSet);
+	ar(state.bUseLibraries);
+
+	if (!ar.Count(state.ColorAttachments))
+		return false;
+	ar.Match(formats.ColorAttachments, state.ColorAttachments.size());
+	for (size_t i = 0; i < state.ColorAttachments.size(); ++i)
 	{
-		auto& size = depthStencilImage->GetSize();
-		m_Width  = size.x;
-		m_Height = size.y;
+		SerializeAttachmentDescription(ar, formats.ColorAttachments[i], state.ColorAttachments[i]);
+		ar(state.ColorAttachments[i].bClearEnabled);
+		SerializeBlendState(ar, state.ColorAttachments[i]);
 	}
-	else
+
+	if (!ar.Count(state.ResolveAttachments))
+		return false;
+	ar.Match(formats.ResolveAttachments, state.ResolveAttachments.size());
+	for (size_t i = 0; i < state.ResolveAttachments.size(); ++i)
+		SerializeAttachmentDescription(ar, formats.ResolveAttachments[i], state.ResolveAttachments[i]);
+
+	SerializeAttachmentDescription(ar, formats.DepthStencilAttachment, state.DepthStencilAttachment);
+	ar(state.DepthStencilAttachment.bClearEnabled);
+	SerializeDepthState(ar, state);
+
+	return true;
+}
+
+static PipelineKey MakeDescription(const GraphicsPipelineState& state, const AttachmentFormats& formats)
+{
+	PipelineKey description;
+	AppendShaderDescription(description, state.VertexShader);
+	AppendShaderDescription(description, state.FragmentShader);
+	AppendShaderDescription(description, state.GeometryShader);
+
+	StateWriter writer(description);
+	SerializeDescription(writer, state, formats);
+	return description;
+}
+
+// Returns false if the description is corrupted
+static bool ReadDescription(const PipelineKey& data, GraphicsPipelineDescription& description)
+{
+	PipelineKeyReader reader(data);
+	for (auto& shader : description.Shaders)
+		if (!ReadShaderDescription(reader, shader))
+			return false;
+
+	StateReader stateReader(reader);
+	if (!SerializeDescription(stateReader, description.State, description.Formats, &description.VertexSpecializationData, &description.FragmentSpecializationData))
+		return false;
+
+	return reader.IsValid() && !description.Shaders[0].Path.empty() && !description.Shaders[1].Path.empty();
+}
+
+static std::vector<VulkanGraphicsPipeline*> s_WarmUpPipelines;
+static std::vector<GraphicsPipelineDescription> s_WarmUpPipelineDescriptions; // Kept alive since states of the pipelines point into their specialization data
+static std::unordered_map<std::string, VulkanShader*> s_WarmUpShaders; // Path and defines -> Shader. Only used by the loading thread until it's done
+static std::future<std::vector<GraphicsPipelineDescription>> s_WarmUpDescriptions; // Descriptions with loaded shaders
+
+static VulkanShader* GetWarmUpShader(const GraphicsPipelineDescription::Shader& description, ShaderType type)
+{
+	if (description.Path.empty())
+		return nullptr;
+
+	std::string name = description.Path;
+	for (auto& [define, value] : description.Defines)
+		name += "|" + define + "=" + value;
+
+	auto it = s_WarmUpShaders.find(name);
+	if (it != s_WarmUpShaders.end())
+		return it->second;
+
+	VulkanShader* shader = std::filesystem::exists(description.Path) ? new VulkanShader(description.Path, type, description.Defines) : nullptr;
+	s_WarmUpShaders.emplace(name, shader);
+	return shader;
+}
+
+VulkanGraphicsPipeline::VulkanGraphicsPipeline(const GraphicsPipelineState& state, const VulkanGraphicsPipeline* parentPipeline)
+	: VulkanGraphicsPipeline(state, GetAttachmentFormats(state), parentPipeline)
+{
+	m_bRecordUsage = true;
+}
+
+// Fills everything that the pipeline is created with. Only called if the pipeline is not registered yet
+static std::shared_ptr<GraphicsPipelineCreateData> MakeCreateData(const GraphicsPipelineState& state, const AttachmentFormats& formats, VkPipelineLayout pipelineLayout, VkRenderPass renderPass)
+{
+	const size_t colorAttachmentsCount = state.ColorAttachments.size();
+	const bool bDeviceSupportsConservativeRasterization = VulkanContext::GetDevice()->GetPhysicalDevice()->GetExtensionSupport().SupportsConservativeRasterization;
+	std::shared_ptr<GraphicsPipelineCreateData> createData = std::make_shared<GraphicsPipelineCreateData>();
+
+	VkPipelineInputAssemblyStateCreateInfo& inputAssembly = createData->InputAssembly;
+	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssembly.topology = TopologyToVulkan(state.Topology);
+
+	VkPipelineViewportStateCreateInfo& viewportState = createData->ViewportState;
+	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportState.scissorCount = 1;
+	viewportState.viewportCount = 1;
+
+	VkPipelineRasterizationConservativeStateCreateInfoEXT& conservativeRasterizationCI = createData->ConservativeRasterization;
+	conservativeRasterizationCI.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_CONSERVATIVE_STATE_CREATE_INFO_EXT;
+	conservativeRasterizationCI.conservativeRasterizationMode = VK_CONSERVATIVE_RASTERIZATION_MODE_OVERESTIMATE_EXT; // TODO: Test different modes
+
+	VkPipelineRasterizationStateCreateInfo& rasterization = createData->Rasterization;
+	rasterization.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterization.rasterizerDiscardEnable = VK_FALSE; // No geometry passes rasterization stage if set to TRUE
+	rasterization.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterization.lineWidth = state.LineWidth;
+	rasterization.cullMode = CullModeToVulkan(state.CullMode);
+	rasterization.frontFace = FrontFaceToVulkan(state.FrontFace);
+	rasterization.pNext = (state.bEnableConservativeRasterization && bDeviceSupportsConservativeRasterization) ? &conservativeRasterizationCI : nullptr;
+
+	VkPipelineMultisampleStateCreateInfo& multisampling = createData->Multisampling;
+	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampling.rasterizationSamples = GetVulkanSamplesCount(GetSamplesCount(formats));
+
+	std::vector<VkPipelineColorBlendAttachmentState>& colorBlendAttachmentStates = createData->ColorBlendAttachmentStates;
+	colorBlendAttachmentStates.resize(colorAttachmentsCount);
+	VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+	colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	for (size_t i = 0; i < colorAttachmentsCount; ++i)
 	{
-		m_Width = m_Height = 0;
+		colorBlendAttachment.blendEnable = state.ColorAttachments[i].bBlendEnabled;
+		
+		const BlendState& blendState = state.ColorAttachments[i].BlendingState;
+		colorBlendAttachment.colorBlendOp = (VkBlendOp)blendState.BlendOp;
+		colorBlendAttachment.alphaBlendOp = (VkBlendOp)blendState.BlendOpAlpha;
+		colorBlendAttachment.srcColorBlendFactor = (VkBlendFactor)blendState.BlendSrc;
+		colorBlendAttachment.dstColorBlendFactor = (VkBlendFactor)blendState.BlendDst;
+		colorBlendAttachment.srcAlphaBlendFactor = (VkBlendFactor)blendState.BlendSrcAlpha;
+		colorBlendAttachment.dstAlphaBlendFactor = (VkBlendFactor)blendState.BlendDstAlpha;
+
+		colorBlendAttachmentStates[i] = colorBlendAttachment;
 	}
 
-	VkFramebufferCreateInfo framebufferCI{};
-	framebufferCI.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-	framebufferCI.attachmentCount = (uint32_t)attachmentsImageViews.size();
-	framebufferCI.renderPass = m_RenderPass;
-	framebufferCI.width = m_Width;
-	framebufferCI.height = m_Height;
-	framebufferCI.layers = 1;
-	framebufferCI.pAttachments = attachmentsImageViews.data();
-	VK_CHECK(vkCreateFramebuffer(device, &framebufferCI, nullptr, &m_Framebuffer));
+	VkPipelineColorBlendStateCreateInfo& colorBlending = createData->ColorBlending;
+	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colorBlending.logicOpEnable = VK_FALSE;
+	colorBlending.attachmentCount = (uint32_t)colorBlendAttachmentStates.size();
+	colorBlending.pAttachments = colorBlendAttachmentStates.data();
+
+	VkPipelineDepthStencilStateCreateInfo& depthStencilCI = createData->DepthStencil;
+	depthStencilCI = s_DefaultDepthStencilCI;
+	const AttachmentFormat& depthStencilFormat = formats.DepthStencilAttachment;
+	if (depthStencilFormat.Format != VK_FORMAT_UNDEFINED)
+	{
+		const bool bDepthTestEnabled = (state.DepthStencilAttachment.DepthCompareOp != CompareOperation::Never);
+		depthStencilCI.depthTestEnable = bDepthTestEnabled;
+		depthStencilCI.depthCompareOp = bDepthTestEnabled ? CompareOpToVulkan(state.DepthStencilAttachment.DepthCompareOp) : VK_COMPARE_OP_NEVER;
+		depthStencilCI.depthWriteEnable = state.DepthStencilAttachment.bWriteDepth;
+	}
+
+	if (!renderPass)
+	{
+		// Pipeline only depends on attachment formats. Images are supplied when rendering begins
+		std::vector<VkFormat>& colorFormats = createData->ColorAttachmentFormats;
+		colorFormats.reserve(colorAttachmentsCount);
+		for (auto& format : formats.ColorAttachments)
+			colorFormats.push_back(format.Format); // Undefined format marks an unused attachment
+
+		VkPipelineRenderingCreateInfoKHR& renderingCI = createData->Rendering;
+		renderingCI.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+		renderingCI.colorAttachmentCount = (uint32_t)colorFormats.size();
+		renderingCI.pColorAttachmentFormats = colorFormats.data();
+		renderingCI.depthAttachmentFormat = HasDepth(depthStencilFormat.Format) ? depthStencilFormat.Format : VK_FORMAT_UNDEFINED;
+		renderingCI.stencilAttachmentFormat = HasStencil(depthStencilFormat.Format) ? depthStencilFormat.Format : VK_FORMAT_UNDEFINED;
+	}
 
 	// Shaders
-	std::vector<VkPipelineShaderStageCreateInfo> stages;
+	std::vector<VkPipelineShaderStageCreateInfo>& stages = createData->Stages;
 	stages.reserve(3);
 	stages.push_back(state.VertexShader->GetPipelineShaderStageInfo());
 	stages.push_back(state.FragmentShader->GetPipelineShaderStageInfo());
 	if (state.GeometryShader)
 		stages.push_back(state.GeometryShader->GetPipelineShaderStageInfo());
 
-	VkSpecializationInfo vertexSpecializationInfo{};
-	VkSpecializationInfo fragmentSpecializationInfo{};
-	std::vector<VkSpecializationMapEntry> vertexMapEntries;
-	std::vector<VkSpecializationMapEntry> fragmentMapEntries;
+	// Specialization data is copied since the state only points to it
+	VkSpecializationInfo& vertexSpecializationInfo = createData->VertexSpecializationInfo;
+	VkSpecializationInfo& fragmentSpecializationInfo = createData->FragmentSpecializationInfo;
+	std::vector<VkSpecializationMapEntry>& vertexMapEntries = createData->VertexMapEntries;
+	std::vector<VkSpecializationMapEntry>& fragmentMapEntries = createData->FragmentMapEntries;
 
 	if (state.VertexSpecializationInfo.Data && (state.VertexSpecializationInfo.Size > 0))
 	{
@@ -352,7 +783,10 @@ VulkanGraphicsPipeline::VulkanGraphicsPipeline(const GraphicsPipelineState& stat
 		for (auto& entry : state.VertexSpecializationInfo.MapEntries)
 			vertexMapEntries.emplace_back(VkSpecializationMapEntry{ entry.ConstantID, entry.Offset, entry.Size });
 
-		vertexSpecializationInfo.pData = state.VertexSpecializationInfo.Data;
+		const uint8_t* data = static_cast<const uint8_t*>(state.VertexSpecializationInfo.Data);
+		createData->VertexSpecializationData.assign(data, data + state.VertexSpecializationInfo.Size);
+
+		vertexSpecializationInfo.pData = createData->VertexSpecializationData.data();
 		vertexSpecializationInfo.dataSize = state.VertexSpecializationInfo.Size;
 		vertexSpecializationInfo.mapEntryCount = (uint32_t)mapEntriesCount;
 		vertexSpecializationInfo.pMapEntries = vertexMapEntries.data();
@@ -365,7 +799,10 @@ VulkanGraphicsPipeline::VulkanGraphicsPipeline(const GraphicsPipelineState& stat
 		for (auto& entry : state.FragmentSpecializationInfo.MapEntries)
 			fragmentMapEntries.emplace_back(VkSpecializationMapEntry{ entry.ConstantID, entry.Offset, entry.Size });
 
-		fragmentSpecializationInfo.pData = state.FragmentSpecializationInfo.Data;
+		const uint8_t* data = static_cast<const uint8_t*>(state.FragmentSpecializationInfo.Data);
+		createData->FragmentSpecializationData.assign(data, data + state.FragmentSpecializationInfo.Size);
+
+		fragmentSpecializationInfo.pData = createData->FragmentSpecializationData.data();
 		fragmentSpecializationInfo.dataSize = state.FragmentSpecializationInfo.Size;
 		fragmentSpecializationInfo.mapEntryCount = (uint32_t)mapEntriesCount;
 		fragmentSpecializationInfo.pMapEntries = fragmentMapEntries.data();
@@ -373,10 +810,10 @@ VulkanGraphicsPipeline::VulkanGraphicsPipeline(const GraphicsPipelineState& stat
 	}
 
 	// Vertex input
-	VkPipelineVertexInputStateCreateInfo vertexInput{};
+	VkPipelineVertexInputStateCreateInfo& vertexInput = createData->VertexInput;
 	vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 
-	std::array<VkVertexInputBindingDescription, 2> vertexInputBindings;
+	std::array<VkVertexInputBindingDescription, 2>& vertexInputBindings = createData->VertexInputBindings;
 	vertexInputBindings[0].binding = 0;
 	vertexInputBindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 	vertexInputBindings[0].stride = 0;
@@ -385,7 +822,8 @@ VulkanGraphicsPipeline::VulkanGraphicsPipeline(const GraphicsPipelineState& stat
 	vertexInputBindings[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
 	vertexInputBindings[1].stride = 0;
 
-	auto vertexAttribs = state.VertexShader->GetInputAttribs();
+	std::vector<VkVertexInputAttributeDescription>& vertexAttribs = createData->VertexAttribs;
+	vertexAttribs = state.VertexShader->GetInputAttribs();
 	if (vertexAttribs.size() > 0)
 	{
 		for (auto& attrib : state.PerInstanceAttribs)
@@ -412,22 +850,35 @@ VulkanGraphicsPipeline::VulkanGraphicsPipeline(const GraphicsPipelineState& stat
 		vertexInput.pVertexAttributeDescriptions = vertexAttribs.data();
 	}
 
-	// Dynamic states
-	std::array dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
-	VkPipelineDynamicStateCreateInfo dynamicStatesCI{};
+	// Dynamic states. Extended ones are set from the state by `VulkanCommandBuffer` once the pipeline is bound
+	const ExtensionSupport& extensionSupport = VulkanContext::GetDevice()->GetPhysicalDevice()->GetExtensionSupport();
+	std::vector<VkDynamicState>& dynamicStates = createData->DynamicStates;
+	dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+	if (extensionSupport.SupportsExtendedDynamicState)
+	{
+		dynamicStates.insert(dynamicStates.end(), { VK_DYNAMIC_STATE_CULL_MODE_EXT, VK_DYNAMIC_STATE_FRONT_FACE_EXT, VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY_EXT,
+			VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE_EXT, VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE_EXT, VK_DYNAMIC_STATE_DEPTH_COMPARE_OP_EXT });
+	}
+	if (extensionSupport.SupportsExtendedDynamicState2)
+		dynamicStates.insert(dynamicStates.end(), { VK_DYNAMIC_STATE_PRIMITIVE_RESTART_ENABLE_EXT, VK_DYNAMIC_STATE_RASTERIZER_DISCARD_ENABLE_EXT });
+#ifdef VK_EXT_extended_dynamic_state3
+	if (extensionSupport.SupportsExtendedDynamicState3 && colorAttachmentsCount)
+		dynamicStates.insert(dynamicStates.end(), { VK_DYNAMIC_STATE_COLOR_BLEND_ENABLE_EXT, VK_DYNAMIC_STATE_COLOR_BLEND_EQUATION_EXT });
+#endif
+	VkPipelineDynamicStateCreateInfo& dynamicStatesCI = createData->DynamicState;
 	dynamicStatesCI.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
 	dynamicStatesCI.dynamicStateCount = (uint32_t)dynamicStates.size();
 	dynamicStatesCI.pDynamicStates = dynamicStates.data();
 
 	// Graphics Pipeline
-	VkGraphicsPipelineCreateInfo pipelineCI{};
+	VkGraphicsPipelineCreateInfo& pipelineCI = createData->PipelineCI;
 	pipelineCI.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
 	pipelineCI.basePipelineIndex = -1;
-	pipelineCI.basePipelineHandle = parentPipeline ? parentPipeline->m_GraphicsPipeline : VK_NULL_HANDLE;
-	pipelineCI.layout = m_PipelineLayout;
+	pipelineCI.layout = pipelineLayout;
 	pipelineCI.stageCount = (uint32_t)stages.size();
 	pipelineCI.pStages = stages.data();
-	pipelineCI.renderPass = m_RenderPass;
+	pipelineCI.renderPass = renderPass;
+	pipelineCI.pNext = renderPass ? nullptr : &createData->Rendering;
 	pipelineCI.pVertexInputState = &vertexInput;
 	pipelineCI.pInputAssemblyState = &inputAssembly;
 	pipelineCI.pRasterizationState = &rasterization;
@@ -437,22 +888,107 @@ VulkanGraphicsPipeline::VulkanGraphicsPipeline(const GraphicsPipelineState& stat
 	pipelineCI.pMultisampleState = &multisampling;
 	pipelineCI.pDynamicState = &dynamicStatesCI;
 
-	VK_CHECK(vkCreateGraphicsPipelines(device, VulkanPipelineCache::GetCache(), 1, &pipelineCI, nullptr, &m_GraphicsPipeline));
+	return createData;
+}
+
+VulkanGraphicsPipeline::VulkanGraphicsPipeline(const GraphicsPipelineState& state, const AttachmentFormats& formats, const VulkanGraphicsPipeline* parentPipeline)
+	: m_State(state)
+{
+	assert(state.VertexShader->GetType() == ShaderType::Vertex);
+	assert(state.FragmentShader->GetType() == ShaderType::Fragment);
+	if (state.GeometryShader)
+		assert(state.GeometryShader->GetType() == ShaderType::Geometry);
+	assert(formats.ColorAttachments.size() == state.ColorAttachments.size() && formats.ResolveAttachments.size() == state.ResolveAttachments.size());
+
+	const VkDevice device = VulkanContext::GetDevice()->GetVulkanDevice();
+	const ExtensionSupport& extensionSupport = VulkanContext::GetDevice()->GetPhysicalDevice()->GetExtensionSupport();
+	if (state.bEnableConservativeRasterization && !extensionSupport.SupportsConservativeRasterization)
+		std::cerr << "[Renderer::WARN] Conservation rasterization was requested but device doesn't support it. So it was not enabled\n";
+
+	// Pipeline layout
+	std::vector<const VulkanShader*> shaders = { state.VertexShader };
+	if (state.GeometryShader)
+		shaders.push_back(state.GeometryShader);
+	shaders.push_back(state.FragmentShader);
+	AcquireLayout(VK_PIPELINE_BIND_POINT_GRAPHICS, shaders, state.PushDescriptorSet);
+
+	// With dynamic rendering, pipeline only depends on attachment formats. Images are supplied when rendering begins
+	if (!extensionSupport.SupportsDynamicRendering)
+		m_RenderPass = AcquireRenderPass(state, formats);
+
+	const VulkanImage* depthStencilImage = state.DepthStencilAttachment.Image;
+	if (state.ColorAttachments.size() && state.ColorAttachments[0].Image)
+	{
+		auto& size = state.ColorAttachments[0].Image->GetSize();
+		m_Width  = size.x;
+		m_Height = size.y;
+	}
+	else if (depthStencilImage)
+	{
+		auto& size = depthStencilImage->GetSize();
+		m_Width  = size.x;
+		m_Height = size.y;
+	}
+	else
+	{
+		m_Width = m_Height = 0;
+	}
+
+	if (m_RenderPass)
+		CreateFramebuffer();
+
+	const bool bConservativeRasterization = state.bEnableConservativeRasterization && extensionSupport.SupportsConservativeRasterization;
+	const VkPipelineLayout pipelineLayout = GetVulkanPipelineLayout();
+	m_PipelineKey = MakePipelineKey(GraphicsPipelineKeyType::Complete, state, formats, m_RenderPass, pipelineLayout, bConservativeRasterization);
+	if (state.bUseLibraries && extensionSupport.SupportsGraphicsPipelineLibrary)
+	{
+		LinkLibraries(formats, bConservativeRasterization);
+		return;
+	}
+
+	// Create infos are only filled if the pipeline is not registered yet
+	m_GraphicsPipeline = VulkanPipelineRegistry::AcquirePipeline(m_PipelineKey, [this, device, &formats, pipelineLayout, parentPipeline]()
+	{
+		std::shared_ptr<GraphicsPipelineCreateData> createData = MakeCreateData(m_State, formats, pipelineLayout, m_RenderPass);
+		std::shared_future<VkPipeline> parent = parentPipeline ? parentPipeline->m_GraphicsPipeline : std::shared_future<VkPipeline>();
+		return VulkanPipelineCompiler::Submit([device, createData, parent](VkPipelineCache cache)
+		{
+			VkGraphicsPipelineCreateInfo& pipelineCI = createData->PipelineCI;
+			pipelineCI.basePipelineHandle = parent.valid() ? parent.get() : VK_NULL_HANDLE;
+
+			VkPipeline pipeline = VK_NULL_HANDLE;
+			VK_CHECK(vkCreateGraphicsPipelines(device, cache, 1, &pipelineCI, nullptr, &pipeline));
+			return pipeline;
+		});
+	});
 }
 
 VulkanGraphicsPipeline::~VulkanGraphicsPipeline()
 {
 	VkDevice device = VulkanContext::GetDevice()->GetVulkanDevice();
 
-	vkDestroyPipeline(device, m_GraphicsPipeline, nullptr);
-	vkDestroyRenderPass(device, m_RenderPass, nullptr);
+	VulkanPipelineRegistry::ReleasePipeline(m_PipelineKey);
+	if (m_FastLinkedPipeline.valid())
+		VulkanPipelineRegistry::ReleasePipeline(m_FastLinkedPipelineKey);
+
+	// Links can still be running on workers, so libraries are released once they're done
+	if (!m_LibraryKeys.empty())
+	{
+		VulkanPipelineCompiler::RunWhenCompiled({ m_GraphicsPipeline, m_FastLinkedPipeline }, [libraryKeys = std::move(m_LibraryKeys)]()
+		{
+			for (auto& key : libraryKeys)
+				VulkanPipelineRegistry::ReleasePipeline(key);
+		});
+	}
+	if (m_RenderPass)
+		VulkanPipelineRegistry::ReleaseRenderPass(m_RenderPass);
 	vkDestroyFramebuffer(device, m_Framebuffer, nullptr);
-	vkDestroyPipelineLayout(device, m_PipelineLayout, nullptr);
 
-	m_GraphicsPipeline = VK_NULL_HANDLE;
+	m_GraphicsPipeline = {};
+	m_FastLinkedPipeline = {};
+	m_LibraryKeys.clear();
 	m_RenderPass = VK_NULL_HANDLE;
 	m_Framebuffer = VK_NULL_HANDLE;
-	m_PipelineLayout = VK_NULL_HANDLE;
 }
 
 void VulkanGraphicsPipeline::Resize(uint32_t width, uint32_t height)
@@ -460,35 +996,200 @@ void VulkanGraphicsPipeline::Resize(uint32_t width, uint32_t height)
 	m_Width = width;
 	m_Height = height;
 
+	// Nothing references the images with dynamic rendering
+	if (!m_RenderPass)
+		return;
+
 	VkDevice device = VulkanContext::GetDevice()->GetVulkanDevice();
 	
 	if (m_Framebuffer)
 		vkDestroyFramebuffer(device, m_Framebuffer, nullptr);
+	m_Framebuffer = VK_NULL_HANDLE;
 
-	std::vector<VkImageView> attachmentsImageViews;
-	attachmentsImageViews.reserve(m_State.ColorAttachments.size());
-	for (size_t i = 0; i < m_State.ColorAttachments.size(); ++i)
+	CreateFramebuffer();
+}
+
+#ifdef VK_EXT_graphics_pipeline_library
+// Points library create infos to the parts of `PipelineCI` that belong to them
+static void InitLibraryCreateInfos(GraphicsPipelineCreateData& createData)
+{
+	static constexpr VkGraphicsPipelineLibraryFlagsEXT libraryFlags[] =
 	{
-		const VulkanImage* renderTarget = m_State.ColorAttachments[i].Image;
-		if (!renderTarget)
-			continue;
+		VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT,
+		VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT,
+		VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT,
+		VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT
+	};
 
-		attachmentsImageViews.push_back(renderTarget->GetVulkanImageView());
+	const VkGraphicsPipelineCreateInfo& pipelineCI = createData.PipelineCI;
+	for (size_t i = 0; i < size_t(GraphicsPipelineLibrary::Count); ++i)
+	{
+		VkGraphicsPipelineLibraryCreateInfoEXT& libraryInfo = createData.LibraryInfos[i];
+		libraryInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+		libraryInfo.flags = libraryFlags[i];
+		// Everything except vertex input depends on attachments
+		if (!pipelineCI.renderPass && i != size_t(GraphicsPipelineLibrary::VertexInput))
+			libraryInfo.pNext = &createData.Rendering;
+
+		VkGraphicsPipelineCreateInfo& libraryCI = createData.LibraryCIs[i];
+		libraryCI.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		libraryCI.pNext = &libraryInfo;
+		libraryCI.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+		libraryCI.basePipelineIndex = -1;
+		libraryCI.pDynamicState = pipelineCI.pDynamicState;
 	}
 
-	for (size_t i = 0; i < m_State.ResolveAttachments.size(); ++i)
+	for (auto& stage : createData.Stages)
+		if (stage.stage != VK_SHADER_STAGE_FRAGMENT_BIT)
+			createData.PreRasterizationStages.push_back(stage);
+
+	VkGraphicsPipelineCreateInfo& vertexInputCI = createData.LibraryCIs[size_t(GraphicsPipelineLibrary::VertexInput)];
+	vertexInputCI.pVertexInputState = pipelineCI.pVertexInputState;
+	vertexInputCI.pInputAssemblyState = pipelineCI.pInputAssemblyState;
+
+	VkGraphicsPipelineCreateInfo& preRasterizationCI = createData.LibraryCIs[size_t(GraphicsPipelineLibrary::PreRasterization)];
+	preRasterizationCI.stageCount = (uint32_t)createData.PreRasterizationStages.size();
+	preRasterizationCI.pStages = createData.PreRasterizationStages.data();
+	preRasterizationCI.pViewportState = pipelineCI.pViewportState;
+	preRasterizationCI.pRasterizationState = pipelineCI.pRasterizationState;
+	preRasterizationCI.layout = pipelineCI.layout;
+	preRasterizationCI.renderPass = pipelineCI.renderPass;
+
+	VkGraphicsPipelineCreateInfo& fragmentShaderCI = createData.LibraryCIs[size_t(GraphicsPipelineLibrary::FragmentShader)];
+	fragmentShaderCI.stageCount = 1;
+	fragmentShaderCI.pStages = &createData.Stages[1];
+	fragmentShaderCI.pDepthStencilState = pipelineCI.pDepthStencilState;
+	fragmentShaderCI.pMultisampleState = pipelineCI.pMultisampleState;
+	fragmentShaderCI.layout = pipelineCI.layout;
+	fragmentShaderCI.renderPass = pipelineCI.renderPass;
+
+	VkGraphicsPipelineCreateInfo& fragmentOutputCI = createData.LibraryCIs[size_t(GraphicsPipelineLibrary::FragmentOutput)];
+	fragmentOutputCI.pColorBlendState = pipelineCI.pColorBlendState;
+	fragmentOutputCI.pMultisampleState = pipelineCI.pMultisampleState;
+	fragmentOutputCI.renderPass = pipelineCI.renderPass;
+}
+
+// Libraries are submitted before the links that wait for them, so workers never wait for a job that is queued after theirs
+static std::shared_future<VkPipeline> SubmitLink(VkDevice device, const std::shared_ptr<GraphicsPipelineCreateData>& createData,
+	const std::array<std::shared_future<VkPipeline>, size_t(GraphicsPipelineLibrary::Count)>& libraries, bool bOptimize)
+{
+	return VulkanPipelineCompiler::Submit([device, createData, libraries, bOptimize](VkPipelineCache cache)
 	{
-		const VulkanImage* renderTarget = m_State.ResolveAttachments[i].Image;
-		if (!renderTarget)
-			continue;
+		std::array<VkPipeline, size_t(GraphicsPipelineLibrary::Count)> libraryHandles;
+		for (size_t i = 0; i < libraries.size(); ++i)
+			libraryHandles[i] = libraries[i].get();
+
+		VkPipelineLibraryCreateInfoKHR libraryCI{};
+		libraryCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+		libraryCI.libraryCount = (uint32_t)libraryHandles.size();
+		libraryCI.pLibraries = libraryHandles.data();
+
+		VkGraphicsPipelineCreateInfo pipelineCI{};
+		pipelineCI.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipelineCI.pNext = &libraryCI;
+		pipelineCI.flags = bOptimize ? VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT : 0;
+		pipelineCI.basePipelineIndex = -1;
+		pipelineCI.layout = createData->PipelineCI.layout;
+		pipelineCI.renderPass = createData->PipelineCI.renderPass;
+
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		VK_CHECK(vkCreateGraphicsPipelines(device, cache, 1, &pipelineCI, nullptr, &pipeline));
+		return pipeline;
+	});
+}
+#endif
+
+void VulkanGraphicsPipeline::LinkLibraries(const AttachmentFormats& formats, bool bConservativeRasterization)
+{
+#ifdef VK_EXT_graphics_pipeline_library
+	const VkDevice device = VulkanContext::GetDevice()->GetVulkanDevice();
+
+	const VkPipelineLayout pipelineLayout = GetVulkanPipelineLayout();
+
+	// Create infos are shared by all jobs of the pipeline and are only filled if something has to be compiled
+	std::shared_ptr<GraphicsPipelineCreateData> createData;
+	auto getCreateData = [this, &createData, &formats, pipelineLayout]() -> const std::shared_ptr<GraphicsPipelineCreateData>&
+	{
+		if (!createData)
+		{
+			createData = MakeCreateData(m_State, formats, pipelineLayout, m_RenderPass);
+			InitLibraryCreateInfos(*createData);
+		}
+		return createData;
+	};
+
+	// Optimized pipeline is equivalent to a complete one, so it's shared with pipelines that don't use libraries.
+	// If it's compiled already, there's nothing to link
+	std::shared_future<VkPipeline> optimized = VulkanPipelineRegistry::FindPipeline(m_PipelineKey);
+	if (optimized.valid() && optimized.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+	{
+		m_GraphicsPipeline = VulkanPipelineRegistry::AcquirePipeline(m_PipelineKey, [&optimized]() { return optimized; });
+		return;
+	}
+
+	// Libraries and the fast link are acquired by every pipeline object, so pipelines whose optimized pipeline is still compiling don't wait for it
+	std::array<std::shared_future<VkPipeline>, size_t(GraphicsPipelineLibrary::Count)> libraries;
+	for (size_t i = 0; i < libraries.size(); ++i)
+	{
+		m_LibraryKeys.push_back(MakeLibraryKey(GraphicsPipelineLibrary(i), m_State, formats, m_RenderPass, pipelineLayout, bConservativeRasterization));
+		libraries[i] = VulkanPipelineRegistry::AcquirePipeline(m_LibraryKeys.back(), [device, &getCreateData, i]()
+		{
+			return VulkanPipelineCompiler::Submit([device, createData = getCreateData(), i](VkPipelineCache cache)
+			{
+				VkPipeline library = VK_NULL_HANDLE;
+				VK_CHECK(vkCreateGraphicsPipelines(device, cache, 1, &createData->LibraryCIs[i], nullptr, &library));
+				return library;
+			});
+		});
+	}
+
+	m_FastLinkedPipelineKey = MakePipelineKey(GraphicsPipelineKeyType::FastLinked, m_State, formats, m_RenderPass, pipelineLayout, bConservativeRasterization);
+	m_FastLinkedPipeline = VulkanPipelineRegistry::AcquirePipeline(m_FastLinkedPipelineKey, [device, &getCreateData, &libraries]()
+	{
+		return SubmitLink(device, getCreateData(), libraries, false);
+	});
+
+	// Submitted after the fast link so it doesn't delay it
+	m_GraphicsPipeline = VulkanPipelineRegistry::AcquirePipeline(m_PipelineKey, [device, &getCreateData, &libraries]()
+	{
+		return SubmitLink(device, getCreateData(), libraries, true);
+	});
+#else
+	assert(!"Graphics pipeline libraries are not supported");
+#endif
+}
 
-		attachmentsImageViews.push_back(renderTarget->GetVulkanImageView());
+void VulkanGraphicsPipeline::CreateFramebuffer()
+{
+	std::vector<VkImageView> attachmentsImageViews;
+	attachmentsImageViews.reserve(m_State.ColorAttachments.size());
+	for (auto& attachment : m_State.ColorAttachments)
+	{
+		if (const VulkanImage* renderTarget = attachment.Image)
+		{
+			assert(renderTarget->HasUsage(ImageUsage::ColorAttachment));
+			attachmentsImageViews.push_back(renderTarget->GetVulkanImageView());
+		}
 	}
 
-	VkPipelineDepthStencilStateCreateInfo depthStencilCI = s_DefaultDepthStencilCI;
-	const VulkanImage* depthStencilImage = m_State.DepthStencilAttachment.Image;
-	if (depthStencilImage)
+	for (auto& attachment : m_State.ResolveAttachments)
+	{
+		if (const VulkanImage* renderTarget = attachment.Image)
+		{
+			assert(renderTarget->HasUsage(ImageUsage::ColorAttachment));
+			attachmentsImageViews.push_back(renderTarget->GetVulkanImageView());
+		}
+	}
+
+	if (const VulkanImage* depthStencilImage = m_State.DepthStencilAttachment.Image)
+	{
+		assert(depthStencilImage->HasUsage(ImageUsage::DepthStencilAttachment));
 		attachmentsImageViews.push_back(depthStencilImage->GetVulkanImageView());
+	}
+
+	// Pipelines without images have no framebuffer
+	if (attachmentsImageViews.empty())
+		return;
 
 	VkFramebufferCreateInfo framebufferCI{};
 	framebufferCI.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
@@ -498,5 +1199,110 @@ void VulkanGraphicsPipeline::Resize(uint32_t width, uint32_t height)
 	framebufferCI.height = m_Height;
 	framebufferCI.layers = 1;
 	framebufferCI.pAttachments = attachmentsImageViews.data();
-	VK_CHECK(vkCreateFramebuffer(device, &framebufferCI, nullptr, &m_Framebuffer));
+	VK_CHECK(vkCreateFramebuffer(VulkanContext::GetDevice()->GetVulkanDevice(), &framebufferCI, nullptr, &m_Framebuffer));
+}
+
+VulkanGraphicsPipeline* VulkanGraphicsPipeline::RequestAsync(const GraphicsPipelineState& state, const VulkanGraphicsPipeline* fallbackPipeline)
+{
+	VulkanGraphicsPipeline* pipeline = new VulkanGraphicsPipeline(state);
+	if (fallbackPipeline)
+	{
+		assert(fallbackPipeline->m_RenderPass == pipeline->m_RenderPass);
+		assert(fallbackPipeline->GetVulkanPipelineLayout() == pipeline->GetVulkanPipelineLayout());
+	}
+
+	pipeline->m_bAsync = true;
+	pipeline->m_FallbackPipeline = fallbackPipeline;
+	return pipeline;
+}
+
+void VulkanGraphicsPipeline::RecordUsage() const
+{
+	if (!m_bRecordUsage)
+		return;
+
+	m_bRecordUsage = false;
+	VulkanPipelineRegistry::RecordUsage(MakeDescription(m_State, GetAttachmentFormats(m_State)));
+}
+
+VkPipeline VulkanGraphicsPipeline::GetPipelineToBind() const
+{
+	if (IsReady())
+		return GetVulkanPipeline();
+
+	// Until the optimized pipeline is linked, the fast-linked one is used
+	if (m_FastLinkedPipeline.valid())
+	{
+		if (!m_bAsync || m_FastLinkedPipeline.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+			return m_FastLinkedPipeline.get();
+	}
+	else if (!m_bAsync)
+		return GetVulkanPipeline();
+
+	if (m_FallbackPipeline && m_FallbackPipeline->IsReady())
+		return m_FallbackPipeline->GetVulkanPipeline();
+
+	return VK_NULL_HANDLE;
+}
+
+void VulkanGraphicsPipeline::WarmUp()
+{
+	std::vector<PipelineKey> recorded = VulkanPipelineRegistry::GetRecordedDescriptions();
+	if (recorded.empty())
+		return;
+
+	// Shaders can take long to compile, so they're loaded on a background thread and pipelines are created by `UpdateWarmUp` once they're loaded
+	s_WarmUpDescriptions = std::async(std::launch::async, [recorded = std::move(recorded)]()
+	{
+		// Reserved since specialization infos point into descriptions, so they must not be moved
+		std::vector<GraphicsPipelineDescription> descriptions;
+		descriptions.reserve(recorded.size());
+		for (auto& data : recorded)
+		{
+			GraphicsPipelineDescription& description = descriptions.emplace_back();
+			if (!ReadDescription(data, description))
+			{
+				descriptions.pop_back();
+				continue;
+			}
+
+			GraphicsPipelineState& state = description.State;
+			state.VertexShader = GetWarmUpShader(description.Shaders[0], ShaderType::Vertex);
+			state.FragmentShader = GetWarmUpShader(description.Shaders[1], ShaderType::Fragment);
+			state.GeometryShader = GetWarmUpShader(description.Shaders[2], ShaderType::Geometry);
+
+			// Shader files were removed since the description was recorded
+			if (!state.VertexShader || !state.FragmentShader || (!description.Shaders[2].Path.empty() && !state.GeometryShader))
+				descriptions.pop_back();
+		}
+		return descriptions;
+	});
+}
+
+void VulkanGraphicsPipeline::UpdateWarmUp()
+{
+	if (!s_WarmUpDescriptions.valid() || s_WarmUpDescriptions.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		return;
+
+	// Moving the vector keeps its elements in place, so specialization infos stay valid
+	s_WarmUpPipelineDescriptions = s_WarmUpDescriptions.get();
+	for (auto& description : s_WarmUpPipelineDescriptions)
+		s_WarmUpPipelines.push_back(new VulkanGraphicsPipeline(description.State, description.Formats, nullptr));
+}
+
+void VulkanGraphicsPipeline::ReleaseWarmUpPipelines()
+{
+	// Shaders can't be deleted while they're still loading
+	if (s_WarmUpDescriptions.valid())
+		s_WarmUpDescriptions.wait();
+	s_WarmUpDescriptions = {};
+
+	for (auto& pipeline : s_WarmUpPipelines)
+		delete pipeline;
+	s_WarmUpPipelines.clear();
+	s_WarmUpPipelineDescriptions.clear();
+
+	for (auto& [name, shader] : s_WarmUpShaders)
+		delete shader;
+	s_WarmUpShaders.clear();
 }
@@ -4,10 +4,14 @@
 #include "VulkanUtils.h"
 #include "VulkanShader.h"
 #include "VulkanPipeline.h"
+#include "VulkanPipelineRegistry.h"
 
 #include <glm/glm.hpp>
 #include <vector>
 #include <unordered_map>
+#include <future>
+#include <chrono>
+#include <memory>
 
 struct Attachment
 {
@@ -54,8 +58,11 @@ public:
 	DepthStencilAttachment DepthStencilAttachment;
 	Topology Topology = Topology::Triangles;
 	CullMode CullMode = CullMode::None;
+	FrontFace FrontFace = FrontFace::CounterClockwise;
 	float LineWidth = 1.0f;
 	bool bEnableConservativeRasterization = false;
+	uint32_t PushDescriptorSet = uint32_t(-1); // Optional. Set that is pushed into the command buffer instead of being allocated. Falls back to a regular set if push descriptors are not supported
+	bool bUseLibraries = false; // Optional. Parts of the pipeline are compiled as libraries shared with other pipelines and fast-linked. Ignored if graphics pipeline libraries are not supported
 
 	SamplesCount GetSamplesCount() const
 	{
@@ -86,6 +93,30 @@ private:
 	static constexpr SamplesCount s_InvalidSamplesCount = static_cast<SamplesCount>(-1);
 };
 
+// Describes attachments of a pipeline without referencing images
+struct AttachmentFormat
+{
+	VkFormat Format = VK_FORMAT_UNDEFINED; // Undefined if the attachment is not used
+	SamplesCount Samples = SamplesCount::Samples1;
+	bool bTransient = false;
+};
+
+struct AttachmentFormats
+{
+	std::vector<AttachmentFormat> ColorAttachments;
+	std::vector<AttachmentFormat> ResolveAttachments;
+	AttachmentFormat DepthStencilAttachment;
+};
+
+// Images that rendering begins with. Null images are not used. Requires dynamic rendering
+struct RenderingAttachments
+{
+	std::vector<VulkanImage*> ColorAttachments;
+	std::vector<VulkanImage*> ResolveAttachments; // Optional
+	VulkanImage* DepthStencilAttachment = nullptr;
+};
+
+struct GraphicsPipelineCreateData;
 class VulkanGraphicsPipeline : public VulkanPipeline
 {
 public:
@@ -96,24 +127,63 @@ public:
 	VulkanGraphicsPipeline& operator= (const VulkanGraphicsPipeline&) = delete;
 
 	const GraphicsPipelineState& GetState() const { return m_State; }
+	// Null if dynamic rendering is used
 	const void* GetRenderPassHandle() const { return m_RenderPass; }
 
+	// Pipelines are compiled on `VulkanPipelineCompiler` workers. Waits if the pipeline is not compiled yet.
+	// With libraries, it's the optimized pipeline that is linked after the fast-linked one
+	VkPipeline GetVulkanPipeline() const { return m_GraphicsPipeline.get(); }
+	bool IsReady() const { return m_GraphicsPipeline.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }
+
+	// Unlike the constructor, the returned pipeline never stalls command recording.
+	// Until it's compiled, draws use `fallbackPipeline` if it's ready, or are skipped otherwise.
+	// Fallback pipeline must have the same attachments and pipeline layout
+	static VulkanGraphicsPipeline* RequestAsync(const GraphicsPipelineState& state, const VulkanGraphicsPipeline* fallbackPipeline = nullptr);
+
 	uint32_t GetWidth() const { return m_Width; }
 	uint32_t GetHeight() const { return m_Height; }
 
-	// Resizes framebuffer
+	// Resizes framebuffer. With dynamic rendering there's no framebuffer and attachments are taken as is when rendering begins
 	void Resize(uint32_t width, uint32_t height);
 
-	virtual VkPipelineLayout GetVulkanPipelineLayout() const override { return m_PipelineLayout; }
+	// Compiles pipelines recorded by previous sessions on `VulkanPipelineCompiler` workers, most used first.
+	// They're kept in `VulkanPipelineRegistry` until `ReleaseWarmUpPipelines`, so matching requests don't compile anything.
+	// Shaders of the pipelines are loaded on a background thread and `UpdateWarmUp` submits the pipelines once they're loaded
+	static void WarmUp();
+	static void UpdateWarmUp(); // Should be called once per frame
+	static void ReleaseWarmUpPipelines();
+
+private:
+	// Attachment images of `state` are optional. Pipelines without them have no framebuffer
+	VulkanGraphicsPipeline(const GraphicsPipelineState& state, const AttachmentFormats& formats, const VulkanGraphicsPipeline* parentPipeline);
+
+	// Creates a framebuffer from attachment images of the state. Not used with dynamic rendering
+	void CreateFramebuffer();
+
+	// Returns the pipeline that should be bound instead of this one. Null if draws should be skipped
+	VkPipeline GetPipelineToBind() const;
+
+	// Compiles the parts of the pipeline as libraries and links them twice: fast first, then optimized in the background.
+	// Libraries and links are shared through `VulkanPipelineRegistry`, so only missing ones are compiled. If the optimized pipeline is compiled already, nothing is linked
+	void LinkLibraries(const AttachmentFormats& formats, bool bConservativeRasterization);
+
+	// Records the description of the pipeline in `VulkanPipelineRegistry` on its first bind, so the next session can warm it up
+	void RecordUsage() const;
 
 private:
 	GraphicsPipelineState m_State;
-	VkPipeline m_GraphicsPipeline = VK_NULL_HANDLE;
-	VkRenderPass m_RenderPass = VK_NULL_HANDLE;
+	PipelineKey m_PipelineKey;
+	std::shared_future<VkPipeline> m_GraphicsPipeline;
+	PipelineKey m_FastLinkedPipelineKey;
+	std::shared_future<VkPipeline> m_FastLinkedPipeline; // Bound until `m_GraphicsPipeline` is ready. Invalid if libraries are not used or the optimized pipeline was compiled already
+	std::vector<PipelineKey> m_LibraryKeys;
+	const VulkanGraphicsPipeline* m_FallbackPipeline = nullptr;
+	VkRenderPass m_RenderPass = VK_NULL_HANDLE; // Null if dynamic rendering is used
 	VkFramebuffer m_Framebuffer = VK_NULL_HANDLE;
-	VkPipelineLayout m_PipelineLayout = VK_NULL_HANDLE;
 	uint32_t m_Width;
 	uint32_t m_Height;
+	bool m_bAsync = false; // If set, command buffers don't wait for the pipeline
+	mutable bool m_bRecordUsage = false; // Cleared once the usage is recorded. Never set for warm-up pipelines
 
 	friend class VulkanCommandBuffer;
 };
@@ -3,9 +3,13 @@
 #include "VulkanAllocator.h"
 #include "VulkanUtils.h"
 #include "VulkanCommandManager.h"
+#include "VulkanStagingManager.h"
+#include "VulkanPipeline.h"
 
 #include "../Renderer/Renderer.h"
 
+#include <algorithm>
+
 VulkanImage::VulkanImage(const ImageSpecifications& specs, const std::string& debugName)
 	: m_DebugName(debugName)
 	, m_Specs(specs)
@@ -56,13 +60,8 @@ VkImageAspectFlags VulkanImage::GetTransitionAspectMask(ImageLayout oldLayout, I
 	return m_AspectMask;
 }
 
-void VulkanImage::CreateImage()
+VkImageCreateInfo VulkanImage::GetImageCreateInfo() const
 {
-	assert(m_bOwns);
-	assert(m_Image == VK_NULL_HANDLE);
-
-	m_VulkanFormat = ImageFormatToVulkan(m_Specs.Format);
-	m_AspectMask = GetImageAspectFlags(m_VulkanFormat);
 	VkImageCreateInfo info{};
 	info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
 	info.imageType = ImageTypeToVulkan(m_Specs.Type);
@@ -76,17 +75,29 @@ void VulkanImage::CreateImage()
 	info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 	info.flags |= m_Specs.bIsCube ? VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT : 0;
 
-	// This is a workaround for Vulkan Memory Allocator issue
-	// The problem here is when all MemoryType::kGpu memory is allocated, the Allocator begins to put images in memory of other MemoryTypes.
-	// It leads to Image and and mappable Buffers to be bound to the same VkDeviceMemory.
-	// When vmaMapMemory() is called, vkMapMemory() with called for VkDeviceMemory with size = VK_WHOLE_SIZE. 
-	// It could lead to device lost if VkImage is not in layout VK_IMAGE_LAYOUT_GENERAL.
-	// Workarounding the issue by allocating each VkImage in its own VkDeviceMemory, so that mapping buffers can't result in mapping memory bound to VkImage.
-	constexpr bool separateAllocation = true;
-	m_Allocation = VulkanAllocator::AllocateImage(&info, m_Specs.MemoryType, separateAllocation, &m_Image);
+	return info;
+}
+
+void VulkanImage::CreateImage()
+{
+	assert(m_bOwns);
+	assert(m_Image == VK_NULL_HANDLE);
+
+	m_VulkanFormat = ImageFormatToVulkan(m_Specs.Format);
+	m_AspectMask = GetImageAspectFlags(m_VulkanFormat);
+	VkImageCreateInfo info = GetImageCreateInfo();
+
+	// Optimal-tiling images are sub-allocated from the image pools that are never shared with mappable buffers.
+	// Linear images are mappable themselves, so they get their own VkDeviceMemory
+	const bool bSeparateAllocation = info.tiling == VK_IMAGE_TILING_LINEAR;
+	const GPUMemoryCategory category = HasUsage(ImageUsage::ColorAttachment) || HasUsage(ImageUsage::DepthStencilAttachment) ? GPUMemoryCategory::RenderTarget : GPUMemoryCategory::Texture;
+	m_Allocation = VulkanAllocator::AllocateImage(&info, m_Specs.MemoryType, category, bSeparateAllocation, &m_Image, m_DebugName);
 	
 	if (!m_DebugName.empty())
 		VulkanContext::AddResourceDebugName(m_Image, m_DebugName, VK_OBJECT_TYPE_IMAGE);
+
+	if (IsMovable())
+		VulkanAllocator::SetDefragmentable(m_Allocation, this);
 }
 
 void VulkanImage::ReleaseImage()
@@ -169,11 +180,126 @@ void VulkanImage::Unmap()
 	VulkanAllocator::UnmapMemory(m_Allocation);
 }
 
+void VulkanImage::Read(void* data, size_t size, ImageLayout initialLayout, ImageLayout finalLayout)
+{
+	// Blocking. Use `VulkanCommandBuffer::Read` to read asynchronously
+	Ref<VulkanFence> fence = MakeRef<VulkanFence>();
+	auto commandManager = Renderer::GetGraphicsCommandManager();
+	auto cmd = commandManager->AllocateCommandBuffer();
+	Ref<VulkanReadbackFuture> readback = cmd.Read(this, initialLayout, finalLayout);
+	cmd.End();
+	commandManager->Submit(&cmd, 1, fence, nullptr, 0, nullptr, 0);
+
+	assert(size <= readback->GetSize());
+	readback->Get(data, size);
+}
+
 void VulkanImage::ReleaseImageView()
 {
 	for (auto& view : m_Views)
+	{
+		VulkanPipeline::OnResourceReleased(view.second);
 		vkDestroyImageView(m_Device, view.second, nullptr);
+	}
 
 	m_Views.clear();
 	m_DefaultImageView = VK_NULL_HANDLE;
 }
+
+bool VulkanImage::BeginMove(VulkanCommandBuffer& cmd, VmaAllocation dstAllocation)
+{
+	VkImageCreateInfo info = GetImageCreateInfo();
+	VkImage newImage = VK_NULL_HANDLE;
+	if (vkCreateImage(m_Device, &info, nullptr, &newImage) != VK_SUCCESS)
+		return false;
+	VulkanAllocator::BindImageMemory(dstAllocation, newImage);
+
+	// Contents of an image in an unknown layout don't need to be preserved
+	const VkImageLayout vkLayout = ImageLayoutToVulkan(m_Specs.Layout);
+	if (vkLayout != VK_IMAGE_LAYOUT_UNDEFINED)
+	{
+		VkCommandBuffer vkCmd = cmd.GetVulkanCommandBuffer();
+
+		VkImageMemoryBarrier barriers[2]{};
+		for (auto& barrier : barriers)
+		{
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.subresourceRange.aspectMask = m_AspectMask;
+			barrier.subresourceRange.levelCount = m_Specs.MipsCount;
+			barrier.subresourceRange.layerCount = GetLayersCount();
+		}
+		barriers[0].image = m_Image;
+		barriers[0].oldLayout = vkLayout;
+		barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barriers[0].srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+		barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barriers[1].image = newImage;
+		barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barriers[1].srcAccessMask = 0;
+		barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(vkCmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 2, barriers);
+
+		std::vector<VkImageCopy> regions(m_Specs.MipsCount);
+		for (uint32_t mip = 0; mip < m_Specs.MipsCount; ++mip)
+		{
+			VkImageCopy& region = regions[mip];
+			region.srcSubresource.aspectMask = m_AspectMask;
+			region.srcSubresource.mipLevel = mip;
+			region.srcSubresource.layerCount = GetLayersCount();
+			region.dstSubresource = region.srcSubresource;
+			region.extent.width = std::max(m_Specs.Size.x >> mip, 1u);
+			region.extent.height = std::max(m_Specs.Size.y >> mip, 1u);
+			region.extent.depth = std::max(m_Specs.Size.z >> mip, 1u);
+		}
+		vkCmdCopyImage(vkCmd, m_Image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, newImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, uint32_t(regions.size()), regions.data());
+
+		// Return the new image into the layout that the old one was in
+		barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barriers[1].newLayout = vkLayout;
+		barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barriers[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+		vkCmdPipelineBarrier(vkCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &barriers[1]);
+	}
+
+	if (!m_DebugName.empty())
+	{
+		VulkanContext::RemoveResourceDebugName(m_Image);
+		VulkanContext::AddResourceDebugName(newImage, m_DebugName, VK_OBJECT_TYPE_IMAGE);
+	}
+
+	// Recreate all views that were requested so far for the new image
+	std::unordered_map<VkImageView, VkImageView> movedViews;
+	std::unordered_map<ImageView, VkImageView> oldViews = std::move(m_Views);
+	m_Views.clear();
+
+	m_MovedImage = m_Image;
+	m_Image = newImage;
+	for (auto& view : oldViews)
+	{
+		movedViews[view.second] = GetVulkanImageView(view.first);
+		m_MovedViews.push_back(view.second);
+	}
+	m_DefaultImageView = GetVulkanImageView(GetImageView());
+
+	VulkanPipeline::OnImageMoved(m_MovedImage, m_Image, movedViews);
+	VulkanBindlessHeap::OnImageMoved(movedViews);
+
+	return true;
+}
+
+void VulkanImage::EndMove()
+{
+	for (auto& view : m_MovedViews)
+	{
+		VulkanPipeline::OnResourceReleased(view);
+		vkDestroyImageView(m_Device, view, nullptr);
+	}
+	m_MovedViews.clear();
+
+	if (m_MovedImage)
+		vkDestroyImage(m_Device, m_MovedImage, nullptr);
+	m_MovedImage = VK_NULL_HANDLE;
+}
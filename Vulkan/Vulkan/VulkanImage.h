@@ -5,6 +5,7 @@
 #include "../Renderer/RendererUtils.h"
 
 #include <unordered_map>
+#include <vector>
 #include <string>
 
 #include <glm/glm.hpp>
@@ -22,7 +23,7 @@ struct ImageSpecifications
     bool bIsCube = false;
 };
 
-class VulkanImage
+class VulkanImage : public VulkanDefragmentable
 {
 public:
     VulkanImage(const ImageSpecifications& specs, const std::string& debugName = "");
@@ -59,7 +60,11 @@ public:
     VkImageAspectFlags GetDefaultAspectMask() const { return m_AspectMask; }
     VkImageAspectFlags GetTransitionAspectMask(ImageLayout oldLayout, ImageLayout newLayout) const;
 
+    bool BeginMove(VulkanCommandBuffer& cmd, VmaAllocation dstAllocation) override;
+    void EndMove() override;
+
 private:
+    VkImageCreateInfo GetImageCreateInfo() const;
     void CreateImage();
     void ReleaseImage();
     void CreateImageView();
@@ -67,13 +72,23 @@ private:
 
     void SetImageLayout(ImageLayout layout) { m_Specs.Layout = layout; }
 
+    // Attachments are referenced by framebuffers so they are not moved during defragmentation
+    bool IsMovable() const
+    {
+        return m_bOwns && m_Specs.MemoryType == MemoryType::Gpu
+            && HasUsage(ImageUsage::TransferSrc | ImageUsage::TransferDst)
+            && !HasUsage(ImageUsage::ColorAttachment) && !HasUsage(ImageUsage::DepthStencilAttachment);
+    }
+
 private:
     mutable std::unordered_map<ImageView, VkImageView> m_Views; // Mutable by `GetVulkanImageView(const ImageView&)`
+    std::vector<VkImageView> m_MovedViews; // Views of the image that's being moved from. Destroyed once the move is complete
 
     std::string m_DebugName;
     ImageSpecifications m_Specs;
     VkDevice m_Device = VK_NULL_HANDLE;
     VkImage m_Image = VK_NULL_HANDLE;
+    VkImage m_MovedImage = VK_NULL_HANDLE;
     VkImageView m_DefaultImageView = VK_NULL_HANDLE;
     VmaAllocation m_Allocation = VK_NULL_HANDLE;
     VkFormat m_VulkanFormat = VK_FORMAT_UNDEFINED;
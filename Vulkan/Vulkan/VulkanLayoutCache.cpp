@@ -0,0 +1,199 @@
+#include "VulkanLayoutCache.h"
+#include "VulkanContext.h"
+#include "../Renderer/RendererUtils.h"
+
+#include <unordered_map>
+#include <algorithm>
+
+struct CachedSetLayout
+{
+	std::vector<VkDescriptorSetLayoutBinding> Bindings;
+	VkDescriptorSetLayoutCreateFlags Flags = 0;
+	VkDescriptorSetLayout Layout = VK_NULL_HANDLE;
+	uint32_t RefCount = 0;
+};
+
+struct CachedPipelineLayout
+{
+	std::vector<VkDescriptorSetLayout> SetLayouts;
+	std::vector<VkPushConstantRange> PushConstants;
+	VkPipelineLayout Layout = VK_NULL_HANDLE;
+	uint32_t RefCount = 0;
+};
+
+struct VulkanLayoutCacheData
+{
+	VkDevice Device = VK_NULL_HANDLE;
+	std::unordered_multimap<size_t, CachedSetLayout> SetLayouts; // Hash -> Layout
+	std::unordered_multimap<size_t, CachedPipelineLayout> PipelineLayouts; // Hash -> Layout
+	std::unordered_map<VkDescriptorSetLayout, size_t> SetLayoutHashes;
+	std::unordered_map<VkPipelineLayout, size_t> PipelineLayoutHashes;
+};
+
+static VulkanLayoutCacheData* s_Data = nullptr;
+
+static bool IsSameBinding(const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b)
+{
+	return a.binding == b.binding && a.descriptorType == b.descriptorType && a.descriptorCount == b.descriptorCount
+		&& a.stageFlags == b.stageFlags && a.pImmutableSamplers == b.pImmutableSamplers;
+}
+
+static bool IsSameRange(const VkPushConstantRange& a, const VkPushConstantRange& b)
+{
+	return a.stageFlags == b.stageFlags && a.offset == b.offset && a.size == b.size;
+}
+
+static size_t HashSetLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings, VkDescriptorSetLayoutCreateFlags flags)
+{
+	size_t hash = std::hash<uint32_t>()(flags);
+	for (auto& binding : bindings)
+	{
+		HashCombine(hash, binding.binding);
+		HashCombine(hash, uint32_t(binding.descriptorType));
+		HashCombine(hash, binding.descriptorCount);
+		HashCombine(hash, uint32_t(binding.stageFlags));
+	}
+	return hash;
+}
+
+static size_t HashPipelineLayout(const std::vector<VkDescriptorSetLayout>& setLayouts, const std::vector<VkPushConstantRange>& pushConstants)
+{
+	size_t hash = 0;
+	for (auto& setLayout : setLayouts)
+		HashCombine(hash, setLayout);
+	for (auto& range : pushConstants)
+	{
+		HashCombine(hash, uint32_t(range.stageFlags));
+		HashCombine(hash, range.offset);
+		HashCombine(hash, range.size);
+	}
+	return hash;
+}
+
+void VulkanLayoutCache::Init()
+{
+	assert(!s_Data);
+	s_Data = new VulkanLayoutCacheData();
+	s_Data->Device = VulkanContext::GetDevice()->GetVulkanDevice();
+}
+
+void VulkanLayoutCache::Shutdown()
+{
+	if (!s_Data->PipelineLayouts.empty() || !s_Data->SetLayouts.empty())
+		std::cerr << "[Vulkan layout cache] " << s_Data->PipelineLayouts.size() << " pipeline layouts and " << s_Data->SetLayouts.size() << " set layouts were not released\n";
+
+	for (auto& it : s_Data->PipelineLayouts)
+		vkDestroyPipelineLayout(s_Data->Device, it.second.Layout, nullptr);
+	for (auto& it : s_Data->SetLayouts)
+		vkDestroyDescriptorSetLayout(s_Data->Device, it.second.Layout, nullptr);
+
+	delete s_Data;
+	s_Data = nullptr;
+}
+
+VkDescriptorSetLayout VulkanLayoutCache::AcquireSetLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings, VkDescriptorSetLayoutCreateFlags flags)
+{
+	const size_t hash = HashSetLayout(bindings, flags);
+	auto range = s_Data->SetLayouts.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		if (it->second.Flags == flags && std::equal(bindings.begin(), bindings.end(), it->second.Bindings.begin(), it->second.Bindings.end(), IsSameBinding))
+		{
+			++it->second.RefCount;
+			return it->second.Layout;
+		}
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.flags = flags;
+	layoutInfo.bindingCount = (uint32_t)bindings.size();
+	layoutInfo.pBindings = bindings.data();
+
+	CachedSetLayout cached;
+	cached.Bindings = bindings;
+	cached.Flags = flags;
+	cached.RefCount = 1;
+	VK_CHECK(vkCreateDescriptorSetLayout(s_Data->Device, &layoutInfo, nullptr, &cached.Layout));
+
+	s_Data->SetLayoutHashes[cached.Layout] = hash;
+	return s_Data->SetLayouts.emplace(hash, std::move(cached))->second.Layout;
+}
+
+bool VulkanLayoutCache::ReleaseSetLayout(VkDescriptorSetLayout setLayout)
+{
+	auto hashIt = s_Data->SetLayoutHashes.find(setLayout);
+	assert(hashIt != s_Data->SetLayoutHashes.end());
+
+	auto range = s_Data->SetLayouts.equal_range(hashIt->second);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		if (it->second.Layout != setLayout)
+			continue;
+
+		if (--it->second.RefCount)
+			return false;
+
+		vkDestroyDescriptorSetLayout(s_Data->Device, setLayout, nullptr);
+		s_Data->SetLayouts.erase(it);
+		s_Data->SetLayoutHashes.erase(hashIt);
+		return true;
+	}
+
+	assert(!"Unknown set layout");
+	return false;
+}
+
+VkPipelineLayout VulkanLayoutCache::AcquirePipelineLayout(const std::vector<VkDescriptorSetLayout>& setLayouts, const std::vector<VkPushConstantRange>& pushConstants)
+{
+	const size_t hash = HashPipelineLayout(setLayouts, pushConstants);
+	auto range = s_Data->PipelineLayouts.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		if (it->second.SetLayouts == setLayouts
+			&& std::equal(pushConstants.begin(), pushConstants.end(), it->second.PushConstants.begin(), it->second.PushConstants.end(), IsSameRange))
+		{
+			++it->second.RefCount;
+			return it->second.Layout;
+		}
+	}
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCI{};
+	pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCI.setLayoutCount = (uint32_t)setLayouts.size();
+	pipelineLayoutCI.pSetLayouts = setLayouts.data();
+	pipelineLayoutCI.pushConstantRangeCount = (uint32_t)pushConstants.size();
+	pipelineLayoutCI.pPushConstantRanges = pushConstants.data();
+
+	CachedPipelineLayout cached;
+	cached.SetLayouts = setLayouts;
+	cached.PushConstants = pushConstants;
+	cached.RefCount = 1;
+	VK_CHECK(vkCreatePipelineLayout(s_Data->Device, &pipelineLayoutCI, nullptr, &cached.Layout));
+
+	s_Data->PipelineLayoutHashes[cached.Layout] = hash;
+	return s_Data->PipelineLayouts.emplace(hash, std::move(cached))->second.Layout;
+}
+
+void VulkanLayoutCache::ReleasePipelineLayout(VkPipelineLayout pipelineLayout)
+{
+	auto hashIt = s_Data->PipelineLayoutHashes.find(pipelineLayout);
+	assert(hashIt != s_Data->PipelineLayoutHashes.end());
+
+	auto range = s_Data->PipelineLayouts.equal_range(hashIt->second);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		if (it->second.Layout != pipelineLayout)
+			continue;
+
+		if (--it->second.RefCount == 0)
+		{
+			vkDestroyPipelineLayout(s_Data->Device, pipelineLayout, nullptr);
+			s_Data->PipelineLayouts.erase(it);
+			s_Data->PipelineLayoutHashes.erase(hashIt);
+		}
+		return;
+	}
+
+	assert(!"Unknown pipeline layout");
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "Vulkan.h"
+
+#include <vector>
+
+// Deduplicates descriptor set layouts and pipeline layouts between pipelines.
+// Layouts are reference counted and destroyed once the last pipeline releases them.
+// Pipelines with identical layouts can share descriptor sets
+class VulkanLayoutCache
+{
+public:
+	VulkanLayoutCache() = delete;
+
+	static void Init();
+	static void Shutdown();
+
+	static VkDescriptorSetLayout AcquireSetLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings, VkDescriptorSetLayoutCreateFlags flags);
+	// Returns true if it was the last reference and the layout was destroyed
+	static bool ReleaseSetLayout(VkDescriptorSetLayout setLayout);
+
+	static VkPipelineLayout AcquirePipelineLayout(const std::vector<VkDescriptorSetLayout>& setLayouts, const std::vector<VkPushConstantRange>& pushConstants);
+	static void ReleasePipelineLayout(VkPipelineLayout pipelineLayout);
+};
@@ -1,6 +1,317 @@
 #include "VulkanPipeline.h"
 
 #include "VulkanTexture2D.h"
+#include "VulkanShader.h"
+#include "VulkanUtils.h"
+#include "VulkanLayoutCache.h"
+
+#include <algorithm>
+
+std::unordered_set<VulkanPipeline*> VulkanPipeline::s_Pipelines;
+std::unordered_map<PipelineKey, VulkanPipeline::SharedLayout, PipelineKeyHash> VulkanPipeline::s_Layouts;
+std::unordered_map<VkDescriptorSetLayout, std::unordered_multimap<size_t, VulkanPipeline::CachedDescriptorSet>> VulkanPipeline::s_DescriptorSetCache;
+
+static void MergeDescriptorSetLayoutBindings(std::vector<VkDescriptorSetLayoutBinding>& dstBindings,
+	const std::vector<VkDescriptorSetLayoutBinding>& srcBindings)
+{
+	std::vector<VkDescriptorSetLayoutBinding> newBindings;
+	newBindings.reserve(srcBindings.size());
+
+	auto cmp = [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b)
+	{
+		return a.binding < b.binding;
+	};
+
+	auto dstIt = dstBindings.begin();
+	for (auto& srcBinding : srcBindings)
+	{
+		dstIt = std::lower_bound(dstIt, dstBindings.end(), srcBinding, cmp);
+
+		if (dstIt == dstBindings.end() || dstIt->binding > srcBinding.binding)
+			newBindings.push_back(srcBinding);
+		else
+			dstIt->stageFlags |= srcBinding.stageFlags;
+	}
+
+	dstBindings.insert(dstBindings.end(), newBindings.begin(), newBindings.end());
+	std::sort(dstBindings.begin(), dstBindings.end(), cmp);
+}
+
+static void MergeDescriptorSetLayoutBindings(std::vector<std::vector<VkDescriptorSetLayoutBinding>>& dstSetBindings,
+	const std::vector<std::vector<VkDescriptorSetLayoutBinding>>& srcSetBindings)
+{
+	if (srcSetBindings.size() > dstSetBindings.size())
+		dstSetBindings.resize(srcSetBindings.size());
+
+	for (std::size_t i = 0; i < srcSetBindings.size(); i++)
+		MergeDescriptorSetLayoutBindings(dstSetBindings[i], srcSetBindings[i]);
+}
+
+VulkanPipeline::~VulkanPipeline()
+{
+	s_Pipelines.erase(this);
+	if (m_Layout)
+		ReleaseLayout(m_LayoutKey);
+	m_Layout = nullptr;
+
+	m_TemplatePayloads.clear();
+	m_DescriptorSetData.clear();
+	m_DescriptorSets.clear();
+}
+
+void VulkanPipeline::AcquireLayout(VkPipelineBindPoint bindPoint, const std::vector<const VulkanShader*>& shaders, uint32_t pushDescriptorSet)
+{
+	assert(!m_Layout && !shaders.empty());
+
+	// Binary hash instead of the module, so separately loaded copies of a shader share layouts
+	m_LayoutKey = PipelineKey();
+	m_LayoutKey.Append(bindPoint);
+	m_LayoutKey.Append(pushDescriptorSet);
+	for (auto& shader : shaders)
+		m_LayoutKey.Append(shader->GetBinaryHash());
+
+	SharedLayout& layout = s_Layouts[m_LayoutKey];
+	m_Layout = &layout;
+	if (layout.RefCount++ == 0)
+	{
+		layout.SetBindings = shaders[0]->GeLayoutSetBindings();
+		for (size_t i = 1; i < shaders.size(); ++i)
+			MergeDescriptorSetLayoutBindings(layout.SetBindings, shaders[i]->GeLayoutSetBindings());
+		const uint32_t setsCount = (uint32_t)layout.SetBindings.size();
+		InitPushDescriptorSet(layout, pushDescriptorSet);
+
+		layout.SetLayouts.resize(setsCount);
+		for (uint32_t i = 0; i < setsCount; ++i)
+		{
+			// Bindless heap layout is shared by all pipelines
+			if (i == VulkanBindlessHeap::Set && VulkanBindlessHeap::IsSupported() && !layout.SetBindings[i].empty())
+			{
+				layout.SetLayouts[i] = VulkanBindlessHeap::GetSetLayout();
+				layout.bUsesBindlessHeap = true;
+				continue;
+			}
+
+			const VkDescriptorSetLayoutCreateFlags flags = (i == layout.PushDescriptorSet) ? VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR : 0;
+			layout.SetLayouts[i] = VulkanLayoutCache::AcquireSetLayout(layout.SetBindings[i], flags);
+		}
+
+		std::vector<VkPushConstantRange> pushConstants;
+		for (auto& shader : shaders)
+			for (auto& range : shader->GetPushConstantRanges())
+				pushConstants.push_back(range);
+
+		layout.PipelineLayout = VulkanLayoutCache::AcquirePipelineLayout(layout.SetLayouts, pushConstants);
+		CreateDescriptorUpdateTemplates(layout, bindPoint);
+	}
+
+	m_TemplatePayloads.resize(layout.UpdateTemplates.size());
+	for (size_t i = 0; i < m_TemplatePayloads.size(); ++i)
+		m_TemplatePayloads[i].resize(layout.UpdateTemplates[i].PayloadSize);
+}
+
+void VulkanPipeline::ReleaseLayout(const PipelineKey& key)
+{
+	auto it = s_Layouts.find(key);
+	assert(it != s_Layouts.end());
+	SharedLayout& layout = it->second;
+	if (--layout.RefCount)
+		return;
+
+	VkDevice device = VulkanContext::GetDevice()->GetVulkanDevice();
+	for (auto& updateTemplate : layout.UpdateTemplates)
+		if (updateTemplate.Template)
+			vkDestroyDescriptorUpdateTemplate(device, updateTemplate.Template, nullptr);
+
+	for (uint32_t i = 0; i < (uint32_t)layout.SetLayouts.size(); ++i)
+	{
+		if (layout.bUsesBindlessHeap && i == VulkanBindlessHeap::Set)
+			continue; // Owned by the heap
+
+		// Sets of the layout are not needed once no pipeline uses it
+		if (VulkanLayoutCache::ReleaseSetLayout(layout.SetLayouts[i]))
+			s_DescriptorSetCache.erase(layout.SetLayouts[i]);
+	}
+	VulkanLayoutCache::ReleasePipelineLayout(layout.PipelineLayout);
+
+	s_Layouts.erase(it);
+}
+
+void VulkanPipeline::OnBufferMoved(VkBuffer oldBuffer, VkBuffer newBuffer)
+{
+	for (auto& pipeline : s_Pipelines)
+		for (auto& data : pipeline->m_DescriptorSetData)
+			data.second.ReplaceBuffer(oldBuffer, newBuffer);
+}
+
+void VulkanPipeline::OnImageMoved(VkImage oldImage, VkImage newImage, const std::unordered_map<VkImageView, VkImageView>& views)
+{
+	for (auto& pipeline : s_Pipelines)
+		for (auto& data : pipeline->m_DescriptorSetData)
+			data.second.ReplaceImage(oldImage, newImage, views);
+}
+
+template<typename Handle>
+void VulkanPipeline::DropCachedDescriptorSets(Handle handle)
+{
+	for (auto& layoutCache : s_DescriptorSetCache)
+	{
+		auto& cache = layoutCache.second;
+		for (auto it = cache.begin(); it != cache.end();)
+		{
+			if (!it->second.Data.References(handle))
+			{
+				++it;
+				continue;
+			}
+
+			// Pipelines that use the set are going to reacquire it during the next commit. Set index can differ between pipelines
+			const VulkanDescriptorSet* descriptorSet = &it->second.DescriptorSet;
+			for (auto& pipeline : s_Pipelines)
+			{
+				for (auto currentIt = pipeline->m_DescriptorSets.begin(); currentIt != pipeline->m_DescriptorSets.end();)
+				{
+					if (currentIt->second != descriptorSet)
+					{
+						++currentIt;
+						continue;
+					}
+
+					pipeline->m_DescriptorSetData[currentIt->first].MarkDirty();
+					currentIt = pipeline->m_DescriptorSets.erase(currentIt);
+				}
+			}
+			it = cache.erase(it);
+		}
+	}
+}
+
+void VulkanPipeline::OnResourceReleased(VkBuffer buffer)
+{
+	DropCachedDescriptorSets(buffer);
+}
+
+void VulkanPipeline::OnResourceReleased(VkImageView imageView)
+{
+	DropCachedDescriptorSets(imageView);
+}
+
+void VulkanPipeline::OnResourceReleased(VkSampler sampler)
+{
+	DropCachedDescriptorSets(sampler);
+}
+
+void VulkanPipeline::InitPushDescriptorSet(SharedLayout& layout, uint32_t set)
+{
+	layout.PushDescriptorSet = uint32_t(-1);
+	if (set == uint32_t(-1) || set >= layout.SetBindings.size() || layout.SetBindings[set].empty())
+		return;
+
+	const VulkanPhysicalDevice* physicalDevice = VulkanContext::GetDevice()->GetPhysicalDevice();
+	if (!physicalDevice->GetExtensionSupport().SupportsPushDescriptors)
+		return;
+
+	if (set == VulkanBindlessHeap::Set && VulkanBindlessHeap::IsSupported())
+	{
+		std::cerr << "[Vulkan pipeline] Bindless heap set can't be pushed\n";
+		return;
+	}
+
+	uint32_t descriptorsCount = 0;
+	for (auto& binding : layout.SetBindings[set])
+		descriptorsCount += binding.descriptorCount;
+
+	const uint32_t maxPushDescriptors = physicalDevice->GetPushDescriptorProperties().maxPushDescriptors;
+	if (descriptorsCount > maxPushDescriptors)
+	{
+		std::cerr << "[Vulkan pipeline] Set " << set << " has " << descriptorsCount << " descriptors, push descriptors are limited to " << maxPushDescriptors << ". Using a regular set\n";
+		return;
+	}
+
+	layout.PushDescriptorSet = set;
+}
+
+void VulkanPipeline::CreateDescriptorUpdateTemplates(SharedLayout& layout, VkPipelineBindPoint bindPoint)
+{
+	VkDevice device = VulkanContext::GetDevice()->GetVulkanDevice();
+	const uint32_t setsCount = (uint32_t)layout.SetLayouts.size();
+	layout.UpdateTemplates.resize(setsCount);
+
+	std::vector<VkDescriptorUpdateTemplateEntry> vkEntries;
+	for (uint32_t set = 0; set < setsCount; ++set)
+	{
+		if (layout.SetBindings[set].empty() || (layout.bUsesBindlessHeap && set == VulkanBindlessHeap::Set))
+			continue;
+
+		DescriptorUpdateTemplate& updateTemplate = layout.UpdateTemplates[set];
+		vkEntries.clear();
+
+		size_t payloadSize = 0;
+		for (auto& binding : layout.SetBindings[set])
+		{
+			if (binding.descriptorCount == 0)
+				continue;
+
+			const size_t stride = IsBufferType(binding.descriptorType) ? sizeof(VkDescriptorBufferInfo) : sizeof(VkDescriptorImageInfo);
+			updateTemplate.Entries.push_back({ binding.binding, binding.descriptorCount, binding.descriptorType, payloadSize });
+
+			VkDescriptorUpdateTemplateEntry& entry = vkEntries.emplace_back();
+			entry.dstBinding = binding.binding;
+			entry.dstArrayElement = 0;
+			entry.descriptorCount = binding.descriptorCount;
+			entry.descriptorType = binding.descriptorType;
+			entry.offset = payloadSize;
+			entry.stride = stride;
+
+			payloadSize += stride * binding.descriptorCount;
+		}
+		updateTemplate.PayloadSize = payloadSize;
+
+		VkDescriptorUpdateTemplateCreateInfo templateCI{};
+		templateCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO;
+		templateCI.descriptorUpdateEntryCount = (uint32_t)vkEntries.size();
+		templateCI.pDescriptorUpdateEntries = vkEntries.data();
+		if (set == layout.PushDescriptorSet)
+		{
+			templateCI.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_PUSH_DESCRIPTORS_KHR;
+			templateCI.pipelineBindPoint = bindPoint;
+			templateCI.pipelineLayout = layout.PipelineLayout;
+			templateCI.set = set;
+		}
+		else
+		{
+			templateCI.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+			templateCI.descriptorSetLayout = layout.SetLayouts[set];
+		}
+		VK_CHECK(vkCreateDescriptorUpdateTemplate(device, &templateCI, nullptr, &updateTemplate.Template));
+	}
+}
+
+bool VulkanPipeline::AcquireDescriptorSet(uint32_t set, const DescriptorSetData& data, const VulkanDescriptorSet** outDescriptorSet)
+{
+	auto& cache = s_DescriptorSetCache[m_Layout->SetLayouts[set]];
+	const size_t hash = data.GetHash();
+
+	auto range = cache.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		if (it->second.Data.HasSameBindings(data))
+		{
+			*outDescriptorSet = m_DescriptorSets[set] = &it->second.DescriptorSet;
+			return false;
+		}
+	}
+
+	// Contents of this set keep changing. Using per-frame sets instead of growing the cache
+	if (cache.size() >= s_MaxCachedDescriptorSets)
+	{
+		*outDescriptorSet = m_DescriptorSets[set] = VulkanDescriptorManager::AllocateTransientDescriptorSet(this, set);
+		return true;
+	}
+
+	auto it = cache.emplace(hash, CachedDescriptorSet{ data, VulkanDescriptorManager::AllocateDescriptorSet(this, set) });
+	*outDescriptorSet = m_DescriptorSets[set] = &it->second.DescriptorSet;
+	return true;
+}
 
 void VulkanPipeline::SetBuffer(const VulkanBuffer* buffer, uint32_t set, uint32_t binding)
 {
@@ -2,27 +2,21 @@
 
 #include "DescriptorSetData.h"
 #include "VulkanDescriptorManager.h"
+#include "VulkanBindlessHeap.h"
+#include "VulkanPipelineRegistry.h"
 
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 
 class VulkanTexture2D;
+class VulkanShader;
 class VulkanPipeline
 {
 public:
+	VulkanPipeline() { s_Pipelines.insert(this); }
 	
-	virtual ~VulkanPipeline()
-	{
-		VkDevice device = VulkanContext::GetDevice()->GetVulkanDevice();
-
-		for (auto& setLayout : m_SetLayouts)
-			vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
-		m_SetLayouts.clear();
-
-		m_DescriptorSetData.clear();
-		m_DescriptorSets.clear();
-		m_SetBindings.clear();
-	}
+	virtual ~VulkanPipeline();
 
 	void SetBuffer(const VulkanBuffer* buffer, uint32_t set, uint32_t binding);
 	void SetBuffer(const VulkanBuffer* buffer, size_t offset, size_t size, uint32_t set, uint32_t binding);
@@ -40,29 +34,91 @@ public:
 	void SetImageSamplerArray(const std::vector<const VulkanImage*>& images, const std::vector<const VulkanSampler*>& samplers, uint32_t set, uint32_t binding);
 	void SetImageSamplerArray(const std::vector<const VulkanImage*>& images, const std::vector<ImageView>& imageViews, const std::vector<const VulkanSampler*>& samplers, uint32_t set, uint32_t binding);
 
-	const std::vector<VkDescriptorSetLayoutBinding>& GetSetBindings(uint32_t set) const { return m_SetBindings[set]; }
-	VkDescriptorSetLayout GetDescriptorSetLayout(uint32_t set) const { assert(set < m_SetLayouts.size()); return m_SetLayouts[set]; }
+	const std::vector<VkDescriptorSetLayoutBinding>& GetSetBindings(uint32_t set) const { return m_Layout->SetBindings[set]; }
+	VkDescriptorSetLayout GetDescriptorSetLayout(uint32_t set) const { assert(set < m_Layout->SetLayouts.size()); return m_Layout->SetLayouts[set]; }
 
-	virtual VkPipelineLayout GetVulkanPipelineLayout() const = 0;
+	VkPipelineLayout GetVulkanPipelineLayout() const { return m_Layout->PipelineLayout; }
+
+	// Called when a resource was moved to a new memory location. Rebinds it in descriptor sets of all pipelines
+	static void OnBufferMoved(VkBuffer oldBuffer, VkBuffer newBuffer);
+	static void OnImageMoved(VkImage oldImage, VkImage newImage, const std::unordered_map<VkImageView, VkImageView>& views);
+
+	// Called before a resource is destroyed. Drops cached descriptor sets that reference it, since its handle can be reused by a new resource
+	static void OnResourceReleased(VkBuffer buffer);
+	static void OnResourceReleased(VkImageView imageView);
+	static void OnResourceReleased(VkSampler sampler);
 
 private:
 	const std::unordered_map<uint32_t, DescriptorSetData>& GetDescriptorSetsData() const { return m_DescriptorSetData; }
 	std::unordered_map<uint32_t, DescriptorSetData>& GetDescriptorSetsData() { return m_DescriptorSetData; }
-	const std::unordered_map<uint32_t, VulkanDescriptorSet>& GetDescriptorSets() const { return m_DescriptorSets; }
+	const std::unordered_map<uint32_t, const VulkanDescriptorSet*>& GetDescriptorSets() const { return m_DescriptorSets; }
 
-	VulkanDescriptorSet& AllocateDescriptorSet(uint32_t set)
-	{
-		assert(m_DescriptorSets.find(set) == m_DescriptorSets.end()); // Should not be present
-		VulkanDescriptorSet& nonInitializedSet = m_DescriptorSets[set];
-		nonInitializedSet = VulkanDescriptorManager::AllocateDescriptorSet(this, set);
-		return nonInitializedSet;
-	}
+	// Makes a descriptor set with the contents of `data` current for `set`.
+	// Returns true if the set was allocated and needs to be written, false if an already written set was found in the cache.
+	// If the cache is full, the set is transient and is valid only for the current frame
+	bool AcquireDescriptorSet(uint32_t set, const DescriptorSetData& data, const VulkanDescriptorSet** outDescriptorSet);
+
+	template<typename Handle>
+	static void DropCachedDescriptorSets(Handle handle);
+
+protected:
+	// Set bindings and push constants of `shaders` are merged in their order. Push descriptors are used only if they're supported and the set fits into their limit.
+	// Layouts and update templates only depend on the shaders and the push descriptor set, so pipelines with the same ones share them
+	// and only the first one merges bindings and creates them. Should be called by constructors before the pipeline layout is used
+	void AcquireLayout(VkPipelineBindPoint bindPoint, const std::vector<const VulkanShader*>& shaders, uint32_t pushDescriptorSet);
 
 protected:
-	std::vector<VkDescriptorSetLayout> m_SetLayouts;
 	std::unordered_map<uint32_t, DescriptorSetData> m_DescriptorSetData; // Set -> Data
-	std::vector<std::vector<VkDescriptorSetLayoutBinding>> m_SetBindings; // Not owned! Set -> Bindings
-	std::unordered_map<uint32_t, VulkanDescriptorSet> m_DescriptorSets; // Set -> DescriptorSet
+	std::unordered_map<uint32_t, const VulkanDescriptorSet*> m_DescriptorSets; // Set -> Current DescriptorSet. Points into the shared cache
+
+private:
+	struct DescriptorUpdateTemplate
+	{
+		VkDescriptorUpdateTemplate Template = VK_NULL_HANDLE; // Null for sets that are not written by the pipeline
+		std::vector<DescriptorTemplateEntry> Entries;
+		size_t PayloadSize = 0;
+	};
+
+	struct SharedLayout
+	{
+		std::vector<std::vector<VkDescriptorSetLayoutBinding>> SetBindings; // Set -> Bindings
+		std::vector<VkDescriptorSetLayout> SetLayouts;
+		std::vector<DescriptorUpdateTemplate> UpdateTemplates; // Set -> Template
+		VkPipelineLayout PipelineLayout = VK_NULL_HANDLE;
+		uint32_t PushDescriptorSet = uint32_t(-1); // Set that is pushed on each commit. Its data never goes through the descriptor set cache
+		bool bUsesBindlessHeap = false; // If set, `VulkanBindlessHeap::Set` is bound to the heap
+		uint32_t RefCount = 0;
+	};
+
+	struct CachedDescriptorSet
+	{
+		DescriptorSetData Data; // Contents that the set was written with
+		VulkanDescriptorSet DescriptorSet;
+	};
+
+	// Should be called once `SetBindings` are known. Push descriptors are used only if they're supported and the set fits into their limit
+	static void InitPushDescriptorSet(SharedLayout& layout, uint32_t set);
+
+	// Should be called once the pipeline layout is created. Builds an update template per set from `SetBindings`
+	static void CreateDescriptorUpdateTemplates(SharedLayout& layout, VkPipelineBindPoint bindPoint);
+
+	static void ReleaseLayout(const PipelineKey& key);
+
+private:
+	const SharedLayout* m_Layout = nullptr; // Points into `s_Layouts`
+	PipelineKey m_LayoutKey;
+	std::vector<std::vector<uint8_t>> m_TemplatePayloads; // Set -> Payload filled by `DescriptorSetData` before each update. Not shared, since pushed payloads keep their last data
+
+private:
+	static std::unordered_set<VulkanPipeline*> s_Pipelines; // All alive pipelines
+	static std::unordered_map<PipelineKey, SharedLayout, PipelineKeyHash> s_Layouts; // Bind point, shaders and push descriptor set -> Layout
+
+	// Already written sets are never rewritten and dropped ones are freed only after the frames in flight are done,
+	// so bindings can change every frame without waiting for the GPU.
+	// Set layouts are shared through `VulkanLayoutCache`, so pipelines with the same layout share descriptor sets
+	static constexpr size_t s_MaxCachedDescriptorSets = 64; // Per set layout
+	static std::unordered_map<VkDescriptorSetLayout, std::unordered_multimap<size_t, CachedDescriptorSet>> s_DescriptorSetCache; // Set layout -> (Content hash -> DescriptorSet)
 
 	friend class VulkanCommandBuffer;
+	friend class VulkanDescriptorManager;
 };
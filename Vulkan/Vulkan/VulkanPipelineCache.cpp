@@ -1,12 +1,102 @@
 #include "VulkanPipelineCache.h"
+#include "VulkanPipelineCompiler.h"
 #include "VulkanContext.h"
 
 #include <sstream>
 #include <filesystem>
 #include <fstream>
+#include <future>
+#include <chrono>
+#include <cstring>
+
+static constexpr std::chrono::seconds s_SaveInterval{ 30 };
+static constexpr size_t s_MaxCacheSize = 256 * 1024 * 1024; // Caches that grew above it are neither loaded nor saved
 
 static VkPipelineCache s_Cache = VK_NULL_HANDLE;
 static std::filesystem::path s_FullPath;
+static std::future<bool> s_PendingSave; // Set if the write succeeded
+static size_t s_PendingSaveSize = 0;
+static std::chrono::steady_clock::time_point s_LastSaveTime;
+static size_t s_SavedSize = 0; // Only updated once a save succeeds, so failed saves are retried
+static bool s_bReportedOversize = false;
+
+static bool IsCacheDataValid(const std::vector<char>& cacheData)
+{
+	VkPipelineCacheHeaderVersionOne header{};
+	if (cacheData.size() < sizeof(header))
+		return false;
+
+	memcpy(&header, cacheData.data(), sizeof(header));
+
+	const auto& props = VulkanContext::GetDevice()->GetPhysicalDevice()->GetProperties();
+	return header.headerSize >= sizeof(header)
+		&& header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+		&& header.vendorID == props.vendorID
+		&& header.deviceID == props.deviceID
+		&& memcmp(header.pipelineCacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+static std::vector<char> GetCacheData()
+{
+	VkDevice device = VulkanContext::GetDevice()->GetVulkanDevice();
+
+	std::size_t cacheSize;
+	vkGetPipelineCacheData(device, s_Cache, &cacheSize, 0);
+	std::vector<char> cacheData(cacheSize);
+	vkGetPipelineCacheData(device, s_Cache, &cacheSize, cacheData.data());
+	cacheData.resize(cacheSize);
+
+	return cacheData;
+}
+
+// Writes into a temporary file first and then replaces the old cache with it. Returns false if either fails
+static bool WriteCacheData(const std::filesystem::path& path, const std::vector<char>& cacheData)
+{
+	std::error_code error;
+	std::filesystem::create_directories(path.parent_path(), error);
+
+	std::filesystem::path tempPath = path;
+	tempPath += ".tmp";
+
+	std::ofstream out(tempPath, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+	out.write(cacheData.data(), cacheData.size());
+	out.close();
+	if (!out)
+	{
+		std::cerr << "[Vulkan pipeline cache] Failed to write " << tempPath << "\n";
+		std::filesystem::remove(tempPath, error);
+		return false;
+	}
+
+	std::filesystem::rename(tempPath, path, error);
+	if (error)
+	{
+		std::cerr << "[Vulkan pipeline cache] Failed to replace " << path << ": " << error.message() << "\n";
+		return false;
+	}
+	return true;
+}
+
+// Waits for the pending save if there's one and takes its size as saved if it succeeded
+static void FinishPendingSave()
+{
+	if (s_PendingSave.valid() && s_PendingSave.get())
+		s_SavedSize = s_PendingSaveSize;
+}
+
+// Returns false if the cache is too big to be saved
+static bool CanSave(size_t cacheSize)
+{
+	if (cacheSize <= s_MaxCacheSize)
+		return true;
+
+	if (!s_bReportedOversize)
+	{
+		std::cerr << "[Vulkan pipeline cache] Cache size (" << cacheSize << " bytes) exceeds the limit. It won't be saved\n";
+		s_bReportedOversize = true;
+	}
+	return false;
+}
 
 void VulkanPipelineCache::Init()
 {
@@ -34,39 +124,74 @@ void VulkanPipelineCache::Init()
 		in.seekg(0, std::ios_base::end);
 		std::size_t size = in.tellg();
 		in.seekg(0, std::ios_base::beg);
-		cacheData.resize(size);
 
-		in.read(cacheData.data(), size);
+		if (size <= s_MaxCacheSize)
+		{
+			cacheData.resize(size);
+			in.read(cacheData.data(), size);
+			if (!in)
+				cacheData.clear();
+		}
 		in.close();
 	}
 
+	if (!cacheData.empty() && !IsCacheDataValid(cacheData))
+	{
+		std::cerr << "[Vulkan pipeline cache] Cache " << s_FullPath << " is invalid or was created by another device. Ignoring it\n";
+		cacheData.clear();
+	}
+
 	VkPipelineCacheCreateInfo cacheCI{};
 	cacheCI.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
 	cacheCI.initialDataSize = cacheData.size();
 	cacheCI.pInitialData = cacheData.data();
 
 	VK_CHECK(vkCreatePipelineCache(VulkanContext::GetDevice()->GetVulkanDevice(), &cacheCI, nullptr, &s_Cache));
+
+	s_SavedSize = cacheData.size();
+	s_LastSaveTime = std::chrono::steady_clock::now();
 }
 
 void VulkanPipelineCache::Shutdown()
 {
-	std::filesystem::path path = Renderer::GetRendererCachePath();
-	if (!std::filesystem::exists(path))
-		std::filesystem::create_directories(path);
+	FinishPendingSave();
 
-	VkDevice device = VulkanContext::GetDevice()->GetVulkanDevice();
+	std::vector<char> cacheData = GetCacheData();
+	if (cacheData.size() != s_SavedSize && CanSave(cacheData.size()))
+		WriteCacheData(s_FullPath, cacheData);
 
-	std::size_t cacheSize;
-	vkGetPipelineCacheData(device, s_Cache, &cacheSize, 0);
-	std::vector<char> cache_data(cacheSize);
-	vkGetPipelineCacheData(device, s_Cache, &cacheSize, cache_data.data());
+	vkDestroyPipelineCache(VulkanContext::GetDevice()->GetVulkanDevice(), s_Cache, nullptr);
+	s_Cache = VK_NULL_HANDLE;
+}
 
-	// Saving cache to file
-	std::ofstream out(s_FullPath, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
-	out.write(cache_data.data(), cacheSize);
-	out.close();
+void VulkanPipelineCache::Update()
+{
+	const auto now = std::chrono::steady_clock::now();
+	if (now - s_LastSaveTime < s_SaveInterval)
+		return;
+
+	// Previous save is still being written
+	if (s_PendingSave.valid() && s_PendingSave.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		return;
+	FinishPendingSave();
+
+	s_LastSaveTime = now;
 
-	vkDestroyPipelineCache(device, s_Cache, nullptr);
+	// Pipelines compiled since the last save are still in worker caches
+	VulkanPipelineCompiler::MergeCaches();
+
+	std::size_t cacheSize = 0;
+	vkGetPipelineCacheData(VulkanContext::GetDevice()->GetVulkanDevice(), s_Cache, &cacheSize, nullptr);
+	if (cacheSize <= s_SavedSize || !CanSave(cacheSize))
+		return;
+
+	// Data is read on this thread since the cache is used only by it. Only the file write is moved to the background
+	std::vector<char> cacheData = GetCacheData();
+	s_PendingSaveSize = cacheData.size();
+	s_PendingSave = std::async(std::launch::async, [path = s_FullPath, data = std::move(cacheData)]()
+	{
+		return WriteCacheData(path, data);
+	});
 }
 
 VkPipelineCache VulkanPipelineCache::GetCache()
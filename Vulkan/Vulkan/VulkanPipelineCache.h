@@ -2,11 +2,17 @@
 
 #include "Vulkan.h"
 
+// Pipeline cache persisted in the renderer cache folder.
+// Loaded data is validated against the device before use. Saves go through a temporary file that replaces the old one,
+// so a crash during a save never leaves a corrupted cache behind
 class VulkanPipelineCache
 {
 public:
 	static void Init();
 	static void Shutdown();
 
+	// Should be called once per frame. Periodically saves the cache on a background thread if it grew since the last save
+	static void Update();
+
 	static VkPipelineCache GetCache();
 };
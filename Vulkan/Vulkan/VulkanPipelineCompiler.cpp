@@ -0,0 +1,205 @@
+#include "VulkanPipelineCompiler.h"
+#include "VulkanPipelineCache.h"
+#include "VulkanContext.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <algorithm>
+
+struct CompileJob
+{
+	VulkanPipelineCompiler::CompileFunc Compile;
+	std::promise<VkPipeline> Promise;
+};
+
+struct PendingAction
+{
+	std::vector<std::shared_future<VkPipeline>> Pipelines; // Run once all of them are compiled
+	std::function<void()> Action;
+};
+
+struct VulkanPipelineCompilerData
+{
+	VkDevice Device = VK_NULL_HANDLE;
+	std::vector<std::thread> Workers;
+	std::vector<VkPipelineCache> WorkerCaches; // Worker index -> Cache
+
+	std::mutex Mutex;
+	std::condition_variable JobAdded;
+	std::condition_variable JobDone;
+	std::deque<CompileJob> Jobs;
+	uint32_t ActiveJobs = 0;
+	bool bDirtyCaches = false; // Set if worker caches have data that was not merged yet
+	bool bStop = false;
+
+	std::vector<PendingAction> PendingActions; // Only used by the main thread
+};
+
+static VulkanPipelineCompilerData* s_Data = nullptr;
+
+static bool AreCompiled(const std::vector<std::shared_future<VkPipeline>>& pipelines)
+{
+	for (auto& pipeline : pipelines)
+		if (pipeline.valid() && pipeline.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			return false;
+	return true;
+}
+
+// Ready actions are taken out before they're run, since they can add new ones
+static void RunReadyActions()
+{
+	auto& pending = s_Data->PendingActions;
+	auto it = std::partition(pending.begin(), pending.end(), [](const PendingAction& action) { return !AreCompiled(action.Pipelines); });
+	std::vector<PendingAction> ready(std::make_move_iterator(it), std::make_move_iterator(pending.end()));
+	pending.erase(it, pending.end());
+
+	for (auto& action : ready)
+		action.Action();
+}
+
+static void WorkerLoop(uint32_t workerIndex)
+{
+	const VkPipelineCache cache = s_Data->WorkerCaches[workerIndex];
+
+	while (true)
+	{
+		CompileJob job;
+		{
+			std::unique_lock lock(s_Data->Mutex);
+			s_Data->JobAdded.wait(lock, []() { return s_Data->bStop || !s_Data->Jobs.empty(); });
+			if (s_Data->Jobs.empty())
+				return;
+
+			job = std::move(s_Data->Jobs.front());
+			s_Data->Jobs.pop_front();
+			++s_Data->ActiveJobs;
+		}
+
+		job.Promise.set_value(job.Compile(cache));
+
+		{
+			std::lock_guard lock(s_Data->Mutex);
+			--s_Data->ActiveJobs;
+			s_Data->bDirtyCaches = true;
+		}
+		s_Data->JobDone.notify_all();
+	}
+}
+
+void VulkanPipelineCompiler::Init()
+{
+	assert(!s_Data);
+	s_Data = new VulkanPipelineCompilerData();
+	s_Data->Device = VulkanContext::GetDevice()->GetVulkanDevice();
+
+	// Seeding worker caches with the loaded cache, so warm starts stay warm on workers too
+	std::size_t cacheSize = 0;
+	vkGetPipelineCacheData(s_Data->Device, VulkanPipelineCache::GetCache(), &cacheSize, nullptr);
+	std::vector<char> cacheData(cacheSize);
+	vkGetPipelineCacheData(s_Data->Device, VulkanPipelineCache::GetCache(), &cacheSize, cacheData.data());
+
+	VkPipelineCacheCreateInfo cacheCI{};
+	cacheCI.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheCI.initialDataSize = cacheSize;
+	cacheCI.pInitialData = cacheData.data();
+
+	const uint32_t workersCount = std::max(std::thread::hardware_concurrency(), 2u) - 1u;
+	s_Data->WorkerCaches.resize(workersCount);
+	for (auto& cache : s_Data->WorkerCaches)
+		VK_CHECK(vkCreatePipelineCache(s_Data->Device, &cacheCI, nullptr, &cache));
+
+	s_Data->Workers.reserve(workersCount);
+	for (uint32_t i = 0; i < workersCount; ++i)
+		s_Data->Workers.emplace_back(WorkerLoop, i);
+}
+
+void VulkanPipelineCompiler::Shutdown()
+{
+	WaitIdle();
+	assert(s_Data->PendingActions.empty());
+
+	{
+		std::lock_guard lock(s_Data->Mutex);
+		s_Data->bStop = true;
+	}
+	s_Data->JobAdded.notify_all();
+	for (auto& worker : s_Data->Workers)
+		worker.join();
+
+	for (auto& cache : s_Data->WorkerCaches)
+		vkDestroyPipelineCache(s_Data->Device, cache, nullptr);
+
+	delete s_Data;
+	s_Data = nullptr;
+}
+
+std::shared_future<VkPipeline> VulkanPipelineCompiler::Submit(CompileFunc compile)
+{
+	CompileJob job;
+	job.Compile = std::move(compile);
+	std::shared_future<VkPipeline> future = job.Promise.get_future().share();
+
+	{
+		std::lock_guard lock(s_Data->Mutex);
+		s_Data->Jobs.push_back(std::move(job));
+	}
+	s_Data->JobAdded.notify_one();
+
+	return future;
+}
+
+void VulkanPipelineCompiler::RunWhenCompiled(const std::vector<std::shared_future<VkPipeline>>& pipelines, std::function<void()> action)
+{
+	if (AreCompiled(pipelines))
+		action();
+	else
+		s_Data->PendingActions.push_back({ pipelines, std::move(action) });
+}
+
+void VulkanPipelineCompiler::DestroyPipeline(const std::shared_future<VkPipeline>& pipeline)
+{
+	RunWhenCompiled({ pipeline }, [pipeline]()
+	{
+		vkDestroyPipeline(s_Data->Device, pipeline.get(), nullptr);
+	});
+}
+
+// Worker caches are internally synchronized, so they can be read while workers compile into them.
+// Only the destination cache requires external synchronization, and it's used by the calling thread only
+void VulkanPipelineCompiler::MergeCaches()
+{
+	{
+		// Cleared before merging, so jobs that finish during the merge mark caches dirty again
+		std::lock_guard lock(s_Data->Mutex);
+		if (!s_Data->bDirtyCaches)
+			return;
+		s_Data->bDirtyCaches = false;
+	}
+
+	VK_CHECK(vkMergePipelineCaches(s_Data->Device, VulkanPipelineCache::GetCache(), (uint32_t)s_Data->WorkerCaches.size(), s_Data->WorkerCaches.data()));
+}
+
+void VulkanPipelineCompiler::WaitIdle()
+{
+	{
+		std::unique_lock lock(s_Data->Mutex);
+		s_Data->JobDone.wait(lock, []() { return s_Data->Jobs.empty() && s_Data->ActiveJobs == 0; });
+	}
+	RunReadyActions();
+	MergeCaches();
+}
+
+void VulkanPipelineCompiler::Update()
+{
+	RunReadyActions();
+
+	{
+		std::unique_lock lock(s_Data->Mutex, std::try_to_lock);
+		if (!lock.owns_lock() || !s_Data->Jobs.empty() || s_Data->ActiveJobs != 0)
+			return;
+	}
+	MergeCaches();
+}
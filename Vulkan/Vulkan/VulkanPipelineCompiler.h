@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Vulkan.h"
+
+#include <functional>
+#include <future>
+
+// Compiles pipelines on worker threads. Each worker compiles into its own pipeline cache seeded with `VulkanPipelineCache`,
+// so workers never contend on a cache. Worker caches are merged back into `VulkanPipelineCache` by `MergeCaches`,
+// which `VulkanPipelineCache::Update` calls before each periodic save, and by `WaitIdle`.
+// Shader modules used by a job must stay alive until the job is done
+class VulkanPipelineCompiler
+{
+public:
+	VulkanPipelineCompiler() = delete;
+
+	using CompileFunc = std::function<VkPipeline(VkPipelineCache)>;
+
+	// Should be called after `VulkanPipelineCache::Init`. Uses a worker per core, leaving one core for the main thread
+	static void Init();
+	static void Shutdown();
+
+	// Queues `compile` for a worker. It's called with the pipeline cache of the worker
+	static std::shared_future<VkPipeline> Submit(CompileFunc compile);
+
+	// Runs `action` on the main thread once all `pipelines` are compiled, so nothing waits for workers.
+	// If they're still compiling, it's run by a later `Update` or `WaitIdle`. Invalid pipelines are ignored
+	static void RunWhenCompiled(const std::vector<std::shared_future<VkPipeline>>& pipelines, std::function<void()> action);
+
+	// Destroys `pipeline` once it's compiled, so releasing a pipeline never waits for a worker
+	static void DestroyPipeline(const std::shared_future<VkPipeline>& pipeline);
+
+	// Waits for all submitted jobs, runs actions that waited for them and merges worker caches into `VulkanPipelineCache`
+	static void WaitIdle();
+
+	// Merges worker caches into `VulkanPipelineCache` without waiting for jobs. Jobs that are still running are merged by a later call.
+	// Should be called from the thread that uses `VulkanPipelineCache`
+	static void MergeCaches();
+
+	// Should be called once per frame. Runs actions whose pipelines are compiled by now. Merges worker caches into `VulkanPipelineCache` if workers are idle. Never waits for them
+	static void Update();
+};
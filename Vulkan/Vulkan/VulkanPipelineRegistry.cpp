@@ -0,0 +1,300 @@
+#include "VulkanPipelineRegistry.h"
+#include "VulkanContext.h"
+#include "VulkanPipelineCompiler.h"
+
+#include <unordered_map>
+#include <string_view>
+#include <fstream>
+#include <algorithm>
+
+static constexpr uint32_t s_UsageFileMagic = 0x554F5350; // "PSOU"
+static constexpr uint32_t s_UsageFileVersion = 4; // Should be bumped if the format of descriptions changes
+
+template<typename Handle>
+struct RegisteredObject
+{
+	PipelineKey Key;
+	Handle Object{};
+	uint32_t RefCount = 0;
+};
+
+struct PipelineUsage
+{
+	uint32_t Uses = 0; // Including uses of previous sessions
+	bool bUsedThisSession = false;
+};
+
+struct VulkanPipelineRegistryData
+{
+	VkDevice Device = VK_NULL_HANDLE;
+	std::unordered_multimap<size_t, RegisteredObject<VkRenderPass>> RenderPasses; // Key hash -> Render pass
+	std::unordered_multimap<size_t, RegisteredObject<std::shared_future<VkPipeline>>> Pipelines; // Key hash -> Pipeline
+	std::unordered_map<VkRenderPass, size_t> RenderPassHashes;
+	std::unordered_map<PipelineKey, PipelineUsage, PipelineKeyHash> Usage; // Description -> Usage
+	std::filesystem::path UsagePath;
+};
+
+static VulkanPipelineRegistryData* s_Data = nullptr;
+
+size_t PipelineKey::GetHash() const
+{
+	return std::hash<std::string_view>()(std::string_view((const char*)m_Data.data(), m_Data.size()));
+}
+
+template<typename Handle, typename CreateFunc>
+static Handle Acquire(std::unordered_multimap<size_t, RegisteredObject<Handle>>& objects, const PipelineKey& key, size_t hash, const CreateFunc& create)
+{
+	auto range = objects.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		if (it->second.Key == key)
+		{
+			++it->second.RefCount;
+			return it->second.Object;
+		}
+	}
+
+	RegisteredObject<Handle> registered;
+	registered.Key = key;
+	registered.Object = create();
+	registered.RefCount = 1;
+
+	return objects.emplace(hash, std::move(registered))->second.Object;
+}
+
+// Returns true if it was the last reference. In that case, `outObject` is set to the released object
+template<typename Handle, typename Predicate>
+static bool Release(std::unordered_multimap<size_t, RegisteredObject<Handle>>& objects, size_t hash, const Predicate& isObject, Handle& outObject)
+{
+	auto range = objects.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		if (!isObject(it->second))
+			continue;
+
+		if (--it->second.RefCount)
+			return false;
+
+		outObject = std::move(it->second.Object);
+		objects.erase(it);
+		return true;
+	}
+
+	assert(!"Unknown object");
+	return false;
+}
+
+static void LoadUsage()
+{
+	std::ifstream in(s_Data->UsagePath, std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
+	if (!in)
+		return;
+
+	// Sizes are checked against it, so a truncated or corrupted file can't make us allocate arbitrary amounts of memory
+	const size_t fileSize = size_t(in.tellg());
+	in.seekg(0, std::ios_base::beg);
+
+	uint32_t magic = 0, version = 0, count = 0;
+	in.read((char*)&magic, sizeof(magic));
+	in.read((char*)&version, sizeof(version));
+	in.read((char*)&count, sizeof(count));
+	if (!in || magic != s_UsageFileMagic || version != s_UsageFileVersion)
+		return;
+
+	std::vector<uint8_t> data;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		uint32_t uses = 0, size = 0;
+		in.read((char*)&uses, sizeof(uses));
+		in.read((char*)&size, sizeof(size));
+		if (!in)
+			break;
+
+		if (size > fileSize - size_t(in.tellg()))
+		{
+			std::cerr << "[Vulkan pipeline registry] Pipeline usage file is corrupted: " << s_Data->UsagePath << "\n";
+			break;
+		}
+
+		data.resize(size);
+		in.read((char*)data.data(), size);
+		if (!in)
+			break;
+
+		PipelineKey description;
+		description.Append(data.data(), data.size());
+		s_Data->Usage[description].Uses = uses;
+	}
+}
+
+// Writes into a temporary file first and then replaces the old file with it
+static void SaveUsage()
+{
+	std::error_code error;
+	std::filesystem::create_directories(s_Data->UsagePath.parent_path(), error);
+
+	std::filesystem::path tempPath = s_Data->UsagePath;
+	tempPath += ".tmp";
+
+	// Descriptions that were not used in this session fade out, so the warm-up doesn't keep compiling outdated pipelines forever
+	for (auto it = s_Data->Usage.begin(); it != s_Data->Usage.end();)
+	{
+		PipelineUsage& usage = it->second;
+		if (!usage.bUsedThisSession)
+			usage.Uses /= 2;
+
+		if (usage.Uses == 0)
+			it = s_Data->Usage.erase(it);
+		else
+			++it;
+	}
+
+	std::ofstream out(tempPath, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+	const uint32_t count = (uint32_t)s_Data->Usage.size();
+	out.write((const char*)&s_UsageFileMagic, sizeof(s_UsageFileMagic));
+	out.write((const char*)&s_UsageFileVersion, sizeof(s_UsageFileVersion));
+	out.write((const char*)&count, sizeof(count));
+	for (auto& [description, usage] : s_Data->Usage)
+	{
+		const uint32_t size = (uint32_t)description.GetData().size();
+		out.write((const char*)&usage.Uses, sizeof(usage.Uses));
+		out.write((const char*)&size, sizeof(size));
+		out.write((const char*)description.GetData().data(), size);
+	}
+	out.close();
+
+	if (out)
+		std::filesystem::rename(tempPath, s_Data->UsagePath, error);
+	if (!out || error)
+		std::cerr << "[Vulkan pipeline registry] Failed to save pipeline usage to " << s_Data->UsagePath << "\n";
+}
+
+void VulkanPipelineRegistry::Init()
+{
+	assert(!s_Data);
+	s_Data = new VulkanPipelineRegistryData();
+	s_Data->Device = VulkanContext::GetDevice()->GetVulkanDevice();
+	s_Data->UsagePath = Path(Renderer::GetRendererCachePath()) / "pipelines.usage";
+	LoadUsage();
+}
+
+void VulkanPipelineRegistry::Shutdown()
+{
+	// Released pipelines can still be waiting for workers
+	VulkanPipelineCompiler::WaitIdle();
+
+	if (!s_Data->Pipelines.empty() || !s_Data->RenderPasses.empty())
+		std::cerr << "[Vulkan pipeline registry] " << s_Data->Pipelines.size() << " pipelines and " << s_Data->RenderPasses.size() << " render passes were not released\n";
+
+	if (!s_Data->Usage.empty())
+		SaveUsage();
+
+	for (auto& it : s_Data->Pipelines)
+		vkDestroyPipeline(s_Data->Device, it.second.Object.get(), nullptr);
+	for (auto& it : s_Data->RenderPasses)
+		vkDestroyRenderPass(s_Data->Device, it.second.Object, nullptr);
+
+	delete s_Data;
+	s_Data = nullptr;
+}
+
+VkRenderPass VulkanPipelineRegistry::AcquireRenderPass(const VkRenderPassCreateInfo& renderPassCI)
+{
+	assert(renderPassCI.subpassCount == 1 && renderPassCI.pNext == nullptr);
+
+	// Attachment descriptions, references and dependencies consist of 32-bit fields only, so they have no padding
+	PipelineKey key;
+	key.Append(renderPassCI.flags);
+	key.Append(renderPassCI.attachmentCount);
+	key.Append(renderPassCI.pAttachments, sizeof(VkAttachmentDescription) * renderPassCI.attachmentCount);
+	key.Append(renderPassCI.dependencyCount);
+	key.Append(renderPassCI.pDependencies, sizeof(VkSubpassDependency) * renderPassCI.dependencyCount);
+
+	const VkSubpassDescription& subpass = renderPassCI.pSubpasses[0];
+	assert(subpass.inputAttachmentCount == 0 && subpass.preserveAttachmentCount == 0);
+	key.Append(subpass.pipelineBindPoint);
+	key.Append(subpass.colorAttachmentCount);
+	key.Append(subpass.pColorAttachments, sizeof(VkAttachmentReference) * subpass.colorAttachmentCount);
+	key.Append(subpass.pResolveAttachments != nullptr);
+	if (subpass.pResolveAttachments)
+		key.Append(subpass.pResolveAttachments, sizeof(VkAttachmentReference) * subpass.colorAttachmentCount);
+	key.Append(subpass.pDepthStencilAttachment != nullptr);
+	if (subpass.pDepthStencilAttachment)
+		key.Append(*subpass.pDepthStencilAttachment);
+
+	const size_t hash = key.GetHash();
+	VkRenderPass renderPass = Acquire(s_Data->RenderPasses, key, hash, [&renderPassCI]()
+	{
+		VkRenderPass newRenderPass = VK_NULL_HANDLE;
+		VK_CHECK(vkCreateRenderPass(s_Data->Device, &renderPassCI, nullptr, &newRenderPass));
+		return newRenderPass;
+	});
+	s_Data->RenderPassHashes[renderPass] = hash;
+
+	return renderPass;
+}
+
+void VulkanPipelineRegistry::ReleaseRenderPass(VkRenderPass renderPass)
+{
+	auto hashIt = s_Data->RenderPassHashes.find(renderPass);
+	assert(hashIt != s_Data->RenderPassHashes.end());
+
+	auto isRenderPass = [renderPass](const RegisteredObject<VkRenderPass>& registered) { return registered.Object == renderPass; };
+	VkRenderPass released = VK_NULL_HANDLE;
+	if (Release(s_Data->RenderPasses, hashIt->second, isRenderPass, released))
+	{
+		s_Data->RenderPassHashes.erase(hashIt);
+		vkDestroyRenderPass(s_Data->Device, released, nullptr);
+	}
+}
+
+std::shared_future<VkPipeline> VulkanPipelineRegistry::AcquirePipeline(const PipelineKey& key, const std::function<std::shared_future<VkPipeline>()>& createPipeline)
+{
+	return Acquire(s_Data->Pipelines, key, key.GetHash(), createPipeline);
+}
+
+std::shared_future<VkPipeline> VulkanPipelineRegistry::FindPipeline(const PipelineKey& key)
+{
+	auto range = s_Data->Pipelines.equal_range(key.GetHash());
+	for (auto it = range.first; it != range.second; ++it)
+		if (it->second.Key == key)
+			return it->second.Object;
+
+	return {};
+}
+
+void VulkanPipelineRegistry::ReleasePipeline(const PipelineKey& key)
+{
+	auto isPipeline = [&key](const RegisteredObject<std::shared_future<VkPipeline>>& registered) { return registered.Key == key; };
+	std::shared_future<VkPipeline> released;
+	if (Release(s_Data->Pipelines, key.GetHash(), isPipeline, released))
+		VulkanPipelineCompiler::DestroyPipeline(released);
+}
+
+void VulkanPipelineRegistry::RecordUsage(const PipelineKey& description)
+{
+	PipelineUsage& usage = s_Data->Usage[description];
+	if (usage.bUsedThisSession)
+		return;
+
+	usage.bUsedThisSession = true;
+	if (usage.Uses != uint32_t(-1))
+		++usage.Uses;
+}
+
+std::vector<PipelineKey> VulkanPipelineRegistry::GetRecordedDescriptions()
+{
+	std::vector<std::pair<uint32_t, const PipelineKey*>> sorted;
+	sorted.reserve(s_Data->Usage.size());
+	for (auto& [description, usage] : s_Data->Usage)
+		sorted.push_back({ usage.Uses, &description });
+
+	std::stable_sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+	std::vector<PipelineKey> result;
+	result.reserve(sorted.size());
+	for (auto& it : sorted)
+		result.push_back(*it.second);
+
+	return result;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "Vulkan.h"
+
+#include <vector>
+#include <functional>
+#include <future>
+#include <type_traits>
+#include <cstring>
+
+// Identifies a pipeline state object. Built from everything that affects the compiled pipeline, so pipelines with equal keys are interchangeable
+class PipelineKey
+{
+public:
+	// Only types without padding should be appended, so equal values produce equal keys
+	template<typename T>
+	void Append(const T& value)
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable types can be a part of the key");
+		Append(&value, sizeof(T));
+	}
+
+	void Append(const void* data, size_t size)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		m_Data.insert(m_Data.end(), bytes, bytes + size);
+	}
+
+	size_t GetHash() const;
+	const std::vector<uint8_t>& GetData() const { return m_Data; }
+
+	bool operator==(const PipelineKey& other) const { return m_Data == other.m_Data; }
+	bool operator!=(const PipelineKey& other) const { return !(*this == other); }
+
+private:
+	std::vector<uint8_t> m_Data;
+};
+
+struct PipelineKeyHash
+{
+	size_t operator()(const PipelineKey& key) const { return key.GetHash(); }
+};
+
+// Reads values in the order they were appended to a `PipelineKey`
+class PipelineKeyReader
+{
+public:
+	PipelineKeyReader(const PipelineKey& key) : m_Data(key.GetData()) {}
+
+	template<typename T>
+	bool Read(T& value)
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable types can be read");
+		return Read(&value, sizeof(T));
+	}
+
+	bool Read(void* data, size_t size)
+	{
+		if (m_bFailed || size > m_Data.size() - m_Offset)
+		{
+			m_bFailed = true;
+			return false;
+		}
+
+		memcpy(data, m_Data.data() + m_Offset, size);
+		m_Offset += size;
+		return true;
+	}
+
+	size_t GetRemainingSize() const { return m_Data.size() - m_Offset; }
+
+	// Returns false if any read went out of bounds or if not all data was read
+	bool IsValid() const { return !m_bFailed && m_Offset == m_Data.size(); }
+
+private:
+	const std::vector<uint8_t>& m_Data;
+	size_t m_Offset = 0;
+	bool m_bFailed = false;
+};
+
+// Shares pipelines and render passes between pipeline objects with the same state.
+// Everything is reference counted and destroyed once the last user releases it
+class VulkanPipelineRegistry
+{
+public:
+	VulkanPipelineRegistry() = delete;
+
+	static void Init();
+	static void Shutdown();
+
+	// Returns a render pass created with identical attachments, subpass and dependencies, or creates a new one.
+	// Only single subpass render passes are supported
+	static VkRenderPass AcquireRenderPass(const VkRenderPassCreateInfo& renderPassCI);
+	static void ReleaseRenderPass(VkRenderPass renderPass);
+
+	// Returns the pipeline registered with `key` or registers the one returned by `createPipeline`.
+	// Pipelines can still be compiling on `VulkanPipelineCompiler` workers
+	static std::shared_future<VkPipeline> AcquirePipeline(const PipelineKey& key, const std::function<std::shared_future<VkPipeline>()>& createPipeline);
+	static void ReleasePipeline(const PipelineKey& key);
+
+	// Returns the pipeline registered with `key` without acquiring it. Invalid if there's none
+	static std::shared_future<VkPipeline> FindPipeline(const PipelineKey& key);
+
+	// Records that a pipeline with `description` was used. A description is counted once per session, so `Uses` is the number of sessions that used it.
+	// Descriptions are opaque to the registry and are saved on shutdown,
+	// so the next launch can compile them before they're requested
+	static void RecordUsage(const PipelineKey& description);
+
+	// Descriptions recorded by previous sessions, most used first
+	static std::vector<PipelineKey> GetRecordedDescriptions();
+};
@@ -0,0 +1,17 @@
+#include "VulkanSampler.h"
+#include "VulkanPipeline.h"
+
+VulkanSampler::~VulkanSampler()
+{
+	Release();
+}
+
+void VulkanSampler::Release()
+{
+	if (m_Sampler)
+	{
+		VulkanPipeline::OnResourceReleased(m_Sampler);
+		vkDestroySampler(m_Device, m_Sampler, nullptr);
+	}
+	m_Sampler = VK_NULL_HANDLE;
+}
@@ -60,8 +60,7 @@ public:
 	VulkanSampler& operator= (const VulkanSampler&) = delete;
 	VulkanSampler& operator= (VulkanSampler&& other) noexcept
 	{
-		if (m_Sampler)
-			vkDestroySampler(m_Device, m_Sampler, nullptr);
+		Release();
 
 		m_Device = other.m_Device;
 		m_Sampler = other.m_Sampler;
@@ -83,11 +82,7 @@ public:
 		return *this;
 	}
 
-	virtual ~VulkanSampler()
-	{
-		if (m_Sampler)
-			vkDestroySampler(m_Device, m_Sampler, nullptr);
-	}
+	virtual ~VulkanSampler();
 
 	VkSampler GetVulkanSampler() const { return m_Sampler; }
 	FilterMode GetFilterMode() const { return m_FilterMode; }
@@ -97,6 +92,9 @@ public:
 	float GetMaxLod() const { return m_MaxLod; }
 	float GetMaxAnisotropy() const { return m_MaxAnisotropy; }
 
+private:
+	void Release();
+
 private:
 	VkDevice m_Device = VK_NULL_HANDLE;
 	VkSampler m_Sampler = VK_NULL_HANDLE;
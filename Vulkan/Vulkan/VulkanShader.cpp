@@ -10,8 +10,13 @@
 
 #include <fstream>
 #include <sstream>
+#include <iomanip>
 #include <map>
 #include <set>
+#include <string_view>
+#include <algorithm>
+#include <cstring>
+#include <mutex>
 
 namespace Utils
 {
@@ -194,115 +199,385 @@ VulkanShader::~VulkanShader()
 
 void VulkanShader::Reload()
 {
-	LoadBinary();
-	CreateShaderModule();
+	// Previous module is kept if the shader can't be loaded
+	if (LoadBinary())
+		CreateShaderModule();
 }
 
-static void ParseIncludes(std::string& source)
+static const Path s_IncludesPath = "Shaders/";
+static constexpr uint32_t s_CacheMagic = 0x56505353; // "SSPV"
+static constexpr uint32_t s_CacheVersion = 1; // Should be bumped if the format of the cache or the compilation changes
+static constexpr bool s_bGenerateDebugInfo = true;
+static constexpr bool s_bWarningsAsErrors = true;
+
+// Shaders can be loaded by several threads at once, e.g. by the pipeline warm-up. Writing cache files and removing stale ones is serialised,
+// so two loads of a shader don't write the same temporary file and a cleanup doesn't remove a file that another load is about to rename
+static std::mutex s_CacheFilesMutex;
+
+// Followed by vertex attributes, bindings of each set, push constant ranges and the binary
+struct ShaderCacheHeader
+{
+	uint32_t Magic = s_CacheMagic;
+	uint32_t Version = s_CacheVersion;
+	Hash128 SourceHash; // Guards against renamed or truncated files
+	uint32_t BinaryWordsCount = 0;
+	uint32_t VertexAttribsCount = 0;
+	uint32_t SetsCount = 0;
+	uint32_t PushConstantRangesCount = 0;
+};
+
+// `VkDescriptorSetLayoutBinding` without the pointer to immutable samplers
+struct ShaderCacheBinding
+{
+	uint32_t Binding = 0;
+	uint32_t DescriptorType = 0;
+	uint32_t DescriptorCount = 0;
+	uint32_t StageFlags = 0;
+};
+
+static uint64_t Rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t FMix64(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdull;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ull;
+	k ^= k >> 33;
+	return k;
+}
+
+// MurmurHash3 x64 128-bit variant
+static Hash128 ComputeHash128(const void* key, size_t size)
+{
+	constexpr uint64_t c1 = 0x87c37b91114253d5ull;
+	constexpr uint64_t c2 = 0x4cf5ad432745937full;
+
+	const uint8_t* data = static_cast<const uint8_t*>(key);
+	const size_t blocksCount = size / 16;
+	uint64_t h1 = 0;
+	uint64_t h2 = 0;
+
+	for (size_t i = 0; i < blocksCount; ++i)
+	{
+		uint64_t k1, k2;
+		memcpy(&k1, data + i * 16, sizeof(k1));
+		memcpy(&k2, data + i * 16 + 8, sizeof(k2));
+
+		k1 *= c1; k1 = Rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = Rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+		k2 *= c2; k2 = Rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = Rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+	}
+
+	const uint8_t* tail = data + blocksCount * 16;
+	const size_t tailSize = size & 15;
+	uint64_t k1 = 0;
+	uint64_t k2 = 0;
+	for (size_t i = tailSize; i > 8; --i)
+		k2 ^= uint64_t(tail[i - 1]) << ((i - 9) * 8);
+	for (size_t i = std::min(tailSize, size_t(8)); i > 0; --i)
+		k1 ^= uint64_t(tail[i - 1]) << ((i - 1) * 8);
+
+	if (tailSize > 8)
+	{
+		k2 *= c2; k2 = Rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+	}
+	if (tailSize > 0)
+	{
+		k1 *= c1; k1 = Rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+	}
+
+	h1 ^= size;
+	h2 ^= size;
+	h1 += h2;
+	h2 += h1;
+	h1 = FMix64(h1);
+	h2 = FMix64(h2);
+	h1 += h2;
+	h2 += h1;
+
+	return { h1, h2 };
+}
+
+static std::string ToHex(uint64_t value)
+{
+	std::stringstream stream;
+	stream << std::hex << std::setw(16) << std::setfill('0') << value;
+	return stream.str();
+}
+
+// Includes are expanded in a single pass. Nested includes are expanded recursively.
+// Every included file is added to `dependencies`
+static bool ParseIncludes(std::string_view source, std::string& result, std::vector<Path>& dependencies, uint32_t depth = 0)
 {
-	const Path cachePath = "Shaders/";
-	const std::string include = "#include ";
-	const size_t includeSize = include.size();
-	std::stringstream buffer;
+	constexpr std::string_view include = "#include ";
+	constexpr uint32_t maxDepth = 32; // Guards against include cycles
 
-	size_t pos = source.find(include);
-	while (pos != std::string::npos)
+	size_t lineStart = 0;
+	while (lineStart < source.size())
 	{
-		size_t endLinePos = source.find_first_of('\n', pos);
+		size_t lineEnd = source.find('\n', lineStart);
+		lineEnd = (lineEnd == std::string_view::npos) ? source.size() : lineEnd + 1;
+		const std::string_view line = source.substr(lineStart, lineEnd - lineStart);
+		lineStart = lineEnd;
+
+		const size_t directiveStart = line.find_first_not_of(" \t");
+		if (directiveStart == std::string_view::npos || line.compare(directiveStart, include.size(), include) != 0)
+		{
+			result.append(line);
+			continue;
+		}
+
+		// File name is enclosed in quotes or angle brackets
+		const size_t nameStart = line.find_first_of("\"<", directiveStart + include.size());
+		const size_t nameEnd = (nameStart == std::string_view::npos) ? std::string_view::npos : line.find_first_of("\">", nameStart + 1);
+		if (nameEnd == std::string_view::npos)
+		{
+			std::cerr << "[Renderer::Vulkan] Invalid include: " << line << '\n';
+			return false;
+		}
 
-		size_t offset = pos + includeSize + 1;
-		std::string filename = source.substr(offset, endLinePos - offset - 1);
-		const Path path = cachePath / filename;
+		const std::string filename(line.substr(nameStart + 1, nameEnd - nameStart - 1));
+		const Path path = s_IncludesPath / filename;
+		if (depth >= maxDepth)
+		{
+			std::cerr << "[Renderer::Vulkan] Includes are nested too deeply, probably an include cycle: " << path << '\n';
+			return false;
+		}
 
-		std::ifstream fin(path);
+		std::ifstream fin(path, std::ios_base::binary | std::ios_base::ate);
 		if (!fin)
 		{
 			std::cout << "Failed to open shader file: " << path << std::endl;
-			return;
+			return false;
 		}
 
-		// Adding defines and reading shader code from the file
-		buffer << "// Include file: " << filename << '\n';
-		buffer << fin.rdbuf();
+		std::string includeSource(size_t(fin.tellg()), '\0');
+		fin.seekg(0, std::ios_base::beg);
+		fin.read(includeSource.data(), includeSource.size());
 		fin.close();
-		std::string includeSource = buffer.str();
-		source.replace(pos, endLinePos - pos + 1, includeSource);
 
-		buffer.str(std::string(""));
-		buffer.clear();
-		pos = source.find("#include ");
+		if (std::find(dependencies.begin(), dependencies.end(), path) == dependencies.end())
+			dependencies.push_back(path);
+
+		result.append("// Include file: ").append(filename).append("\n");
+		if (!ParseIncludes(includeSource, result, dependencies, depth + 1))
+			return false;
+		if (!result.empty() && result.back() != '\n')
+			result.push_back('\n');
+	}
+
+	return true;
+}
+
+// Stale entries of the same shader are removed, so the cache doesn't grow with every edit
+static void RemoveStaleCacheFiles(const Path& cachePath, const std::string& prefix, const Path& currentFile)
+{
+	std::error_code error;
+	for (auto& entry : std::filesystem::directory_iterator(cachePath, error))
+	{
+		const Path& path = entry.path();
+		if (path != currentFile && path.filename().u8string().compare(0, prefix.size(), prefix) == 0)
+			std::filesystem::remove(path, error);
 	}
 }
 
-void VulkanShader::LoadBinary()
+bool VulkanShader::LoadBinary()
 {
-	std::ifstream fin(m_Path);
+	std::ifstream fin(m_Path, std::ios_base::binary | std::ios_base::ate);
 	if (!fin)
 	{
 		std::cout << "Failed to open shader file: " << m_Path << std::endl;
-		return;
+		return false;
 	}
 
-	// Adding defines and reading shader code from the file
-	std::stringstream buffer;
-	buffer << s_ShaderVersion << '\n';
-	for (auto& define : m_Defines)
-		buffer << "#define " << define.first << ' ' << define.second << '\n';
-	buffer << fin.rdbuf();
+	std::string fileSource(size_t(fin.tellg()), '\0');
+	fin.seekg(0, std::ios_base::beg);
+	fin.read(fileSource.data(), fileSource.size());
 	fin.close();
-	std::string source = buffer.str();
-	ParseIncludes(source);
-	const size_t sourceHash = std::hash<std::string>()(source);
-
-	// Trying to find a cache for the shader
-	Path cachePath = Path(Renderer::GetRendererCachePath()) / "Shaders/Vulkan";
-	Path cacheFilePath = cachePath / (m_Path.filename().u8string() + "_" + std::to_string(sourceHash) + ".bin");
-	bool bLoadedFromCache = false;
-	if (std::filesystem::exists(cacheFilePath))
+
+	// Adding defines and expanding includes
+	std::string source;
+	source.reserve(fileSource.size());
+	source.append(s_ShaderVersion).append("\n");
+	for (auto& define : m_Defines)
+		source.append("#define ").append(define.first).append(" ").append(define.second).append("\n");
+
+	m_Dependencies.clear();
+	m_Dependencies.push_back(m_Path);
+	if (!ParseIncludes(fileSource, source, m_Dependencies))
+	{
+		std::cerr << "[Renderer::Vulkan] Failed to expand includes of shader at: " << m_Path << '\n';
+		return false;
+	}
+
+	// Everything that affects the binary is hashed: the expanded source and compiler options
+	const uint32_t options[] = { s_CacheVersion, (uint32_t)Utils::ShaderTypeToShaderC(m_Type), (uint32_t)Utils::GetShaderCVersion(), s_bGenerateDebugInfo, s_bWarningsAsErrors };
+	source.append((const char*)options, sizeof(options));
+	const Hash128 sourceHash = ComputeHash128(source.data(), source.size());
+	source.resize(source.size() - sizeof(options));
+
+	// Cache files of a shader share a prefix that is unique for its path, type and defines
+	std::string identity = m_Path.generic_u8string() + "|" + std::to_string(int(m_Type));
+	for (auto& [name, value] : m_Defines)
+		identity += "|" + name + "=" + value;
+	const std::string cachePrefix = m_Path.filename().u8string() + "_" + ToHex(ComputeHash128(identity.data(), identity.size()).Low) + "_";
+
+	const Path cachePath = Path(Renderer::GetRendererCachePath()) / "Shaders/Vulkan";
+	const Path cacheFilePath = cachePath / (cachePrefix + ToHex(sourceHash.High) + ToHex(sourceHash.Low) + ".bin");
+	if (LoadCache(cacheFilePath, sourceHash))
+		return true;
+
+	// 1) Compile
+	shaderc::Compiler compiler;
+	shaderc::CompileOptions compileOptions;
+	compileOptions.SetTargetEnvironment(shaderc_target_env_vulkan, Utils::GetShaderCVersion());
+	if (s_bWarningsAsErrors)
+		compileOptions.SetWarningsAsErrors();
+	if (s_bGenerateDebugInfo)
+		compileOptions.SetGenerateDebugInfo();
+
+	shaderc::SpvCompilationResult module = compiler.CompileGlslToSpv(source, Utils::ShaderTypeToShaderC(m_Type), m_Path.u8string().c_str(), compileOptions);
+	if (module.GetCompilationStatus() != shaderc_compilation_status_success)
+	{
+		std::cerr << "[Renderer::Vulkan] Failed to compile shader at: " << m_Path << '\n';
+		std::cerr << "Error: \n" << module.GetErrorMessage();
+		assert(false);
+		return false;
+	}
+
+	m_Binary = std::vector<uint32_t>(module.begin(), module.end());
+	Reflect(m_Binary);
+
+	// 2) Write to cache
+	std::lock_guard lock(s_CacheFilesMutex);
+	SaveCache(cacheFilePath, sourceHash);
+	RemoveStaleCacheFiles(cachePath, cachePrefix, cacheFilePath);
+	return true;
+}
+
+// Reads a value of the cache and advances `offset`. Returns false if the cache is too small
+template<typename T>
+static bool ReadCache(const std::vector<uint8_t>& cache, size_t& offset, T* values, size_t count = 1)
+{
+	const size_t size = sizeof(T) * count;
+	if (size > cache.size() - offset)
+		return false;
+
+	memcpy(values, cache.data() + offset, size);
+	offset += size;
+	return true;
+}
+
+template<typename T>
+static void WriteCache(std::vector<uint8_t>& cache, const T* values, size_t count = 1)
+{
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(values);
+	cache.insert(cache.end(), bytes, bytes + sizeof(T) * count);
+}
+
+bool VulkanShader::LoadCache(const Path& cacheFilePath, const Hash128& sourceHash)
+{
+	// Read with a single call
+	std::ifstream in(cacheFilePath, std::ios_base::binary | std::ios_base::ate);
+	if (!in)
+		return false;
+
+	std::vector<uint8_t> cache(size_t(in.tellg()));
+	in.seekg(0, std::ios_base::beg);
+	in.read((char*)cache.data(), cache.size());
+	if (!in)
+		return false;
+	in.close();
+
+	size_t offset = 0;
+	ShaderCacheHeader header;
+	if (!ReadCache(cache, offset, &header) || header.Magic != s_CacheMagic || header.Version != s_CacheVersion || header.SourceHash != sourceHash)
+		return false;
+
+	std::vector<VkVertexInputAttributeDescription> vertexAttribs(header.VertexAttribsCount);
+	if (header.VertexAttribsCount > cache.size() || !ReadCache(cache, offset, vertexAttribs.data(), vertexAttribs.size()))
+		return false;
+
+	if (header.SetsCount > cache.size())
+		return false;
+	std::vector<std::vector<VkDescriptorSetLayoutBinding>> layoutBindings(header.SetsCount);
+	std::vector<ShaderCacheBinding> cachedBindings;
+	for (auto& bindings : layoutBindings)
 	{
-		bLoadedFromCache = true;
-		std::ifstream cacheFin(cacheFilePath, std::ios_base::binary);
-		std::stringstream cacheBuffer;
-		cacheBuffer << cacheFin.rdbuf();
-		cacheFin.close();
-		std::string cacheBinaryStr = cacheBuffer.str();
-
-		size_t strBinarySize = cacheBinaryStr.size();
-		// Binary has uint32 type and string is char. So we divide caches size by 4
-		m_Binary.reserve(strBinarySize / 4);
-		for (size_t i = 0; i < strBinarySize; i += 4)
-			m_Binary.push_back(*(uint32_t*)&cacheBinaryStr[i]); // Reading 4 chars as uint32_t
+		uint32_t bindingsCount = 0;
+		if (!ReadCache(cache, offset, &bindingsCount) || bindingsCount > cache.size())
+			return false;
+
+		cachedBindings.resize(bindingsCount);
+		if (!ReadCache(cache, offset, cachedBindings.data(), cachedBindings.size()))
+			return false;
+
+		bindings.reserve(bindingsCount);
+		for (auto& cached : cachedBindings)
+			bindings.push_back({ cached.Binding, VkDescriptorType(cached.DescriptorType), cached.DescriptorCount, VkShaderStageFlags(cached.StageFlags), nullptr });
 	}
 
-	if (!bLoadedFromCache)
+	std::vector<VkPushConstantRange> pushConstantRanges(header.PushConstantRangesCount);
+	if (header.PushConstantRangesCount > cache.size() || !ReadCache(cache, offset, pushConstantRanges.data(), pushConstantRanges.size()))
+		return false;
+
+	std::vector<uint32_t> binary(header.BinaryWordsCount);
+	if (header.BinaryWordsCount == 0 || header.BinaryWordsCount > cache.size() || !ReadCache(cache, offset, binary.data(), binary.size()) || offset != cache.size())
+		return false;
+
+	m_Binary = std::move(binary);
+	m_VertexAttribs = std::move(vertexAttribs);
+	m_LayoutBindings = std::move(layoutBindings);
+	m_PushConstantRanges = std::move(pushConstantRanges);
+	return true;
+}
+
+// Writes into a temporary file first and then replaces the old cache with it
+void VulkanShader::SaveCache(const Path& cacheFilePath, const Hash128& sourceHash) const
+{
+	ShaderCacheHeader header;
+	header.SourceHash = sourceHash;
+	header.BinaryWordsCount = (uint32_t)m_Binary.size();
+	header.VertexAttribsCount = (uint32_t)m_VertexAttribs.size();
+	header.SetsCount = (uint32_t)m_LayoutBindings.size();
+	header.PushConstantRangesCount = (uint32_t)m_PushConstantRanges.size();
+
+	std::vector<uint8_t> cache;
+	WriteCache(cache, &header);
+	WriteCache(cache, m_VertexAttribs.data(), m_VertexAttribs.size());
+	for (auto& bindings : m_LayoutBindings)
 	{
-		// 1) Compile
-		shaderc::Compiler compiler;
-		shaderc::CompileOptions options;
-		options.SetTargetEnvironment(shaderc_target_env_vulkan, Utils::GetShaderCVersion());
-		options.SetWarningsAsErrors();
-		options.SetGenerateDebugInfo();
-
-		shaderc::SpvCompilationResult module = compiler.CompileGlslToSpv(source, Utils::ShaderTypeToShaderC(m_Type), m_Path.u8string().c_str(), options);
-		if (module.GetCompilationStatus() != shaderc_compilation_status_success)
+		const uint32_t bindingsCount = (uint32_t)bindings.size();
+		WriteCache(cache, &bindingsCount);
+		for (auto& binding : bindings)
 		{
-			std::cerr << "[Renderer::Vulkan] Failed to compile shader at: " << m_Path << '\n';
-			std::cerr << "Error: \n" << module.GetErrorMessage();
-			assert(false);
+			const ShaderCacheBinding cached{ binding.binding, (uint32_t)binding.descriptorType, binding.descriptorCount, (uint32_t)binding.stageFlags };
+			WriteCache(cache, &cached);
 		}
+	}
+	WriteCache(cache, m_PushConstantRanges.data(), m_PushConstantRanges.size());
+	WriteCache(cache, m_Binary.data(), m_Binary.size());
 
-		m_Binary = std::vector<uint32_t>(module.begin(), module.end());
+	std::error_code error;
+	std::filesystem::create_directories(cacheFilePath.parent_path(), error);
 
-		// 2) Write to cache
-		if (!std::filesystem::exists(cachePath))
-			std::filesystem::create_directories(cachePath);
+	Path tempPath = cacheFilePath;
+	tempPath += ".tmp";
 
-		std::ofstream out(cacheFilePath, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
-		out.write((const char*)m_Binary.data(), m_Binary.size() * sizeof(uint32_t));
-		out.close();
-	}
+	std::ofstream out(tempPath, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+	out.write((const char*)cache.data(), cache.size());
+	out.close();
 
-	Reflect(m_Binary);
+	if (out)
+		std::filesystem::rename(tempPath, cacheFilePath, error);
+	if (!out || error)
+		std::cerr << "[Renderer::Vulkan] Failed to write shader cache " << cacheFilePath << '\n';
 }
 
 void VulkanShader::Reflect(const std::vector<uint32_t>& binary)
@@ -387,6 +662,8 @@ void VulkanShader::CreateShaderModule()
 		m_ShaderModule = VK_NULL_HANDLE;
 	}
 
+	m_BinaryHash = ComputeHash128(m_Binary.data(), m_Binary.size() * sizeof(uint32_t));
+
 	VkShaderModuleCreateInfo ci{};
 	ci.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
 	ci.codeSize = m_Binary.size() * sizeof(uint32_t);
@@ -30,6 +30,15 @@ struct ShaderSpecializationInfo
 
 using ShaderDefines = std::vector<std::pair<std::string, std::string>>;
 
+struct Hash128
+{
+	uint64_t Low = 0;
+	uint64_t High = 0;
+
+	bool operator==(const Hash128& other) const { return Low == other.Low && High == other.High; }
+	bool operator!=(const Hash128& other) const { return !(*this == other); }
+};
+
 class VulkanShader
 {
 public:
@@ -43,21 +52,36 @@ public:
 	const std::vector<std::vector<VkDescriptorSetLayoutBinding>>& GeLayoutSetBindings() const { return m_LayoutBindings; }
 
 	ShaderType GetType() const { return m_Type; }
+	const std::filesystem::path& GetPath() const { return m_Path; }
+	const ShaderDefines& GetDefines() const { return m_Defines; }
+
+	// Hash of the SPIR-V binary. Shaders with equal hashes are interchangeable in pipelines
+	const Hash128& GetBinaryHash() const { return m_BinaryHash; }
+
+	// Files that the binary was compiled from: the shader and its includes. Shader should be reloaded if any of them changes
+	const std::vector<std::filesystem::path>& GetDependencies() const { return m_Dependencies; }
 
 	void Reload();
 
 private:
-	void LoadBinary();
+	// Returns false if the shader can't be read, its includes can't be expanded or it fails to compile. `m_Binary` is left as is then
+	bool LoadBinary();
 	void CreateShaderModule();
 	void Reflect(const std::vector<uint32_t>& binary);
 
+	// Cache contains the binary with its reflection, so a warm load doesn't reflect anything. Returns false if the cache is missing or invalid
+	bool LoadCache(const std::filesystem::path& cacheFilePath, const Hash128& sourceHash);
+	void SaveCache(const std::filesystem::path& cacheFilePath, const Hash128& sourceHash) const;
+
 private:
 	std::filesystem::path m_Path;
 	ShaderDefines m_Defines;
+	std::vector<std::filesystem::path> m_Dependencies;
 	std::vector<VkVertexInputAttributeDescription> m_VertexAttribs;
 	std::vector<std::vector<VkDescriptorSetLayoutBinding>> m_LayoutBindings; // Set -> Bindings
 	std::vector<VkPushConstantRange> m_PushConstantRanges;
 	std::vector<uint32_t> m_Binary;
+	Hash128 m_BinaryHash;
 	VkShaderModule m_ShaderModule = VK_NULL_HANDLE;
 	VkPipelineShaderStageCreateInfo m_PipelineShaderStageCI;
 	ShaderType m_Type;
@@ -1,6 +1,7 @@
 #include "VulkanStagingManager.h"
 
 #include <vector>
+#include <algorithm>
 
 //------------------
 // Staging Manager
@@ -14,7 +15,7 @@ VulkanStagingBuffer* VulkanStagingManager::AcquireBuffer(size_t size, bool bIsCP
 
 	for (auto& staging : s_StagingBuffers)
 	{
-		if (staging->IsCPURead() == bIsCPURead && size <= staging->GetSize())
+		if (staging->IsCPURead() == bIsCPURead && !staging->IsPinned() && size <= staging->GetSize())
 		{
 			if (staging->m_State == StagingBufferState::Free)
 			{
@@ -23,8 +24,7 @@ VulkanStagingBuffer* VulkanStagingManager::AcquireBuffer(size_t size, bool bIsCP
 			}
 			else if (staging->m_State == StagingBufferState::InFlight)
 			{
-				assert(staging->m_Fence);
-				if (staging->m_Fence->IsSignaled())
+				if (staging->IsSubmissionCompleted())
 				{
 					stagingBuffer = staging;
 					break;
@@ -49,9 +49,11 @@ void VulkanStagingManager::ReleaseBuffers()
 	auto it = s_StagingBuffers.begin();
 	while (it != s_StagingBuffers.end())
 	{
-		if ((*it)->m_State == StagingBufferState::Free)
+		if ((*it)->IsPinned())
+			++it;
+		else if ((*it)->m_State == StagingBufferState::Free)
 			it = s_StagingBuffers.erase(it);
-		else if ((*it)->m_State == StagingBufferState::InFlight && (*it)->m_Fence->IsSignaled())
+		else if ((*it)->m_State == StagingBufferState::InFlight && (*it)->IsSubmissionCompleted())
 		{
 			delete (*it);
 			it = s_StagingBuffers.erase(it);
@@ -74,3 +76,56 @@ VulkanStagingBuffer::VulkanStagingBuffer(size_t size, bool bIsCPURead)
 
 	m_Buffer = new VulkanBuffer(specs);
 }
+
+bool VulkanStagingBuffer::IsSubmissionCompleted() const
+{
+	assert(m_Fence);
+	return m_Fence->GetResetCount() != m_FenceResetCount || m_Fence->IsSignaled();
+}
+
+void VulkanStagingBuffer::WaitSubmission() const
+{
+	assert(m_Fence);
+	if (m_Fence->GetResetCount() == m_FenceResetCount)
+		m_Fence->Wait();
+}
+
+//------------------
+// Readback Future
+//------------------
+VulkanReadbackFuture::VulkanReadbackFuture(VulkanStagingBuffer* stagingBuffer, size_t size)
+	: m_StagingBuffer(stagingBuffer)
+	, m_Size(size)
+{
+	assert(m_StagingBuffer->IsCPURead());
+	assert(m_Size <= m_StagingBuffer->GetSize());
+	m_StagingBuffer->SetPinned(true);
+}
+
+VulkanReadbackFuture::~VulkanReadbackFuture()
+{
+	m_StagingBuffer->SetPinned(false);
+}
+
+bool VulkanReadbackFuture::IsReady() const
+{
+	// Fence is set when the command buffer is submitted
+	return m_StagingBuffer->GetFence() && m_StagingBuffer->IsSubmissionCompleted();
+}
+
+void VulkanReadbackFuture::Wait() const
+{
+	// Command buffer must be submitted before waiting on it
+	assert(m_StagingBuffer->GetFence());
+	if (m_StagingBuffer->GetFence())
+		m_StagingBuffer->WaitSubmission();
+}
+
+void VulkanReadbackFuture::Get(void* data, size_t size) const
+{
+	Wait();
+
+	void* mapped = m_StagingBuffer->Map();
+	memcpy(data, mapped, std::min(size, m_Size));
+	m_StagingBuffer->Unmap();
+}
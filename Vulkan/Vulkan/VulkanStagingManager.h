@@ -26,13 +26,17 @@ public:
 	{
 		m_Buffer = other.m_Buffer;
 		m_Fence = other.m_Fence;
+		m_FenceResetCount = other.m_FenceResetCount;
 		m_State = other.m_State;
 		m_bIsCPURead = other.m_bIsCPURead;
+		m_bPinned = other.m_bPinned;
 
 		other.m_Buffer = nullptr;
 		other.m_Fence.reset();
+		other.m_FenceResetCount = 0;
 		other.m_State = StagingBufferState::Free;
 		other.m_bIsCPURead = false;
+		other.m_bPinned = false;
 	}
 	VulkanStagingBuffer& operator=(VulkanStagingBuffer&& other) noexcept
 	{
@@ -41,13 +45,17 @@ public:
 
 		m_Buffer = other.m_Buffer;
 		m_Fence = other.m_Fence;
+		m_FenceResetCount = other.m_FenceResetCount;
 		m_State = other.m_State;
 		m_bIsCPURead = other.m_bIsCPURead;
+		m_bPinned = other.m_bPinned;
 
 		other.m_Buffer = nullptr;
 		other.m_Fence.reset();
+		other.m_FenceResetCount = 0;
 		other.m_State = StagingBufferState::Free;
 		other.m_bIsCPURead = false;
+		other.m_bPinned = false;
 
 		return *this;
 	}
@@ -56,14 +64,27 @@ public:
 	void Unmap() { m_Buffer->Unmap(); }
 
 	void SetState(StagingBufferState state) { m_State = state; }
-	void SetFence(const Ref<VulkanFence>& fence) { m_Fence = fence; }
+	void SetFence(const Ref<VulkanFence>& fence)
+	{
+		m_Fence = fence;
+		m_FenceResetCount = fence ? fence->GetResetCount() : 0;
+	}
 	Ref<VulkanFence>& GetFence() { return m_Fence; }
 	const Ref<VulkanFence>& GetFence() const { return m_Fence; }
 
+	// Fence can be reset and reused by later submissions, so these only check the submission that the buffer was used in.
+	// Buffer must be submitted
+	bool IsSubmissionCompleted() const;
+	void WaitSubmission() const;
+
 	StagingBufferState GetState() const { return m_State; }
 	size_t GetSize() const { return m_Buffer->GetSize(); }
 	bool IsCPURead() const { return m_bIsCPURead; }
 
+	// Pinned buffers are not reused until unpinned. Used to keep readback data alive until it's consumed
+	void SetPinned(bool bPinned) { m_bPinned = bPinned; }
+	bool IsPinned() const { return m_bPinned; }
+
 	VulkanBuffer* GetBuffer() { return m_Buffer; }
 	const VulkanBuffer* GetBuffer() const { return m_Buffer; }
 
@@ -72,12 +93,39 @@ public:
 private:
 	VulkanBuffer* m_Buffer = nullptr;
 	Ref<VulkanFence> m_Fence = nullptr;
+	uint64_t m_FenceResetCount = 0; // Reset count of `m_Fence` when the buffer was submitted
 	StagingBufferState m_State = StagingBufferState::Free;
 	bool m_bIsCPURead = false;
+	bool m_bPinned = false;
 
 	friend class VulkanStagingManager;
 };
 
+// Result of an asynchronous GPU -> CPU copy.
+// Becomes ready once the submission that contains the copy has completed. It never blocks unless `Wait` or `Get` is called.
+// Must be destroyed before `VulkanStagingManager::ReleaseBuffers` is called on shutdown
+class VulkanReadbackFuture
+{
+public:
+	VulkanReadbackFuture(VulkanStagingBuffer* stagingBuffer, size_t size);
+	virtual ~VulkanReadbackFuture();
+
+	VulkanReadbackFuture(const VulkanReadbackFuture&) = delete;
+	VulkanReadbackFuture& operator=(const VulkanReadbackFuture&) = delete;
+
+	// Returns false if the command buffer wasn't submitted yet or the GPU hasn't finished executing it
+	bool IsReady() const;
+	void Wait() const;
+
+	// Blocks until ready. Copies min(size, GetSize()) bytes
+	void Get(void* data, size_t size) const;
+	size_t GetSize() const { return m_Size; }
+
+private:
+	VulkanStagingBuffer* m_StagingBuffer = nullptr;
+	size_t m_Size = 0;
+};
+
 class VulkanStagingManager
 {
 public:
@@ -1,9 +1,7 @@
 #include "VulkanTexture2D.h"
 #include "VulkanSampler.h"
-#include "VulkanFence.h"
-#include "VulkanCommandManager.h"
-
-#include "../Renderer/Renderer.h"
+#include "VulkanUploadManager.h"
+#include "VulkanBindlessHeap.h"
 
 #include "../stb_image.h"
 
@@ -46,22 +44,16 @@ VulkanTexture2D::VulkanTexture2D(const Path& path, const Texture2DSpecifications
 		ImageSpecifications imageSpecs;
 		imageSpecs.Size = glm::uvec3{ m_Width, m_Height, 1 };
 		imageSpecs.Format = m_Format;
-		imageSpecs.Usage = ImageUsage::Sampled | ImageUsage::TransferDst; // To sample in shader and to write texture data to it
-		imageSpecs.Layout = ImageLayoutType::CopyDest; // Since we're about to write texture data to it
+		imageSpecs.Usage = ImageUsage::Sampled | ImageUsage::TransferSrc | ImageUsage::TransferDst; // To sample in shader, to write texture data to it and to be moved by defragmentation
+		imageSpecs.Layout = ImageLayoutType::Unknown; // Transitioned by the upload
 		imageSpecs.SamplesCount = m_Specs.SamplesCount;
 		imageSpecs.MipsCount =  mipsCount;
 		m_Image = new VulkanImage(imageSpecs, m_Path.filename().u8string());
 
-		Ref<VulkanFence> writeFence = MakeRef<VulkanFence>();
-		auto cmdManager = Renderer::GetGraphicsCommandManager();
-		auto cmd = cmdManager->AllocateCommandBuffer();
-		cmd.Write(m_Image, m_ImageData.Data, m_ImageData.Size, ImageLayoutType::CopyDest, ImageReadAccess::PixelShaderRead);
-		cmd.End();
-		cmdManager->Submit(&cmd, 1, writeFence, nullptr, 0, nullptr, 0);
+		VulkanUploadManager::Write(m_Image, m_ImageData.Data, m_ImageData.Size, ImageReadAccess::PixelShaderRead);
 
 		m_Sampler = new VulkanSampler(m_Specs.FilterMode, m_Specs.AddressMode, CompareOperation::Never, 0.f, mipsCount > 1 ? float(mipsCount) : 0.f, m_Specs.MaxAnisotropy);
-
-		writeFence->Wait();
+		m_BindlessIndex = VulkanBindlessHeap::RegisterTexture(m_Image, m_Sampler);
 	}
 	else
 	{
@@ -89,28 +81,24 @@ VulkanTexture2D::VulkanTexture2D(ImageFormat format, glm::uvec2 size, const void
 	imageSpecs.Format = m_Format;
 	imageSpecs.Size = glm::uvec3{ m_Width, m_Height, 1 };
 	imageSpecs.MipsCount = mipsCount;
-	imageSpecs.Usage = ImageUsage::Sampled | ImageUsage::TransferDst;
-	imageSpecs.Layout = ImageLayoutType::CopyDest; // Since we're about to write texture data to it
+	imageSpecs.Usage = ImageUsage::Sampled | ImageUsage::TransferSrc | ImageUsage::TransferDst;
+	imageSpecs.Layout = ImageLayoutType::Unknown; // Transitioned by the upload
 	imageSpecs.SamplesCount = m_Specs.SamplesCount;
 	m_Image = new VulkanImage(imageSpecs);
 
 	if (data)
 	{
 		m_ImageData = DataBuffer::Copy(data, dataSize);
-		Ref<VulkanFence> writeFence = MakeRef<VulkanFence>();
-		auto cmdManager = Renderer::GetGraphicsCommandManager();
-		auto cmd = cmdManager->AllocateCommandBuffer();
-		cmd.Write(m_Image, m_ImageData.Data, m_ImageData.Size, ImageLayoutType::CopyDest, ImageReadAccess::PixelShaderRead);
-		cmd.End();
-		cmdManager->Submit(&cmd, 1, writeFence, nullptr, 0, nullptr, 0);
+		VulkanUploadManager::Write(m_Image, m_ImageData.Data, m_ImageData.Size, ImageReadAccess::PixelShaderRead);
 
 		m_Sampler = new VulkanSampler(m_Specs.FilterMode, m_Specs.AddressMode, CompareOperation::Never, 0.f, mipsCount > 1 ? float(mipsCount) : 0.f, m_Specs.MaxAnisotropy);
-		writeFence->Wait();
+		m_BindlessIndex = VulkanBindlessHeap::RegisterTexture(m_Image, m_Sampler);
 	}
 }
 
 VulkanTexture2D::~VulkanTexture2D()
 {
+	VulkanBindlessHeap::UnregisterTexture(m_BindlessIndex);
 	if (m_Image)
 	{
 		delete m_Image;
@@ -34,6 +34,9 @@ public:
     uint32_t GetWidth() const { return m_Width; }
     uint32_t GetHeight() const { return m_Height; }
 
+    // Index of the texture in the bindless heap. `uint32_t(-1)` if the texture is not registered
+    uint32_t GetBindlessIndex() const { return m_BindlessIndex; }
+
 private:
     bool Load(Path& path);
 
@@ -46,4 +49,5 @@ private:
     ImageFormat m_Format = ImageFormat::Unknown;
     uint32_t m_Width = 0;
     uint32_t m_Height = 0;
+    uint32_t m_BindlessIndex = uint32_t(-1);
 };
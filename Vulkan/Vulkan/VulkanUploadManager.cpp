@@ -0,0 +1,180 @@
+#include "VulkanUploadManager.h"
+#include "VulkanContext.h"
+#include "VulkanCommandManager.h"
+#include "VulkanImage.h"
+#include "VulkanBuffer.h"
+
+#include <vector>
+
+struct UploadBatch
+{
+	UploadBatch(VulkanCommandManager* commandManager)
+		: Cmd(commandManager->AllocateCommandBuffer(false))
+		, TransferFence(MakeRef<VulkanFence>(true))
+	{}
+
+	// Batch can be reused once the transfer queue is done with it and the graphics queue is done waiting on its semaphore
+	bool IsFree()
+	{
+		if (!TransferFence->IsSignaled())
+			return false;
+		if (GraphicsFence && !GraphicsFence->IsSignaled())
+			return false;
+
+		GraphicsFence.reset();
+		return true;
+	}
+
+	VulkanCommandBuffer Cmd;
+	VulkanSemaphore Semaphore;
+	Ref<VulkanFence> TransferFence;
+	Ref<VulkanFence> GraphicsFence; // Fence of the graphics submission that waits on `Semaphore`
+};
+
+struct ImageAcquire
+{
+	VulkanImage* Image;
+	ImageLayout OldLayout;
+	ImageLayout NewLayout;
+};
+
+struct BufferAcquire
+{
+	VulkanBuffer* Buffer;
+	BufferLayout NewLayout;
+};
+
+struct VulkanUploadManagerData
+{
+	VulkanCommandManager* CommandManager = nullptr;
+	std::vector<UploadBatch*> Batches;
+	UploadBatch* CurrentBatch = nullptr;
+
+	std::vector<ImageAcquire> ImageAcquires;
+	std::vector<BufferAcquire> BufferAcquires;
+
+	uint32_t TransferFamilyIndex = uint32_t(-1);
+	uint32_t GraphicsFamilyIndex = uint32_t(-1);
+	bool bDedicatedTransferQueue = false;
+};
+
+static VulkanUploadManagerData* s_Data = nullptr;
+
+static UploadBatch* GetCurrentBatch()
+{
+	if (s_Data->CurrentBatch)
+		return s_Data->CurrentBatch;
+
+	UploadBatch* batch = nullptr;
+	for (auto& it : s_Data->Batches)
+	{
+		if (it->IsFree())
+		{
+			batch = it;
+			break;
+		}
+	}
+
+	if (!batch)
+	{
+		batch = new UploadBatch(s_Data->CommandManager);
+		s_Data->Batches.push_back(batch);
+	}
+
+	batch->TransferFence->Reset();
+	batch->Cmd.Begin();
+	s_Data->CurrentBatch = batch;
+
+	return batch;
+}
+
+void VulkanUploadManager::Init()
+{
+	s_Data = new VulkanUploadManagerData();
+
+	const QueueFamilyIndices& indices = VulkanContext::GetDevice()->GetPhysicalDevice()->GetFamilyIndices();
+	s_Data->TransferFamilyIndex = indices.TransferFamily;
+	s_Data->GraphicsFamilyIndex = indices.GraphicsFamily;
+	s_Data->bDedicatedTransferQueue = indices.TransferFamily != indices.GraphicsFamily;
+
+	// If there's no dedicated transfer queue, uploads are recorded for the graphics queue and no ownership transfer is required
+	s_Data->CommandManager = new VulkanCommandManager(s_Data->bDedicatedTransferQueue ? CommandQueueFamily::Transfer : CommandQueueFamily::Graphics, true);
+
+	if (!s_Data->bDedicatedTransferQueue)
+		std::cout << "[Vulkan upload manager] No dedicated transfer queue. Uploading on the graphics queue\n";
+}
+
+void VulkanUploadManager::Shutdown()
+{
+	if (s_Data->CurrentBatch)
+		std::cerr << "[Vulkan upload manager] Shutting down with pending uploads!\n";
+
+	for (auto& batch : s_Data->Batches)
+	{
+		batch->TransferFence->Wait();
+		delete batch;
+	}
+	s_Data->Batches.clear();
+
+	delete s_Data->CommandManager;
+	delete s_Data;
+	s_Data = nullptr;
+}
+
+void VulkanUploadManager::Write(VulkanBuffer* buffer, const void* data, size_t size, BufferLayout finalLayout)
+{
+	assert(size <= buffer->GetSize());
+	VulkanCommandBuffer& cmd = GetCurrentBatch()->Cmd;
+
+	if (!s_Data->bDedicatedTransferQueue)
+	{
+		cmd.Write(buffer, data, size, 0, BufferLayoutType::Unknown, finalLayout);
+		return;
+	}
+
+	cmd.Write(buffer, data, size, 0, BufferLayoutType::Unknown, BufferLayoutType::CopyDest);
+	cmd.ReleaseOwnership(buffer, BufferLayoutType::CopyDest, s_Data->GraphicsFamilyIndex);
+	s_Data->BufferAcquires.push_back({ buffer, finalLayout });
+}
+
+void VulkanUploadManager::Write(VulkanImage* image, const void* data, size_t size, ImageLayout finalLayout)
+{
+	VulkanCommandBuffer& cmd = GetCurrentBatch()->Cmd;
+
+	if (!s_Data->bDedicatedTransferQueue)
+	{
+		cmd.Write(image, data, size, ImageLayoutType::Unknown, finalLayout);
+		return;
+	}
+
+	cmd.Write(image, data, size, ImageLayoutType::Unknown, ImageLayoutType::CopyDest);
+	cmd.ReleaseOwnership(image, ImageLayoutType::CopyDest, finalLayout, s_Data->GraphicsFamilyIndex);
+	s_Data->ImageAcquires.push_back({ image, ImageLayoutType::CopyDest, finalLayout });
+}
+
+bool VulkanUploadManager::HasPendingUploads()
+{
+	return s_Data->CurrentBatch != nullptr;
+}
+
+const VulkanSemaphore* VulkanUploadManager::Submit(VulkanCommandBuffer* graphicsCmd, const Ref<VulkanFence>& graphicsFence)
+{
+	UploadBatch* batch = s_Data->CurrentBatch;
+	if (!batch)
+		return nullptr;
+
+	batch->Cmd.End();
+	s_Data->CommandManager->Submit(&batch->Cmd, 1, batch->TransferFence, nullptr, 0, &batch->Semaphore, 1);
+	batch->GraphicsFence = graphicsFence;
+
+	for (auto& acquire : s_Data->BufferAcquires)
+		graphicsCmd->AcquireOwnership(acquire.Buffer, acquire.NewLayout, s_Data->TransferFamilyIndex);
+	for (auto& acquire : s_Data->ImageAcquires)
+		graphicsCmd->AcquireOwnership(acquire.Image, acquire.OldLayout, acquire.NewLayout, s_Data->TransferFamilyIndex);
+
+	s_Data->BufferAcquires.clear();
+	s_Data->ImageAcquires.clear();
+	s_Data->CurrentBatch = nullptr;
+
+	return &batch->Semaphore;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Vulkan.h"
+#include "../Renderer/RendererUtils.h"
+
+class VulkanCommandBuffer;
+class VulkanSemaphore;
+class VulkanFence;
+class VulkanImage;
+class VulkanBuffer;
+
+// Records resource uploads on a dedicated transfer queue (if present) so they don't stall the graphics queue.
+// Uploaded resources are released to the graphics queue family and acquired by the graphics command buffer passed to `Submit`
+class VulkanUploadManager
+{
+public:
+	VulkanUploadManager() = delete;
+
+	static void Init();
+	static void Shutdown();
+
+	// Writes the whole buffer starting at offset 0. Buffer must not be in use by the GPU.
+	// @finalLayout. Layout in which the buffer is acquired by the graphics queue
+	static void Write(VulkanBuffer* buffer, const void* data, size_t size, BufferLayout finalLayout);
+
+	// Writes the first mip of the image. Previous contents of the image are discarded. Image must not be in use by the GPU.
+	// @finalLayout. Layout in which the image is acquired by the graphics queue
+	static void Write(VulkanImage* image, const void* data, size_t size, ImageLayout finalLayout);
+
+	static bool HasPendingUploads();
+
+	// Submits all recorded uploads to the transfer queue and records acquire barriers into `graphicsCmd`.
+	// @graphicsFence. Fence that will be signaled by the submission of `graphicsCmd`. Used to know when upload resources can be reused
+	// Returns a semaphore that the submission of `graphicsCmd` must wait on. nullptr if there was nothing to upload
+	static const VulkanSemaphore* Submit(VulkanCommandBuffer* graphicsCmd, const Ref<VulkanFence>& graphicsFence);
+};
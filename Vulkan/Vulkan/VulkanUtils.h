@@ -418,7 +418,7 @@ inline void GetTransitionStagesAndAccesses(
 	else if (oldLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
 	{
 		*outSrcAccess = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-		*outSrcStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+		*outSrcStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT; // Writes happen in late tests
 	}
 	else if (oldLayout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL)
 	{
@@ -776,6 +776,18 @@ inline VkCullModeFlags CullModeToVulkan(CullMode mode)
 	}
 }
 
+inline VkFrontFace FrontFaceToVulkan(FrontFace frontFace)
+{
+	switch (frontFace)
+	{
+		case FrontFace::CounterClockwise: return VK_FRONT_FACE_COUNTER_CLOCKWISE;
+		case FrontFace::Clockwise		: return VK_FRONT_FACE_CLOCKWISE;
+		default:
+			assert(!"Unsupported front face");
+			return VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	}
+}
+
 inline void FilterModeToVulkan(FilterMode filterMode, VkFilter* outMinFilter, VkFilter* outMagFilter, VkSamplerMipmapMode* outMipmapMode)
 {
 	switch (filterMode)